@@ -0,0 +1,904 @@
+/**
+ * @brief Frame-capture workload replayed on the simulated card (host build)
+ * @note g++ -std=c++17 -O2 -DISACFS_HOST -Iinclude src/isacfs.cpp src/isacfs_os.cpp src/isacfs_async.cpp src/isacfs_stripe.cpp src/isacfs_delta.cpp src/isacfs_streams.cpp src/isacfs_preview.cpp src/isacfs_stats.cpp src/microSD.cpp src/microSD_sim.cpp bench/isacfs_bench.cpp -lpthread -o isacfs_bench
+ * @note usage: isacfs_bench [-i image] [-s sectors] [-n frames] [-z size,size,...] [-j jitter%] [-m] [-F] [-L] [-R] [-T] [-a avg_size] [-g segment_size] [-S] [-c cards] [-t streams] [-p preview_size] [-d key_interval] [-v] [-E distance] [-U] [-V]
+ * @note -S prints the isacfs instrumentation after every run (build with -DISACFS_STATS), timed in the simulated time of the card
+ * @note -T formats for 16B descriptors (the 10 fps frames get their milliseconds and sequence numbers)
+ * @note -R records in a loop (isacfs_layout_loop) - "-n" may exceed the card, the oldest frames make room
+ * @note -c stripes the frames over that many card images (image.0, image.1, ...), the slowest card sets the time
+ * @note -t writes the frames of that many cameras into streams on the one card image, a writer task each (frame i goes
+ *       to the stream i % streams, the cameras capture at the same instants); with -R, each stream loops over an equal share
+ *       of the card
+ * @note -p writes a preview of that many bytes with every frame into a stream of its own next to the frames, then scrubs
+ *       through the recording - all the frames with isacfs_read_range against all the previews with isacfs_preview_range
+ * @note -d writes through the delta stage with a key frame every "key_interval" frames, a sixteenth of every frame changing
+ * @note -v writes every frame in the pieces a camera driver hands over (a JPEG header, the body in DMA chunks, a trailer)
+ *       with isacfs_write_filev
+ * @note -E erases "distance" bytes ahead of the write head in the idle time between the frames of the 10 fps camera
+ *       (isacfs_preerase_step) - an erase running past the next frame delays it, and that counts in its latency
+ * @note -U starts with a used card - every sector holds old data, writing over it costs more until it is erased
+ * @note -V reads the recording back with isacfs_iter (decoding the deltas of -d) and compares every frame with the one
+ *       written - with -R, the frames still in the loop; with -c and -t every card and stream on its own, with -p the
+ *       previews as well
+*/
+#include "isacfs.hpp"
+#include "isacfs_delta.hpp"
+#include "isacfs_os.hpp"
+#include "isacfs_preview.hpp"
+#include "isacfs_stats.hpp"
+#include "isacfs_stripe.hpp"
+#include "isacfs_streams.hpp"
+#include "microSD_sim.hpp"
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+
+#define BENCH_MAX_CARDS 0x8
+#define BENCH_QUEUE_LEN 0x10
+#define BENCH_IOV_HEADER 623U // the pieces of a frame with -v
+#define BENCH_IOV_TRAILER 64U
+#define BENCH_IOV_CHUNK 0x1000U
+#define BENCH_SCRUB_BUFFER 0x80000U // the read buffer of the scrubbing with -p
+#define BENCH_FRAME_INTERVAL_US 100000U // 10 fps, like the timestamps
+
+typedef struct {
+    const char* image_path;
+    size_t sector_count;
+    u32 frames;
+    std::vector<u32> frame_sizes;
+    u32 jitter_pct;
+    bool use_mmap;
+    isacfs_format_mode_t format_mode;
+    isacfs_layout_t layout;
+    isacfs_desc_format_t desc_format;
+    u32 avg_file_size; // 0 - the frame size of the run
+    u32 segment_size; // group commit (0 - off)
+    bool print_stats;
+    u32 cards; // >1 - striped over that many card images
+    u32 streams; // >1 - that many streams on the card image
+    u32 preview_size; // >0 - a preview that big with every frame
+    u32 key_interval; // >0 - through the delta stage
+    bool pieces; // isacfs_write_filev
+    u32 preerase; // >0 - erase that many bytes ahead of the write head in the idle time
+    bool used_card; // every sector holds old data at the start
+    bool verify; // read the frames back after the run
+} bench_config_t;
+
+/* a card of a striped run (a stream of a multi-stream run) - the write latency of a frame is the simulated time its card spent since the previous one */
+typedef struct {
+    micro_sd_sim_t* sim;
+    u64 last_clock_us;
+    std::vector<u64>* latency_us;
+    std::mutex* latency_lock;
+    u32 written; // the frames written to it (a full card fails the rest)
+} bench_card_t;
+
+static void __bench_timestamp(u32 frame_no, isacfs_file_meta* file_meta){
+    u32 t = frame_no / 10U; // 10 fps
+    file_meta->millisecond = (frame_no % 10U) * 100U;
+    file_meta->year_diff = 0x0;
+    file_meta->second = t % 60U;
+    t /= 60U;
+    file_meta->minute = t % 60U;
+    t /= 60U;
+    file_meta->hour = t % 24U;
+    t /= 24U;
+    file_meta->day = 1U + t % 28U;
+    file_meta->month = 1U + (t / 28U) % 12U;
+}
+
+/**
+ * @brief FNV-1a of the bytes of a frame, continued from "hash" (a frame in pieces is hashed one piece after another)
+*/
+static u64 __bench_hash(const u8* data, u32 size, u64 hash = 0xCBF29CE484222325ULL){
+    for(u32 i = 0x0; i < size; i++){
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Read the frames of the bound instance back in the recording order && compare them with the hashes of the frames written
+ * @note The frames in the log are the newest ones written - the loop drops them from the oldest end
+ * @param label tells the cards and streams of a run apart in the printout ("" - a single card)
+ * @returns the number of the frames that don't match
+*/
+static u32 __bench_verify(const bench_config_t* cfg, u32 max_size, const std::vector<u64>& written_hashes, const char* label = ""){
+    isacfs_iter_t* iter = NULL;
+    isacfs_delta_t* delta = NULL;
+    if(isacfs_iter_open(&iter, UNKNOWN_SECTOR, UNKNOWN_OFFSET, true, ISACFS_DELTA_HEADER_SIZE + max_size) != ESP_OK
+       || (cfg->key_interval && isacfs_delta_open(&delta, max_size, cfg->key_interval) != ESP_OK)){
+        fprintf(stderr, "cannot open the recording for reading\n");
+        if(iter){
+            isacfs_iter_close(iter);
+        }
+        return 0x1;
+    }
+    std::vector<u64> read_hashes;
+    u32 undecodable = 0x0; // -d -R: the deltas ahead of the first key frame left in the loop
+    u32 bad = 0x0;
+    isacfs_file_meta file_meta;
+    const u8* data;
+    esp_err_t res;
+    while((res = isacfs_iter_next(iter, &file_meta, &data)) == ESP_OK){
+        u32 size = file_meta.size;
+        if(delta){
+            res = isacfs_delta_decode(delta, data, file_meta.size, &data, &size);
+            if(res == ESP_ERR_INVALID_STATE && read_hashes.empty() && cfg->layout == isacfs_layout_loop){
+                undecodable++;
+                continue;
+            }
+            if(res != ESP_OK){
+                bad++;
+                data = NULL;
+                size = 0x0;
+            }
+        }
+        read_hashes.push_back(data ? __bench_hash(data, size) : 0x0);
+    }
+    isacfs_iter_close(iter);
+    if(delta){
+        isacfs_delta_close(delta);
+    }
+    size_t live = read_hashes.size() + undecodable;
+    if(res != ESP_ERR_NOT_FOUND || live > written_hashes.size() || (cfg->layout != isacfs_layout_loop && live != written_hashes.size())){
+        bad++; // a broken log, or frames missing from it
+    }
+    size_t first = written_hashes.size() - std::min(written_hashes.size(), read_hashes.size());
+    for(size_t i = 0x0; i < read_hashes.size() && first + i < written_hashes.size(); i++){
+        bad += read_hashes[i] != written_hashes[first + i];
+    }
+    printf("         verify%s: %zu of %zu frames read back, %u mismatched\n", label, read_hashes.size(), written_hashes.size(), bad);
+    return bad;
+}
+
+static u64 __bench_percentile(std::vector<u64>& sorted, u32 pct){
+    size_t i = (sorted.size() * pct) / 100U;
+    return sorted[i < sorted.size() ? i : sorted.size() - 1];
+}
+
+static void __bench_print_row(u32 frame_size, u32 written, u64 total_us, u64 bytes, const micro_sd_sim_stats_t* stats, std::vector<u64>& latency_us, u64 format_us){
+    std::sort(latency_us.begin(), latency_us.end());
+    if(!written){
+        return;
+    }
+    printf("%8u %8u %10.1f %9.2f %9.3f %9.2f %8.2f %9llu %9llu %8.2f %9.1f\n",
+           frame_size, written,
+           written * 1e6 / (double)total_us,
+           bytes / (double)total_us,
+           stats->commands / (double)written,
+           stats->sectors_read / (double)written,
+           stats->sectors_written / (double)written,
+           __bench_percentile(latency_us, 50U),
+           __bench_percentile(latency_us, 99U),
+           stats->random_writes / (double)written,
+           format_us / 1000.0);
+}
+
+static int __bench_run(const bench_config_t* cfg, u32 frame_size){
+    micro_sd_sim_t* sim = micro_sd_sim_open(cfg->image_path, cfg->sector_count, cfg->use_mmap);
+    if(!sim){
+        fprintf(stderr, "cannot open the card image %s\n", cfg->image_path);
+        return 1;
+    }
+    if(cfg->used_card){
+        micro_sd_sim_mark_written(sim);
+    }
+    micro_sd_set_backend(micro_sd_sim_backend(sim));
+    u64 format_start_us = micro_sd_sim_clock_us(sim);
+    if(isacfs_format(cfg->format_mode, cfg->layout, cfg->avg_file_size ? cfg->avg_file_size : frame_size, cfg->desc_format) != ESP_OK || isacfs_init() != isacfs_ok){
+        fprintf(stderr, "cannot format the card image\n");
+        micro_sd_sim_close(sim);
+        return 1;
+    }
+    if(isacfs_group_commit_config(cfg->segment_size) != ESP_OK){
+        fprintf(stderr, "cannot allocate the staging arena\n");
+        micro_sd_sim_close(sim);
+        return 1;
+    }
+    isacfs_preerase_config(cfg->preerase);
+
+    u32 max_size = frame_size + frame_size * cfg->jitter_pct / 100U;
+    std::vector<u8> frame(max_size);
+    for(u32 i = 0x0; i < max_size; i++){
+        frame[i] = (u8)(i * 31U + 7U);
+    }
+    /* -v: the header and the trailer in buffers of their own, the body in a DMA-capable frame buffer */
+    std::vector<u8> header(BENCH_IOV_HEADER, 0xFF), trailer(BENCH_IOV_TRAILER, 0xA5);
+    std::vector<isacfs_iovec_t> pieces;
+    u8* body = cfg->pieces ? (u8*)isacfs_dma_alloc(max_size) : NULL;
+    if(cfg->pieces && !body){
+        fprintf(stderr, "cannot allocate the frame buffer\n");
+        micro_sd_sim_close(sim);
+        return 1;
+    }
+    if(body){
+        memcpy(body, frame.data(), max_size);
+    }
+    isacfs_delta_t* delta = NULL;
+    if(cfg->key_interval && isacfs_delta_open(&delta, max_size, cfg->key_interval) != ESP_OK){
+        fprintf(stderr, "cannot allocate the delta stage\n");
+        micro_sd_sim_close(sim);
+        return 1;
+    }
+    u64 format_us = micro_sd_sim_clock_us(sim) - format_start_us;
+    std::vector<u64> latency_us;
+    latency_us.reserve(cfg->frames);
+    srand(frame_size);
+
+    micro_sd_sim_reset_stats(sim);
+    isacfs_stats_reset();
+    u64 start_us = micro_sd_sim_clock_us(sim);
+    u64 bytes = 0x0;
+    u64 idle_us = 0x0; // -E: spent erasing between the frames
+    u64 late_us = 0x0; // -E: how long the frame waited for an erase
+    std::vector<u64> hashes; // -V: of the frames written
+    u32 written = 0x0;
+    for(; written < cfg->frames; written++){
+        u32 sz = frame_size;
+        if(cfg->jitter_pct){
+            u32 span = frame_size * cfg->jitter_pct / 100U;
+            sz = frame_size - span + (u32)(rand() % (2U * span + 1U));
+        }
+        isacfs_file_meta file_meta;
+        __bench_timestamp(written, &file_meta);
+        u64 t0 = micro_sd_sim_clock_us(sim);
+        if(delta){
+            u32 block = max_size / 16U; // the moving part of the scene
+            u32 at = (written * 997U) % (max_size - block + 1U);
+            for(u32 i = 0x0; i < block; i++){
+                frame[at + i] += 0x1;
+            }
+        }
+        esp_err_t res;
+        if(body && sz > BENCH_IOV_HEADER + BENCH_IOV_TRAILER){
+            u32 body_sz = sz - BENCH_IOV_HEADER - BENCH_IOV_TRAILER;
+            pieces.clear();
+            pieces.push_back({ header.data(), BENCH_IOV_HEADER });
+            for(u32 at = 0x0; at < body_sz; at += BENCH_IOV_CHUNK){
+                pieces.push_back({ body + at, std::min(BENCH_IOV_CHUNK, body_sz - at) });
+            }
+            pieces.push_back({ trailer.data(), BENCH_IOV_TRAILER });
+            res = isacfs_write_filev(&file_meta, pieces.data(), pieces.size());
+        }
+        else {
+            res = delta ? isacfs_delta_write_file(delta, &file_meta, frame.data(), sz) : isacfs_write_file(&file_meta, frame.data(), sz);
+        }
+        if(res != ESP_OK){
+            break; // card full
+        }
+        latency_us.push_back(micro_sd_sim_clock_us(sim) - t0 + late_us);
+        if(cfg->verify){
+            if(body && sz > BENCH_IOV_HEADER + BENCH_IOV_TRAILER){
+                u64 hash = __bench_hash(header.data(), BENCH_IOV_HEADER);
+                hash = __bench_hash(body, sz - BENCH_IOV_HEADER - BENCH_IOV_TRAILER, hash);
+                hashes.push_back(__bench_hash(trailer.data(), BENCH_IOV_TRAILER, hash));
+            }
+            else {
+                hashes.push_back(__bench_hash(frame.data(), sz));
+            }
+        }
+        bytes += sz;
+        if(cfg->preerase){
+            u64 next_us = t0 - late_us + BENCH_FRAME_INTERVAL_US; // when the camera hands over the next frame
+            u64 idle_start_us = micro_sd_sim_clock_us(sim);
+            while(micro_sd_sim_clock_us(sim) < next_us && isacfs_preerase_step() == ESP_OK){
+            }
+            u64 now_us = micro_sd_sim_clock_us(sim);
+            idle_us += now_us - idle_start_us;
+            late_us = now_us > next_us ? now_us - next_us : 0x0;
+        }
+    }
+    isacfs_sync();
+    u64 total_us = micro_sd_sim_clock_us(sim) - start_us - idle_us;
+
+    micro_sd_sim_stats_t stats;
+    micro_sd_sim_get_stats(sim, &stats);
+    __bench_print_row(frame_size, written, total_us, bytes, &stats, latency_us, format_us);
+    if((cfg->preerase || cfg->used_card || cfg->layout == isacfs_layout_loop) && written){
+        printf("         erase: %llu erases %.1f MiB %.1f ms in the idle time, %.2f sectors/frame written over old data\n",
+               (unsigned long long)stats.erase_commands, stats.sectors_erased / 2048.0, idle_us / 1000.0,
+               stats.sectors_overwritten / (double)written);
+    }
+    if(delta){
+        isacfs_delta_stats_t delta_stats;
+        isacfs_delta_get_stats(delta, &delta_stats);
+        printf("         delta: %u key + %u delta frames, %.1f%% of the frame bytes stored\n",
+               delta_stats.key_frames, delta_stats.delta_frames,
+               delta_stats.raw_bytes ? 100.0 * delta_stats.stored_bytes / (double)delta_stats.raw_bytes : 0.0);
+        isacfs_delta_close(delta);
+    }
+    isacfs_stats_t isacfs_stats;
+    if(cfg->print_stats && isacfs_stats_snapshot(&isacfs_stats) == ESP_OK){
+        isacfs_stats_print(&isacfs_stats);
+    }
+    u32 bad = cfg->verify ? __bench_verify(cfg, max_size, hashes) : 0x0;
+    isacfs_dma_free(body);
+    micro_sd_sim_close(sim);
+    return bad ? 1 : 0;
+}
+
+static void __bench_striped_done(const isacfs_file_meta*, const u8*, esp_err_t res, void* user){
+    bench_card_t* card = (bench_card_t*)user;
+    u64 now_us = micro_sd_sim_clock_us(card->sim);
+    std::lock_guard<std::mutex> guard(*card->latency_lock);
+    if(res == ESP_OK){
+        card->latency_us->push_back(now_us - card->last_clock_us);
+        card->written++;
+    }
+    card->last_clock_us = now_us;
+}
+
+/**
+ * @brief Same workload as "__bench_run", the frames striped over "cfg->cards" card images by a writer task each
+*/
+static int __bench_run_striped(const bench_config_t* cfg, u32 frame_size){
+    micro_sd_sim_t* sims[BENCH_MAX_CARDS] = {NULL};
+    const micro_sd_backend_t* backends[BENCH_MAX_CARDS];
+    std::string paths[BENCH_MAX_CARDS];
+    size_t card_sectors = cfg->sector_count / cfg->cards; // the same capacity in total as a single-card run
+    for(u32 i = 0x0; i < cfg->cards; i++){
+        paths[i] = std::string(cfg->image_path) + "." + std::to_string(i);
+        sims[i] = micro_sd_sim_open(paths[i].c_str(), card_sectors, cfg->use_mmap);
+        if(!sims[i]){
+            fprintf(stderr, "cannot open the card image %s\n", paths[i].c_str());
+            for(u32 j = 0x0; j < i; j++){
+                micro_sd_sim_close(sims[j]);
+            }
+            return 1;
+        }
+        backends[i] = micro_sd_sim_backend(sims[i]);
+    }
+
+    int ret = 1;
+    isacfs_stripe_t* stripe = NULL;
+    u64 format_start_us[BENCH_MAX_CARDS];
+    u64 start_us[BENCH_MAX_CARDS];
+    for(u32 i = 0x0; i < cfg->cards; i++){
+        format_start_us[i] = micro_sd_sim_clock_us(sims[i]);
+    }
+    if(isacfs_stripe_open(&stripe, backends, cfg->cards, 0x1) != ESP_OK){
+        fprintf(stderr, "cannot open the stripe\n");
+        goto done;
+    }
+    if(isacfs_stripe_format(stripe, cfg->format_mode, cfg->layout, cfg->avg_file_size ? cfg->avg_file_size : frame_size, cfg->desc_format) != ESP_OK
+       || isacfs_stripe_init(stripe) != isacfs_ok){
+        fprintf(stderr, "cannot format the card images\n");
+        goto done;
+    }
+    for(u32 i = 0x0; i < cfg->cards; i++){
+        isacfs_bind(isacfs_stripe_card(stripe, i));
+        esp_err_t gc_res = isacfs_group_commit_config(cfg->segment_size);
+        isacfs_bind(NULL);
+        if(gc_res != ESP_OK){
+            fprintf(stderr, "cannot allocate the staging arena\n");
+            goto done;
+        }
+    }
+    if(isacfs_stripe_start(stripe, BENCH_QUEUE_LEN, 0x2000, 0x5) != ESP_OK){
+        fprintf(stderr, "cannot start the writer tasks\n");
+        goto done;
+    }
+
+    {
+        u32 max_size = frame_size + frame_size * cfg->jitter_pct / 100U;
+        std::vector<u8> frame(max_size);
+        for(u32 i = 0x0; i < max_size; i++){
+            frame[i] = (u8)(i * 31U + 7U);
+        }
+        u64 format_us = 0x0;
+        std::vector<u64> latency_us;
+        std::mutex latency_lock;
+        latency_us.reserve(cfg->frames);
+        bench_card_t cards[BENCH_MAX_CARDS];
+        for(u32 i = 0x0; i < cfg->cards; i++){
+            u64 card_format_us = micro_sd_sim_clock_us(sims[i]) - format_start_us[i];
+            format_us = card_format_us > format_us ? card_format_us : format_us;
+            micro_sd_sim_reset_stats(sims[i]);
+            start_us[i] = micro_sd_sim_clock_us(sims[i]);
+            cards[i].sim = sims[i];
+            cards[i].last_clock_us = start_us[i];
+            cards[i].latency_us = &latency_us;
+            cards[i].latency_lock = &latency_lock;
+            cards[i].written = 0x0;
+        }
+        srand(frame_size);
+        isacfs_stats_reset();
+
+        u64 bytes = 0x0;
+        std::vector<u64> hashes[BENCH_MAX_CARDS]; // -V: of the frames sent to each card
+        u32 written = 0x0;
+        for(; written < cfg->frames; written++){
+            u32 sz = frame_size;
+            if(cfg->jitter_pct){
+                u32 span = frame_size * cfg->jitter_pct / 100U;
+                sz = frame_size - span + (u32)(rand() % (2U * span + 1U));
+            }
+            isacfs_file_meta file_meta;
+            __bench_timestamp(written, &file_meta);
+            if(cfg->verify){
+                hashes[written % cfg->cards].push_back(__bench_hash(frame.data(), sz));
+            }
+            esp_err_t res;
+            while((res = isacfs_stripe_write_file(stripe, &file_meta, frame.data(), sz, __bench_striped_done, cards + written % cfg->cards)) == ESP_ERR_NO_MEM){
+                sched_yield(); // the queue of the card is full
+            }
+            if(res != ESP_OK){
+                break;
+            }
+            bytes += sz;
+        }
+        isacfs_stripe_flush(stripe);
+
+        u64 total_us = 0x0;
+        micro_sd_sim_stats_t stats;
+        memset(&stats, 0x0, sizeof(stats));
+        for(u32 i = 0x0; i < cfg->cards; i++){
+            u64 card_us = micro_sd_sim_clock_us(sims[i]) - start_us[i];
+            total_us = card_us > total_us ? card_us : total_us;
+            micro_sd_sim_stats_t card_stats;
+            micro_sd_sim_get_stats(sims[i], &card_stats);
+            stats.commands += card_stats.commands;
+            stats.sectors_read += card_stats.sectors_read;
+            stats.sectors_written += card_stats.sectors_written;
+            stats.random_writes += card_stats.random_writes;
+        }
+        written = (u32)latency_us.size(); // the frames that made it (a full card fails on its writer task)
+        __bench_print_row(frame_size, written, total_us, bytes, &stats, latency_us, format_us);
+        isacfs_stats_t isacfs_stats;
+        if(cfg->print_stats && isacfs_stats_snapshot(&isacfs_stats) == ESP_OK){
+            isacfs_stats_print(&isacfs_stats);
+        }
+
+        /* -V: every card on its own, the writer tasks are idle after the flush */
+        u32 bad = 0x0;
+        for(u32 i = 0x0; cfg->verify && i < cfg->cards; i++){
+            hashes[i].resize(std::min((size_t)cards[i].written, hashes[i].size()));
+            std::string label = " card " + std::to_string(i);
+            isacfs_bind(isacfs_stripe_card(stripe, i));
+            bad += __bench_verify(cfg, max_size, hashes[i], label.c_str());
+            isacfs_bind(NULL);
+        }
+        ret = bad ? 1 : 0;
+    }
+
+done:
+    if(stripe){
+        isacfs_stripe_close(stripe);
+    }
+    for(u32 i = 0x0; i < cfg->cards; i++){
+        micro_sd_sim_close(sims[i]);
+        unlink(paths[i].c_str());
+    }
+    return ret;
+}
+
+/**
+ * @brief Same workload as "__bench_run", the frames of "cfg->streams" cameras written into as many streams of the card image by a writer task each
+*/
+static int __bench_run_streams(const bench_config_t* cfg, u32 frame_size){
+    micro_sd_sim_t* sim = micro_sd_sim_open(cfg->image_path, cfg->sector_count, cfg->use_mmap);
+    if(!sim){
+        fprintf(stderr, "cannot open the card image %s\n", cfg->image_path);
+        return 1;
+    }
+    const micro_sd_backend_t* card = micro_sd_sim_backend(sim);
+    int ret = 1;
+    isacfs_streams_t* streams = NULL;
+    isacfs_writer_t* writers[BENCH_MAX_CARDS] = {NULL};
+    u32 max_extents[ISACFS_MAX_STREAMS] = {0x0};
+    if(cfg->layout == isacfs_layout_loop){
+        /* a loop stream fills its device before wrapping - the card is split evenly, less the extent the tables start */
+        u64 card_extents = ((u64)cfg->sector_count * micro_sd_get_sector_size_on(card)) / ISACFS_STREAMS_DEFAULT_EXTENT_SIZE;
+        for(u32 i = 0x0; i < cfg->streams; i++){
+            max_extents[i] = card_extents > 0x1 ? (u32)((card_extents - 0x1) / cfg->streams) : 0x0;
+        }
+        if(!max_extents[0]){
+            fprintf(stderr, "the card is too small for %u loop streams\n", cfg->streams);
+            micro_sd_sim_close(sim);
+            return 1;
+        }
+    }
+    u64 format_start_us = micro_sd_sim_clock_us(sim);
+    if(isacfs_streams_format(card, cfg->streams, 0x0, max_extents) != ESP_OK || isacfs_streams_open(&streams, card) != ESP_OK){
+        fprintf(stderr, "cannot lay out the streams\n");
+        micro_sd_sim_close(sim);
+        return 1;
+    }
+    for(u32 i = 0x0; i < cfg->streams; i++){
+        isacfs_bind(isacfs_stream(streams, i));
+        bool ok = isacfs_format(isacfs_format_fast, cfg->layout, cfg->avg_file_size ? cfg->avg_file_size : frame_size, cfg->desc_format) == ESP_OK
+                  && isacfs_init() == isacfs_ok && isacfs_group_commit_config(cfg->segment_size) == ESP_OK;
+        isacfs_bind(NULL);
+        if(!ok){
+            fprintf(stderr, "cannot format the streams\n");
+            goto done;
+        }
+        if(isacfs_writer_start(writers + i, isacfs_stream(streams, i), BENCH_QUEUE_LEN, 0x2000, 0x5) != ESP_OK){
+            fprintf(stderr, "cannot start the writer tasks\n");
+            goto done;
+        }
+    }
+
+    {
+        u32 max_size = frame_size + frame_size * cfg->jitter_pct / 100U;
+        std::vector<u8> frame(max_size);
+        for(u32 i = 0x0; i < max_size; i++){
+            frame[i] = (u8)(i * 31U + 7U);
+        }
+        u64 format_us = micro_sd_sim_clock_us(sim) - format_start_us;
+        std::vector<u64> latency_us;
+        std::mutex latency_lock;
+        latency_us.reserve(cfg->frames);
+        micro_sd_sim_reset_stats(sim);
+        u64 start_us = micro_sd_sim_clock_us(sim);
+        bench_card_t cameras[BENCH_MAX_CARDS];
+        for(u32 i = 0x0; i < cfg->streams; i++){
+            cameras[i].sim = sim;
+            cameras[i].last_clock_us = start_us;
+            cameras[i].latency_us = &latency_us;
+            cameras[i].latency_lock = &latency_lock;
+            cameras[i].written = 0x0;
+        }
+        srand(frame_size);
+        isacfs_stats_reset();
+
+        u64 bytes = 0x0;
+        std::vector<u64> hashes[BENCH_MAX_CARDS]; // -V: of the frames sent to each stream
+        for(u32 written = 0x0; written < cfg->frames; written++){
+            u32 sz = frame_size;
+            if(cfg->jitter_pct){
+                u32 span = frame_size * cfg->jitter_pct / 100U;
+                sz = frame_size - span + (u32)(rand() % (2U * span + 1U));
+            }
+            u32 stream = written % cfg->streams;
+            isacfs_file_meta file_meta;
+            __bench_timestamp(written / cfg->streams, &file_meta);
+            if(cfg->verify){
+                hashes[stream].push_back(__bench_hash(frame.data(), sz));
+            }
+            while(isacfs_writer_submit(writers[stream], &file_meta, frame.data(), sz, __bench_striped_done, cameras + stream) == ESP_ERR_NO_MEM){
+                sched_yield(); // the queue of the stream is full
+            }
+            bytes += sz;
+        }
+        for(u32 i = 0x0; i < cfg->streams; i++){
+            isacfs_writer_flush(writers[i]);
+        }
+        u64 total_us = micro_sd_sim_clock_us(sim) - start_us;
+
+        micro_sd_sim_stats_t stats;
+        micro_sd_sim_get_stats(sim, &stats);
+        u32 written = (u32)latency_us.size(); // the frames that made it (a full card fails on the writer tasks)
+        __bench_print_row(frame_size, written, total_us, bytes, &stats, latency_us, format_us);
+        printf("         streams: extents of %uKiB claimed", ISACFS_STREAMS_DEFAULT_EXTENT_SIZE >> 10U);
+        for(u32 i = 0x0; i < cfg->streams; i++){
+            printf(i ? " + %u" : " %u", isacfs_streams_extents(streams, i));
+        }
+        printf(", %u free\n", isacfs_streams_extents(streams, ISACFS_MAX_STREAMS));
+        isacfs_stats_t isacfs_stats;
+        if(cfg->print_stats && isacfs_stats_snapshot(&isacfs_stats) == ESP_OK){
+            isacfs_stats_print(&isacfs_stats);
+        }
+
+        /* -V: every stream on its own, the writer tasks are idle after the flush */
+        u32 bad = 0x0;
+        for(u32 i = 0x0; cfg->verify && i < cfg->streams; i++){
+            hashes[i].resize(std::min((size_t)cameras[i].written, hashes[i].size()));
+            std::string label = " stream " + std::to_string(i);
+            isacfs_bind(isacfs_stream(streams, i));
+            bad += __bench_verify(cfg, max_size, hashes[i], label.c_str());
+            isacfs_bind(NULL);
+        }
+        ret = bad ? 1 : 0;
+    }
+
+done:
+    for(u32 i = 0x0; i < cfg->streams; i++){
+        if(writers[i]){
+            isacfs_writer_stop(writers[i]);
+        }
+    }
+    isacfs_streams_close(streams);
+    micro_sd_sim_close(sim);
+    return ret;
+}
+
+static bool __bench_scrub_frame(const isacfs_file_meta*, const u8*, u32, void* user){
+    (*(u32*)user)++;
+    return true;
+}
+
+static bool __bench_scrub_preview(const isacfs_file_meta*, const u8*, u32, void* user){
+    (*(u32*)user)++;
+    return true;
+}
+
+/* -V with -p: the previews handed out against the one written with every frame */
+typedef struct {
+    const u8* thumb;
+    u32 thumb_sz;
+    u32 seen;
+    u32 bad;
+} bench_preview_check_t;
+
+static bool __bench_check_preview(const isacfs_file_meta*, const u8* thumb, u32 thumb_sz, void* user){
+    bench_preview_check_t* check = (bench_preview_check_t*)user;
+    check->seen++;
+    check->bad += thumb_sz != check->thumb_sz || memcmp(thumb, check->thumb, thumb_sz);
+    return true;
+}
+
+/**
+ * @brief Same workload as "__bench_run" with a preview of every frame (stream 0 - the frames, stream 1 - the previews), then scrubbing through it
+*/
+static int __bench_run_preview(const bench_config_t* cfg, u32 frame_size){
+    micro_sd_sim_t* sim = micro_sd_sim_open(cfg->image_path, cfg->sector_count, cfg->use_mmap);
+    if(!sim){
+        fprintf(stderr, "cannot open the card image %s\n", cfg->image_path);
+        return 1;
+    }
+    const micro_sd_backend_t* card = micro_sd_sim_backend(sim);
+    isacfs_streams_t* streams = NULL;
+    isacfs_preview_t* preview = NULL;
+    isacfs_preview_config_t preview_config;
+    memset(&preview_config, 0x0, sizeof(preview_config));
+    u64 format_start_us = micro_sd_sim_clock_us(sim);
+    bool ok = isacfs_streams_format(card, 0x2) == ESP_OK && isacfs_streams_open(&streams, card) == ESP_OK;
+    for(u32 i = 0x0; ok && i < 0x2; i++){
+        isacfs_bind(isacfs_stream(streams, i));
+        u32 avg_file_size = i ? cfg->preview_size + ISACFS_PREVIEW_HEADER_SIZE : cfg->avg_file_size ? cfg->avg_file_size : frame_size;
+        ok = isacfs_format(isacfs_format_fast, cfg->layout, avg_file_size, cfg->desc_format) == ESP_OK && isacfs_init() == isacfs_ok
+             && isacfs_group_commit_config(cfg->segment_size) == ESP_OK;
+    }
+    isacfs_bind(streams ? isacfs_stream(streams, 0x0) : NULL); // the frames
+    ok = ok && isacfs_preview_open(&preview, isacfs_stream(streams, 0x1), &preview_config) == ESP_OK;
+    if(!ok){
+        fprintf(stderr, "cannot format the streams\n");
+        isacfs_bind(NULL);
+        if(streams){
+            isacfs_streams_close(streams);
+        }
+        micro_sd_sim_close(sim);
+        return 1;
+    }
+
+    u32 max_size = frame_size + frame_size * cfg->jitter_pct / 100U;
+    std::vector<u8> frame(max_size > cfg->preview_size ? max_size : cfg->preview_size);
+    for(u32 i = 0x0; i < frame.size(); i++){
+        frame[i] = (u8)(i * 31U + 7U);
+    }
+    u64 format_us = micro_sd_sim_clock_us(sim) - format_start_us;
+    std::vector<u64> latency_us;
+    latency_us.reserve(cfg->frames);
+    srand(frame_size);
+
+    micro_sd_sim_reset_stats(sim);
+    isacfs_stats_reset();
+    u64 start_us = micro_sd_sim_clock_us(sim);
+    u64 bytes = 0x0;
+    std::vector<u64> hashes; // -V: of the frames written
+    u32 written = 0x0;
+    for(; written < cfg->frames; written++){
+        u32 sz = frame_size;
+        if(cfg->jitter_pct){
+            u32 span = frame_size * cfg->jitter_pct / 100U;
+            sz = frame_size - span + (u32)(rand() % (2U * span + 1U));
+        }
+        isacfs_file_meta file_meta;
+        __bench_timestamp(written, &file_meta);
+        u64 t0 = micro_sd_sim_clock_us(sim);
+        if(isacfs_preview_write_file(preview, &file_meta, frame.data(), sz, frame.data(), cfg->preview_size) != ESP_OK){
+            break; // card full
+        }
+        latency_us.push_back(micro_sd_sim_clock_us(sim) - t0);
+        if(cfg->verify){
+            hashes.push_back(__bench_hash(frame.data(), sz));
+        }
+        bytes += sz;
+    }
+    isacfs_sync();
+    isacfs_preview_sync(preview);
+    u64 total_us = micro_sd_sim_clock_us(sim) - start_us;
+    micro_sd_sim_stats_t stats;
+    micro_sd_sim_get_stats(sim, &stats);
+    __bench_print_row(frame_size, written, total_us, bytes, &stats, latency_us, format_us);
+
+    /* scrubbing: the whole recording, frames against previews */
+    if(written){
+        isacfs_file_meta t_begin;
+        isacfs_file_meta t_end;
+        __bench_timestamp(0x0, &t_begin);
+        __bench_timestamp(written - 0x1, &t_end);
+        u8* buffer = (u8*)isacfs_dma_alloc(BENCH_SCRUB_BUFFER);
+        u32 frames_seen = 0x0;
+        u32 previews_seen = 0x0;
+        micro_sd_sim_stats_t frame_stats;
+        micro_sd_sim_stats_t preview_stats;
+        micro_sd_sim_reset_stats(sim);
+        u64 t0 = micro_sd_sim_clock_us(sim);
+        isacfs_read_range(&t_begin, &t_end, buffer, BENCH_SCRUB_BUFFER, __bench_scrub_frame, &frames_seen);
+        u64 frames_us = micro_sd_sim_clock_us(sim) - t0;
+        micro_sd_sim_get_stats(sim, &frame_stats);
+        micro_sd_sim_reset_stats(sim);
+        t0 = micro_sd_sim_clock_us(sim);
+        isacfs_preview_range(preview, &t_begin, &t_end, buffer, BENCH_SCRUB_BUFFER, __bench_scrub_preview, &previews_seen);
+        u64 previews_us = micro_sd_sim_clock_us(sim) - t0;
+        micro_sd_sim_get_stats(sim, &preview_stats);
+        isacfs_dma_free(buffer);
+        printf("         scrub: %u frames %.1f MiB %.1f ms %llu cmds, %u previews %.2f MiB %.1f ms %llu cmds\n",
+               frames_seen, frame_stats.sectors_read / 2048.0, frames_us / 1000.0, (unsigned long long)frame_stats.commands,
+               previews_seen, preview_stats.sectors_read / 2048.0, previews_us / 1000.0, (unsigned long long)preview_stats.commands);
+    }
+    isacfs_stats_t isacfs_stats;
+    if(cfg->print_stats && isacfs_stats_snapshot(&isacfs_stats) == ESP_OK){
+        isacfs_stats_print(&isacfs_stats);
+    }
+    u32 bad = 0x0;
+    if(cfg->verify){
+        bad = __bench_verify(cfg, max_size, hashes, " frames");
+        bench_preview_check_t check = { frame.data(), cfg->preview_size, 0x0, 0x0 };
+        if(written){
+            isacfs_file_meta t_begin;
+            isacfs_file_meta t_end;
+            __bench_timestamp(0x0, &t_begin);
+            __bench_timestamp(written - 0x1, &t_end);
+            u8* buffer = (u8*)isacfs_dma_alloc(BENCH_SCRUB_BUFFER);
+            if(!buffer || isacfs_preview_range(preview, &t_begin, &t_end, buffer, BENCH_SCRUB_BUFFER, __bench_check_preview, &check) != ESP_OK){
+                check.bad++;
+            }
+            isacfs_dma_free(buffer);
+        }
+        if(check.seen > written || (cfg->layout != isacfs_layout_loop && check.seen != written)){
+            check.bad++; // previews missing
+        }
+        printf("         verify previews: %u of %u previews read back, %u mismatched\n", check.seen, written, check.bad);
+        bad += check.bad;
+    }
+    isacfs_bind(NULL);
+    isacfs_preview_close(preview);
+    isacfs_streams_close(streams);
+    micro_sd_sim_close(sim);
+    return bad ? 1 : 0;
+}
+
+int main(int argc, char** argv){
+    bench_config_t cfg;
+    cfg.image_path = "isacfs_bench.img";
+    cfg.sector_count = 0x1 << 21U; // 1GiB
+    cfg.frames = 5000U;
+    cfg.jitter_pct = 25U;
+    cfg.use_mmap = false;
+    cfg.format_mode = isacfs_format_fast;
+    cfg.layout = isacfs_layout_fixed;
+    cfg.desc_format = isacfs_desc_8B;
+    cfg.avg_file_size = 0x0;
+    cfg.segment_size = 0x0;
+    cfg.print_stats = false;
+    cfg.cards = 0x1;
+    cfg.streams = 0x1;
+    cfg.preview_size = 0x0;
+    cfg.key_interval = 0x0;
+    cfg.pieces = false;
+    cfg.preerase = 0x0;
+    cfg.used_card = false;
+    cfg.verify = false;
+
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "-i") && i + 1 < argc){
+            cfg.image_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc){
+            cfg.sector_count = strtoull(argv[++i], NULL, 0);
+        }
+        else if(!strcmp(argv[i], "-n") && i + 1 < argc){
+            cfg.frames = strtoul(argv[++i], NULL, 0);
+        }
+        else if(!strcmp(argv[i], "-j") && i + 1 < argc){
+            cfg.jitter_pct = strtoul(argv[++i], NULL, 0);
+        }
+        else if(!strcmp(argv[i], "-z") && i + 1 < argc){
+            for(char* tok = strtok(argv[++i], ","); tok; tok = strtok(NULL, ",")){
+                cfg.frame_sizes.push_back(strtoul(tok, NULL, 0));
+            }
+        }
+        else if(!strcmp(argv[i], "-m")){
+            cfg.use_mmap = true;
+        }
+        else if(!strcmp(argv[i], "-F")){
+            cfg.format_mode = isacfs_format_full;
+        }
+        else if(!strcmp(argv[i], "-L")){
+            cfg.layout = isacfs_layout_converging;
+        }
+        else if(!strcmp(argv[i], "-R")){
+            cfg.layout = isacfs_layout_loop;
+        }
+        else if(!strcmp(argv[i], "-T")){
+            cfg.desc_format = isacfs_desc_16B;
+        }
+        else if(!strcmp(argv[i], "-a") && i + 1 < argc){
+            cfg.avg_file_size = strtoul(argv[++i], NULL, 0);
+        }
+        else if(!strcmp(argv[i], "-g") && i + 1 < argc){
+            cfg.segment_size = strtoul(argv[++i], NULL, 0);
+        }
+        else if(!strcmp(argv[i], "-S")){
+            cfg.print_stats = true;
+        }
+        else if(!strcmp(argv[i], "-c") && i + 1 < argc){
+            cfg.cards = strtoul(argv[++i], NULL, 0);
+            if(!cfg.cards || cfg.cards > BENCH_MAX_CARDS){
+                fprintf(stderr, "1 to %u cards\n", BENCH_MAX_CARDS);
+                return 2;
+            }
+        }
+        else if(!strcmp(argv[i], "-t") && i + 1 < argc){
+            cfg.streams = strtoul(argv[++i], NULL, 0);
+            if(!cfg.streams || cfg.streams > ISACFS_MAX_STREAMS){
+                fprintf(stderr, "1 to %u streams\n", ISACFS_MAX_STREAMS);
+                return 2;
+            }
+        }
+        else if(!strcmp(argv[i], "-p") && i + 1 < argc){
+            cfg.preview_size = strtoul(argv[++i], NULL, 0);
+        }
+        else if(!strcmp(argv[i], "-d") && i + 1 < argc){
+            cfg.key_interval = strtoul(argv[++i], NULL, 0);
+        }
+        else if(!strcmp(argv[i], "-v")){
+            cfg.pieces = true;
+        }
+        else if(!strcmp(argv[i], "-E") && i + 1 < argc){
+            cfg.preerase = strtoul(argv[++i], NULL, 0);
+        }
+        else if(!strcmp(argv[i], "-U")){
+            cfg.used_card = true;
+        }
+        else if(!strcmp(argv[i], "-V")){
+            cfg.verify = true;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-i image] [-s sectors] [-n frames] [-z size,size,...] [-j jitter%%] [-m] [-F] [-L] [-R] [-T] [-a avg_size] [-g segment_size] [-S] [-c cards] [-t streams] [-p preview_size] [-d key_interval] [-v] [-E distance] [-U] [-V]\n", argv[0]);
+            return 2;
+        }
+    }
+    if(cfg.key_interval && (cfg.cards > 0x1 || cfg.streams > 0x1)){
+        fprintf(stderr, "-d writes to a single card\n");
+        return 2;
+    }
+    if(cfg.pieces && (cfg.key_interval || cfg.cards > 0x1 || cfg.streams > 0x1)){
+        fprintf(stderr, "-v writes to a single card, without the delta stage\n");
+        return 2;
+    }
+    if(cfg.cards > 0x1 && cfg.streams > 0x1){
+        fprintf(stderr, "-t writes to a single card\n");
+        return 2;
+    }
+    if(cfg.preview_size && (cfg.key_interval || cfg.pieces || cfg.cards > 0x1 || cfg.streams > 0x1)){
+        fprintf(stderr, "-p writes to a single card, without the delta stage, pieces or streams of its own\n");
+        return 2;
+    }
+    if((cfg.preerase || cfg.used_card) && (cfg.cards > 0x1 || cfg.streams > 0x1 || cfg.preview_size)){
+        fprintf(stderr, "-E and -U write to a single card, without streams of its own\n");
+        return 2;
+    }
+    if(cfg.frame_sizes.empty()){
+        cfg.frame_sizes = {0x1000, 0x4000, 0x10000};
+    }
+
+    printf("%8s %8s %10s %9s %9s %9s %8s %9s %9s %8s %9s\n",
+           "size[B]", "frames", "frames/s", "MB/s", "cmd/frm", "rd/frm", "wr/frm", "p50[us]", "p99[us]", "rnd/frm", "fmt[ms]");
+    for(u32 frame_size : cfg.frame_sizes){
+        int res = cfg.cards > 0x1 ? __bench_run_striped(&cfg, frame_size) : cfg.streams > 0x1 ? __bench_run_streams(&cfg, frame_size)
+                  : cfg.preview_size ? __bench_run_preview(&cfg, frame_size) : __bench_run(&cfg, frame_size);
+        if(res){
+            return 1;
+        }
+    }
+    unlink(cfg.image_path);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+/**
+ * @brief Minimal stand-ins for the Arduino/ESP-IDF API used by isacfs, for host (Linux) builds with -DISACFS_HOST
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+
+class HostSerial {
+public:
+    void begin(unsigned long){}
+    void print(const char *s){ fputs(s, stderr); }
+    void println(const char *s = ""){ fputs(s, stderr); fputc('\n', stderr); }
+    template <typename... Args>
+    void printf(const char *fmt, Args... args){ fprintf(stderr, fmt, args...); }
+};
+
+inline HostSerial Serial;
+
+static inline unsigned long millis(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)(ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL);
+}
+
+static inline unsigned long micros(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)(ts.tv_sec * 1000000UL + ts.tv_nsec / 1000UL);
+}
+
+static inline void delay(unsigned long ms){
+    struct timespec ts = { (time_t)(ms / 1000UL), (long)((ms % 1000UL) * 1000000UL) };
+    nanosleep(&ts, NULL);
+}
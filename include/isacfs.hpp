@@ -1,7 +1,9 @@
+#pragma once
 #include "microSD.hpp"
 
 #define UNKNOWN_SECTOR 0x0
 #define UNKNOWN_OFFSET 0x0
+#define YEAR_DIFF_REF 2023 // year_diff of a timestamp counts the years from it
 
 typedef unsigned long long u64;
 typedef unsigned int u32;
@@ -10,9 +12,29 @@ typedef unsigned char u8;
 typedef enum
 {
     isacfs_ok,
-    isacfs_256GiB_limit_exceeded
+    isacfs_256GiB_limit_exceeded,
+    isacfs_fail
 } isacfs_err_t;
 
+typedef enum
+{
+    isacfs_format_full, // clear the whole card
+    isacfs_format_fast  // write the superblock and clear the start of the descriptor region only
+} isacfs_format_mode_t;
+
+typedef enum
+{
+    isacfs_layout_fixed,      // descriptors at the start of the card, frames from DATA_START on (split by the average frame size)
+    isacfs_layout_converging, // descriptors grow up from the start of the card, frames grow down from its end until they meet
+    isacfs_layout_loop        // the regions of isacfs_layout_fixed, each one a ring - the oldest frames make room for the new ones
+} isacfs_layout_t;
+
+typedef enum
+{
+    isacfs_desc_8B, // address and time down to the second
+    isacfs_desc_16B // + the millisecond and the sequence number of the frame (half the descriptors per metadata sector)
+} isacfs_desc_format_t;
+
 typedef struct {
     u32 sector = 0x0;
     u32 offset = 0x0;
@@ -22,9 +44,39 @@ typedef struct {
     u8 hour;
     u8 minute;
     u8 second;
+    u32 millisecond = 0x0; // 0-999, stored with isacfs_desc_16B only
+    u32 sequence = 0x0; // isacfs_desc_16B: number of the frame since the format, set as its descriptor goes to the log
+    u32 size = 0x0; // not stored - filled by "isacfs_file_desc"
 } isacfs_file_meta;
 
 
+/**
+ * @brief Filesystem state of a card - the isacfs_* functions work on the instance bound to the calling task
+ * @note Every task starts bound to the default instance, the one on the card set with "micro_sd_set_backend".
+ *       An instance may be bound to several tasks, but only one of them may write at a time. The lookups and reads of
+ *       the others take a lock of the instance, which the writer takes too while it updates what they read.
+*/
+typedef struct isacfs isacfs_t;
+
+/**
+ * @brief Create an instance on "card" (bind it and call "isacfs_init" to mount the card)
+ * @returns NULL if out of memory
+*/
+isacfs_t *isacfs_open(const micro_sd_backend_t *card);
+
+/**
+ * @note The staged files are dropped - call "isacfs_sync" with the instance bound first; the default instance is never freed
+*/
+void isacfs_close(isacfs_t *fs);
+
+/**
+ * @brief Bind "fs" to the calling task (NULL - the default instance)
+ * @returns the instance bound before
+*/
+isacfs_t *isacfs_bind(isacfs_t *fs);
+
+isacfs_t *isacfs_current();
+
 /**
  * @note "init_sdcard" has to be called first
 */
@@ -33,29 +85,248 @@ isacfs_err_t isacfs_init();
 /**
  * @brief Encode/compress "file_meta" into a 64-bit block
 */
-const u8 *__isacfs_file_meta__to__desc_8B_blk(isacfs_file_meta *file_meta_p);
+void __isacfs_file_meta__to__desc_8B_blk(const isacfs_file_meta *file_meta_p, u8 *desc_8B_blk);
 
 /**
  * @brief Decode/expand "desc_8B_blk" into a isac_file_meta structure
 */
-const isacfs_file_meta *__desc_8B_blk__to__isacfs_file_meta(const u8 *desc_8B_blk);
+void __desc_8B_blk__to__isacfs_file_meta(const u8 *desc_8B_blk, isacfs_file_meta *file_meta);
+
+/**
+ * @brief Pack the timestamp of "file_meta" (year_diff|month|day|hour|minute|second like the low bits of a descriptor, then 10 bits of millisecond)
+ * @note Packed timestamps compare like the time they stand for
+*/
+u64 isacfs_pack_timestamp(const isacfs_file_meta *file_meta);
+
+/**
+ * @brief Fill the timestamp fields of "file_meta" from a packed timestamp
+*/
+void isacfs_unpack_timestamp(u64 timestamp, isacfs_file_meta *file_meta);
+
+/**
+ * @brief Decode "count" consecutive descriptors at once into a struct of arrays
+ * @note Reentrant (no static state), word-wide: a 64-bit big-endian load per descriptor
+ * @note The descriptors are of the format of the bound instance (see "isacfs_desc_size")
+ * @param sector may be NULL together with "offset" - only the packed timestamps are decoded then
+*/
+void isacfs_decode_descs(const u8 *descs, u32 count, u32 *sector, u32 *offset, u64 *timestamp);
+
+/**
+ * @brief Encode "count" descriptors from a struct of arrays (inverse of "isacfs_decode_descs")
+ * @note The sequence numbers of 16B descriptors are left as they are
+*/
+void isacfs_encode_descs(u8 *descs, u32 count, const u32 *sector, const u32 *offset, const u64 *timestamp);
+
+/**
+ * @brief Size of a descriptor on the card of the bound instance (8 or 16, set by "isacfs_format")
+*/
+u32 isacfs_desc_size();
+
+/**
+ * @brief Decode all the descriptors of the metadata sector "sector_no" (read from the card into "sector")
+ * @param sector_offset,data_offset,timestamp arrays of (sector size - 16) / 8 entries
+ * @returns number of the descriptors in the sector (0 for a sector of an older format generation)
+*/
+u32 isacfs_decode_meta_sector(const u8 *sector, u32 sector_no, u32 *data_sector, u32 *data_offset, u64 *timestamp);
 
 /**
  * @brief Fills all the sectors with zeroes
 */
 esp_err_t __isacfs_clear_all_sectors();
 
-void isacfs_format();
+/**
+ * @note Works on a card that isn't mounted (a blank one) - call "isacfs_init" afterwards to mount it
+ * @returns ESP_ERR_INVALID_STATE if the card geometry isn't supported (see "isacfs_init") or the sector buffers can't be allocated
+ * @note Sector 0 is read to pick the next format generation; metadata sectors of older generations count as empty
+ * @note Clearing uses the erase command if the card supports it, large multi-block zero writes otherwise
+ * @param layout isacfs_layout_converging needs no average frame size - the regions take whatever the frames leave
+ * @param avg_file_size sizes the descriptor region of isacfs_layout_fixed/isacfs_layout_loop (0 - the running estimate, see "isacfs_avg_file_size")
+ * @param desc_format isacfs_desc_16B for high frame rates - the time searches tell the frames of a second apart and
+ *        "isacfs_seek_sequence" finds a frame by its number
+ * @returns ESP_ERR_INVALID_SIZE if the card is too small for isacfs_layout_loop
+*/
+esp_err_t isacfs_format(isacfs_format_mode_t mode = isacfs_format_full, isacfs_layout_t layout = isacfs_layout_fixed, u32 avg_file_size = 0x0,
+                        isacfs_desc_format_t desc_format = isacfs_desc_8B);
 
-void isacfs_write_file(isacfs_file_meta file_meta, const void *buffer, u32 buf_sz);
+/**
+ * @brief Running average of the written frame sizes (exponentially weighted, kept in the superblock)
+*/
+u32 isacfs_avg_file_size();
+
+/**
+ * @brief How many more frames fit, projected with the running average frame size (all ones with isacfs_layout_loop)
+*/
+u64 isacfs_files_left();
+
+/**
+ * @note "file_meta" is supposed to have sector=UNKNOWN_SECTOR, offset=UNKNOWN_OFFSET
+ * @note All the full sectors of the file are sent in a single multi-block transfer - straight from "buffer" if the card
+ *       driver can DMA from the first of them (see "isacfs_dma_alloc"), through the bounce buffers of the instance otherwise
+ * @note The descriptor goes to the metadata journal; call "isacfs_sync" to make it durable
+ * @returns ESP_ERR_INVALID_SIZE if the file doesn't fit, or if it is empty on a card of isacfs_layout_converging
+*/
+esp_err_t isacfs_write_file(isacfs_file_meta *file_meta, const u8 *buffer, u32 buf_sz);
+
+/**
+ * @brief A piece of a frame for "isacfs_write_filev"
+*/
+typedef struct {
+    const void *base;
+    u32 len;
+} isacfs_iovec_t;
+
+/**
+ * @brief Write a frame that is in several pieces (a JPEG header, chunks of the frame buffer, a trailer) as a single
+ *        file - like "isacfs_write_file" with the pieces one after another, without putting them together first
+ * @note A full sector lying in a piece the card driver can DMA from goes to the card straight from it; the partial
+ *       sectors and the ones straddling two pieces are gathered through the buffers of the instance
+ * @returns ESP_ERR_INVALID_SIZE if the pieces add up to 4GiB or more, or to nothing on a card of isacfs_layout_converging
+*/
+esp_err_t isacfs_write_filev(isacfs_file_meta *file_meta, const isacfs_iovec_t *iov, u32 iov_count);
+
+/**
+ * @brief Collect files in a RAM arena and write them as AU-aligned segments, each in a single multi-block transfer
+ * @param segment_size rounded down to a power of 2 between 64KiB and 4MiB (0 - write every file as it arrives)
+ * @note A descriptor goes to the log only once the data of its file is on the card; "isacfs_sync" commits
+ *       the staged files too. On power failure the staged files are lost along with the pending descriptors.
+*/
+esp_err_t isacfs_group_commit_config(u32 segment_size);
+
+/**
+ * @brief Set when the metadata journal gets flushed
+ * @param max_pending_files flush after this many descriptors (0 - only when the metadata sector fills)
+ * @param max_pending_ms flush when the oldest pending descriptor is this old (0 - never)
+ * @note On power failure at most the pending descriptors are lost, which is never more than one metadata sector
+ *       and never past the FUTURE_WRITE marker (the journal is flushed before the write head reaches it)
+*/
+void isacfs_journal_config(u32 max_pending_files, u32 max_pending_ms);
+
+/**
+ * @brief Keep the card erased ahead of the write heads - a card writes into erased blocks faster than over old data,
+ *        which is what every write lands on once the card has wrapped (isacfs_layout_loop) or was formatted when full
+ * @param distance bytes kept erased ahead of the data head (0 - off); ahead of CURR_WRITE_META, the metadata sectors
+ *        the descriptors of that many bytes of frames take
+ * @param chunk erased per "isacfs_preerase_step" at most, the data erases are aligned to it (0 - 4MiB, the allocation unit of the big cards)
+ * @note Nothing is erased until "isacfs_preerase_step" runs - the writer tasks of "isacfs_async" run it whenever their
+ *       queue is empty. Configure it before starting a writer task on the instance.
+ * @note isacfs_layout_loop: the oldest frames in the distance are dropped ahead of time - the recording is shorter by up
+ *       to "distance" (a quarter of the data ring at most)
+ * @returns ESP_ERR_INVALID_STATE if the card geometry is unknown
+*/
+esp_err_t isacfs_preerase_config(u32 distance, u32 chunk = 0x0);
+
+/**
+ * @brief Erase the next chunk ahead of a write head - in the idle time between the frames, a frame coming meanwhile
+ *        waits for one erase command at most
+ * @returns ESP_ERR_NOT_FOUND if there is nothing left to erase (or "isacfs_preerase_config" is off),
+ *          ESP_ERR_NOT_SUPPORTED if the card has no erase command (the pre-erase turns itself off)
+*/
+esp_err_t isacfs_preerase_step();
+
+/**
+ * @brief Write all the pending descriptors (and the staged files) to the card
+*/
+esp_err_t isacfs_sync();
+
+/**
+ * @brief Find the first descriptor with a timestamp not older than the one of "key"
+ * @note Interpolation/binary search over the descriptor log; the first timestamps of the probed metadata sectors are cached
+ * @note The millisecond of "key" counts with isacfs_desc_16B only
+ * @returns ESP_ERR_NOT_FOUND if all the descriptors are older than "key"
+*/
+esp_err_t isacfs_find_meta(const isacfs_file_meta *key, u32 *meta_sector, u32 *meta_offset);
+
+/**
+ * @brief Meta location of the frame number "sequence" (isacfs_desc_16B)
+ * @note O(1) - frame n takes the descriptor slot n of the log, only that descriptor is read to check it
+ * @returns ESP_ERR_NOT_SUPPORTED with 8B descriptors, ESP_ERR_NOT_FOUND if the frame is not in the log (not written yet, or dropped by isacfs_layout_loop)
+*/
+esp_err_t isacfs_seek_sequence(u32 sequence, u32 *meta_sector, u32 *meta_offset);
+
+/**
+ * @brief Meta location of the oldest file in the log
+ * @note isacfs_layout_loop: the descriptor ring and the data ring wrap on their own; the oldest frame whose descriptor and data
+ *       are both intact (the tail) is kept in RAM and stored in the metadata sector trailers, so that the searches,
+ *       "isacfs_read_range" and the iterators see only the live frames [tail, CURR_WRITE_META)
+ * @returns ESP_ERR_NOT_FOUND if the log is empty
+*/
+esp_err_t isacfs_oldest_meta(u32 *meta_sector, u32 *meta_offset);
+
+/**
+ * @brief Meta location the next descriptor goes to - the end of the log, one past the newest file
+*/
+void isacfs_head_meta(u32 *meta_sector, u32 *meta_offset);
 
 /**
  * @brief Fills "file_meta" with the sector & offset info
- * @returns Size of the file (in bytes)
+ * @param meta_sector in or out depending if it is known or not (UNKNOWN_SECTOR&UNKNOWN_OFFSET/NULL - search by the timestamp of "file_meta")
+ * @param meta_offset in or out depending if it is known or not
+*/
+esp_err_t isacfs_file_desc(isacfs_file_meta *file_meta, u32 *discovered_size, u32 *meta_sector, u32 *meta_offset);
+
+/**
+ * @brief Read "length" bytes from "offset" on of the file described by "file_meta" (obtained using the "isacfs_file_desc" function)
+ * @note Sector-aligned data goes straight into "out_buffer" in a single multi-block transfer (if the card driver can
+ *       DMA into it, see "isacfs_dma_capable"), only the partial head and tail sectors go through a bounce buffer
+ * @returns ESP_ERR_INVALID_SIZE if the range goes beyond the end of the file
+*/
+esp_err_t isacfs_read_file(isacfs_file_meta file_meta, void *out_buffer, u32 offset, u32 length);
+
+/**
+ * @brief Byte addresses on the card of the data of a file described by "file_meta" (obtained using the "isacfs_file_desc" function)
+ * @note For readers that map the card (no copy) - a file of isacfs_layout_loop that reaches past the end of the card
+ *       goes on at the start of the data region, in a second run
+ * @param pos,len arrays of 2 runs
+ * @returns number of the runs (1 or 2)
+*/
+u32 isacfs_file_extents(const isacfs_file_meta *file_meta, u64 *pos, u32 *len);
+
+/**
+ * @brief Called by "isacfs_read_range" for every frame of the range
+ * @param data view of the frame in the buffer of "isacfs_read_range", valid until the callback returns
+ *        (NULL for a frame bigger than that buffer - read it with "isacfs_read_file")
+ * @returns false to stop
+*/
+typedef bool (*isacfs_range_cb_t)(const isacfs_file_meta *file_meta, const u8 *data, u32 size, void *user);
+
+/**
+ * @brief Hand out every frame with a timestamp in [t_begin, t_end] in the recording order
+ * @note Both ends are found through the descriptor log; the data of the range is read in multi-block transfers
+ *       as big as "buffer" and the frames are handed out as views into it (no copy)
+ * @param buffer the bigger, the fewer reads (a few hundred KiB keep the card at full speed)
+ * @returns ESP_ERR_NOT_FOUND if no frame falls into the range
 */
-u32 isacfs_file_desc(isacfs_file_meta file_meta);
+esp_err_t isacfs_read_range(const isacfs_file_meta *t_begin, const isacfs_file_meta *t_end, u8 *buffer, u32 buffer_size, isacfs_range_cb_t cb, void *user);
 
 /**
- * Read the file based on the sector, offset and size data obtained using the "isacfs_file_desc" function
+ * @brief updates the meta sector&offset to enable reading the next file
 */
-void isacfs_read_file(isacfs_file_meta file_meta, void *out_buffer);
+void isacfs_next_meta(u32 *sector, u32 *offset);
+
+/**
+ * @brief updates the meta sector&offset to enable reading the previous file
+*/
+void isacfs_prev_meta(u32 *sector, u32 *offset);
+
+/**
+ * @brief Iterator over the recorded sequence, in the recording order or backwards
+ * @note Metadata sectors are decoded as a whole. The next metadata sector and the next frame are
+ *       read ahead by a worker task while the caller processes the current frame.
+ * @note It stays on the instance bound when it was opened, whichever one the caller is bound to later
+*/
+typedef struct isacfs_iter isacfs_iter_t;
+
+/**
+ * @param meta_sector first file (UNKNOWN_SECTOR&UNKNOWN_OFFSET - the oldest one going forward, the newest one going backward)
+ * @param max_frame_size bigger frames are reported with ESP_ERR_INVALID_SIZE
+*/
+esp_err_t isacfs_iter_open(isacfs_iter_t **iter, u32 meta_sector, u32 meta_offset, bool forward, u32 max_frame_size);
+
+/**
+ * @brief Hand out the next frame with its timestamp and size
+ * @param[out] data valid until the next call
+ * @returns ESP_ERR_NOT_FOUND at the end of the sequence (going forward, that is CURR_WRITE_META)
+*/
+esp_err_t isacfs_iter_next(isacfs_iter_t *iter, isacfs_file_meta *file_meta, const u8 **data);
+
+void isacfs_iter_close(isacfs_iter_t *iter);
@@ -0,0 +1,75 @@
+#pragma once
+#include "isacfs.hpp"
+
+/**
+ * @brief Called on the writer task once the frame is written (or failed), the buffer may be reused from then on
+*/
+typedef void (*isacfs_write_cb_t)(const isacfs_file_meta *file_meta, const u8 *buffer, esp_err_t res, void *user);
+
+typedef struct {
+    u32 submitted;
+    u32 completed;
+    u32 failed;
+    u32 rejected;  // submissions refused because the queue was full
+    u32 max_depth; // high-water mark of the queue
+} isacfs_async_stats_t;
+
+/**
+ * @brief Start the writer task draining the frame queue into isacfs (the instance bound to the calling task)
+ * @param queue_len capacity of the frame queue (rounded up to a power of 2)
+ * @note While the writer task runs, isacfs_write_file/isacfs_sync must not be called from other tasks
+*/
+esp_err_t isacfs_async_start(u32 queue_len, u32 stack_size, u32 priority);
+
+/**
+ * @brief Queue a frame for the writer task (single producer, lock-free, never blocks)
+ * @note "buffer" belongs to isacfs until "cb" is called
+ * @returns ESP_ERR_NO_MEM if the queue is full - backpressure, the frame is not taken
+*/
+esp_err_t isacfs_write_file_async(const isacfs_file_meta *file_meta, const u8 *buffer, u32 buf_sz, isacfs_write_cb_t cb, void *user);
+
+/**
+ * @brief Number of the frames queued and not yet written
+*/
+u32 isacfs_async_pending();
+
+void isacfs_async_get_stats(isacfs_async_stats_t *stats);
+
+/**
+ * @brief Barrier - wait until all the queued frames are written and their descriptors are on the card
+*/
+esp_err_t isacfs_flush();
+
+/**
+ * @brief Flush and stop the writer task
+*/
+void isacfs_async_stop();
+
+/**
+ * @brief Writer task with its own frame queue, draining into the instance "fs" - the isacfs_async_* functions drive one
+ *        of them, several of them write to several cards at once
+*/
+typedef struct isacfs_writer isacfs_writer_t;
+
+/**
+ * @note Whenever its queue is empty, the writer task erases ahead of the write head (see "isacfs_preerase_config")
+*/
+esp_err_t isacfs_writer_start(isacfs_writer_t **writer, isacfs_t *fs, u32 queue_len, u32 stack_size, u32 priority);
+
+/**
+ * @brief Queue a frame like "isacfs_write_file_async"
+ * @returns ESP_ERR_NO_MEM if the queue is full
+*/
+esp_err_t isacfs_writer_submit(isacfs_writer_t *writer, const isacfs_file_meta *file_meta, const u8 *buffer, u32 buf_sz, isacfs_write_cb_t cb, void *user);
+u32 isacfs_writer_pending(isacfs_writer_t *writer);
+void isacfs_writer_get_stats(isacfs_writer_t *writer, isacfs_async_stats_t *stats);
+
+/**
+ * @brief Barrier like "isacfs_flush"
+*/
+esp_err_t isacfs_writer_flush(isacfs_writer_t *writer);
+
+/**
+ * @brief Flush, stop the writer task and free the writer
+*/
+void isacfs_writer_stop(isacfs_writer_t *writer);
@@ -0,0 +1,82 @@
+#pragma once
+#include "isacfs.hpp"
+
+/**
+ * @brief Inter-frame delta stage in front of "isacfs_write_file" (for a fixed camera, where most of a frame repeats the previous one)
+ * @note Every "key_interval"-th frame is a key frame stored as it is, the ones in between are deltas against the previous
+ *       frame: the frame XOR the previous one, as runs of zero bytes (skipped) and of literal bytes. A delta that would not
+ *       come out smaller than the frame is stored as a key frame instead.
+ * @note A stored frame starts with a 8B header (type, frames since the key frame, size of the frame); the descriptors
+ *       are the usual ones, so the searches, "isacfs_read_range" and the iterators work on the stored frames unchanged.
+ * @note Encoding and decoding keep a frame of state each; they may run on two tasks, but each one on a single task.
+*/
+typedef struct isacfs_delta isacfs_delta_t;
+
+#define ISACFS_DELTA_HEADER_SIZE 0x8
+
+typedef enum
+{
+    isacfs_delta_key_frame = 0xD1,
+    isacfs_delta_delta_frame = 0xD2
+} isacfs_delta_frame_t;
+
+typedef struct {
+    u32 key_frames;
+    u32 delta_frames;
+    u64 raw_bytes;    // the frames handed to "isacfs_delta_write_file"
+    u64 stored_bytes; // what went to isacfs (with the headers)
+} isacfs_delta_stats_t;
+
+/**
+ * @param max_frame_size the biggest frame, encoded or decoded (the state buffers are that big)
+ * @param key_interval a key frame every that many frames (1 - key frames only) - the most frames decoded to get to one
+*/
+esp_err_t isacfs_delta_open(isacfs_delta_t **delta, u32 max_frame_size, u32 key_interval);
+
+void isacfs_delta_close(isacfs_delta_t *delta);
+
+/**
+ * @brief Change the key frame spacing from the next frame on
+*/
+void isacfs_delta_set_key_interval(isacfs_delta_t *delta, u32 key_interval);
+
+/**
+ * @brief Make the next frame a key frame (a scene change, the start of a clip)
+*/
+void isacfs_delta_force_key(isacfs_delta_t *delta);
+
+/**
+ * @brief Encode the frame against the previous one and write it with "isacfs_write_file" (the instance bound to the calling task)
+ * @note The frame becomes the reference of the next delta only once it is written - a failed frame is never referenced
+ * @returns ESP_ERR_INVALID_SIZE if "buf_sz" is over "max_frame_size"
+*/
+esp_err_t isacfs_delta_write_file(isacfs_delta_t *delta, isacfs_file_meta *file_meta, const u8 *buffer, u32 buf_sz);
+
+/**
+ * @brief Type of a stored frame and how many frames after its key frame it is (0 for a key frame)
+ * @returns ESP_ERR_NOT_SUPPORTED if "data" is not a frame of "isacfs_delta_write_file"
+*/
+esp_err_t isacfs_delta_frame_info(const u8 *data, u32 size, isacfs_delta_frame_t *type, u32 *key_distance);
+
+/**
+ * @brief Decode the next stored frame of a sequence (the frames of "isacfs_iter_next" or "isacfs_read_range", in the recording order)
+ * @param[out] out the frame, valid until the next decoding call
+ * @returns ESP_ERR_INVALID_STATE for a delta whose previous frame was not decoded just before (start at a key frame, see "isacfs_delta_key_meta")
+*/
+esp_err_t isacfs_delta_decode(isacfs_delta_t *delta, const u8 *data, u32 size, const u8 **out, u32 *out_size);
+
+/**
+ * @brief Move the meta location back to the key frame of the frame there
+ * @returns ESP_ERR_NOT_FOUND if the key frame is not in the log anymore (isacfs_layout_loop)
+*/
+esp_err_t isacfs_delta_key_meta(u32 *meta_sector, u32 *meta_offset);
+
+/**
+ * @brief Decode the frame described by "file_meta" from its key frame on
+ * @note The last decoded frame is kept, so reading the frames one after another decodes every one of them once
+ * @param meta_sector,meta_offset as with "isacfs_file_desc" (UNKNOWN_SECTOR&UNKNOWN_OFFSET - search by the timestamp of "file_meta")
+ * @param[out] out the frame, valid until the next decoding call
+*/
+esp_err_t isacfs_delta_read(isacfs_delta_t *delta, isacfs_file_meta *file_meta, u32 *meta_sector, u32 *meta_offset, const u8 **out, u32 *out_size);
+
+void isacfs_delta_get_stats(isacfs_delta_t *delta, isacfs_delta_stats_t *stats);
@@ -0,0 +1,214 @@
+#pragma once
+#include "isacfs.hpp"
+#include <string.h>
+
+/**
+ * @brief Big-endian 64-bit load/store (the byte order of the descriptors on the card)
+*/
+static inline u64 isacfs_load_be64(const u8 *p){
+    u64 v;
+    memcpy(&v, p, 0x8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline void isacfs_store_be64(u8 *p, u64 v){
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    memcpy(p, &v, 0x8);
+}
+
+#define ISACFS_MS_BITS 10U // milliseconds below the seconds of a packed timestamp
+#define ISACFS_DESC_8B_SHIFT 0x3
+#define ISACFS_DESC_16B_SHIFT 0x4
+
+/**
+ * @brief year_diff|month|day|hour|minute|second, as in the low bits of a descriptor
+*/
+static inline u64 __isacfs_pack_ts(const isacfs_file_meta *file_meta){
+    return ((u64)file_meta->year_diff << 26U) | ((u64)file_meta->month << 22U) | ((u64)file_meta->day << 17U)
+           | ((u64)file_meta->hour << 12U) | ((u64)file_meta->minute << 6U) | (u64)file_meta->second;
+}
+
+static inline void __isacfs_unpack_ts(u64 timestamp, isacfs_file_meta *file_meta){
+    file_meta->year_diff = timestamp >> 26U;
+    file_meta->month = (timestamp >> 22U) & 0xF;
+    file_meta->day = (timestamp >> 17U) & 0x1F;
+    file_meta->hour = (timestamp >> 12U) & 0x1F;
+    file_meta->minute = (timestamp >> 6U) & 0x3F;
+    file_meta->second = timestamp & 0x3F;
+}
+
+/**
+ * @brief Extension of a 16B descriptor: millisecond(2B), reserved(2B), sequence number(4B)
+*/
+static inline u32 __isacfs_desc_ms(const u8 *desc){
+    return ((u32)desc[0x8] << 8U) | desc[0x9];
+}
+
+static inline u32 __isacfs_desc_sequence(const u8 *desc){
+    return ((u32)desc[0xC] << 24U) | ((u32)desc[0xD] << 16U) | ((u32)desc[0xE] << 8U) | desc[0xF];
+}
+
+static inline void __isacfs_desc_put_ms(u8 *desc, u32 millisecond){
+    desc[0x8] = millisecond >> 8U;
+    desc[0x9] = millisecond & 0xFF;
+}
+
+static inline void __isacfs_desc_put_sequence(u8 *desc, u32 sequence){
+    desc[0xC] = sequence >> 24U;
+    desc[0xD] = (sequence >> 16U) & 0xFF;
+    desc[0xE] = (sequence >> 8U) & 0xFF;
+    desc[0xF] = sequence & 0xFF;
+}
+
+/**
+ * @brief Geometry-dependent part of isacfs: the 5-byte sector&offset addresses (superblock, trailers) and the descriptors
+ * @note "encode_desc"/"decode_desc" handle the first 8 bytes of a descriptor; the batch codec takes the descriptor size
+ *       (1 << desc_shift) and puts the milliseconds of the 16B descriptors into the packed timestamps
+ * @note "isacfs_init" picks the instantiation of "isacfs_engine" matching the card, the runtime-detected geometry is the fallback
+*/
+typedef struct {
+    void (*encode_desc)(const isacfs_file_meta *file_meta, u8 *desc_8B_blk);
+    void (*decode_desc)(const u8 *desc_8B_blk, isacfs_file_meta *file_meta);
+    void (*put_addr_5B)(u8 *blk_5B, u32 sector, u32 offset);
+    void (*get_addr_5B)(const u8 *blk_5B, u32 *sector, u32 *offset);
+    void (*decode_descs)(const u8 *descs, u32 count, u32 desc_shift, u32 *sector, u32 *offset, u64 *timestamp);
+    void (*encode_descs)(u8 *descs, u32 count, u32 desc_shift, const u32 *sector, const u32 *offset, const u64 *timestamp);
+} isacfs_engine_ops_t;
+
+/**
+ * @brief Codec for a fixed sector geometry - every shift and mask is a compile-time constant
+ * @note On the 32-bit target a 64-bit shift by a variable amount is a libgcc call, by a constant it is a couple of word moves
+*/
+template <u32 SectorSize, u8 SectorAddrBits, u8 OffsetAddrBits>
+struct isacfs_engine {
+    static_assert(SectorSize == (0x1U << OffsetAddrBits), "the sector size has to be 2^OffsetAddrBits");
+    static_assert(SectorAddrBits > 0x0 && SectorAddrBits + OffsetAddrBits <= 38U, "256GiB limit exceeded");
+
+    static const u32 sector_size = SectorSize;
+    static const u32 offset_mask = SectorSize - 0x1;
+    static const u8 sector_shift = 64U - SectorAddrBits;
+    static const u8 offset_shift = 64U - SectorAddrBits - OffsetAddrBits;
+    static const u8 year_diff_width = 38U - SectorAddrBits - OffsetAddrBits;
+    static const u64 timestamp_mask = (0x1ULL << offset_shift) - 0x1;
+
+    static void encode_desc(const isacfs_file_meta *file_meta, u8 *desc_8B_blk){
+        u64 desc_u64 = (u64)file_meta->sector << sector_shift;
+        desc_u64 |= (u64)file_meta->offset << offset_shift;
+        desc_u64 |= __isacfs_pack_ts(file_meta);
+        isacfs_store_be64(desc_8B_blk, desc_u64);
+    }
+
+    static void decode_desc(const u8 *desc_8B_blk, isacfs_file_meta *file_meta){
+        u64 desc_u64 = isacfs_load_be64(desc_8B_blk);
+        file_meta->sector = desc_u64 >> sector_shift;
+        file_meta->offset = (desc_u64 >> offset_shift) & offset_mask;
+        __isacfs_unpack_ts(desc_u64 & timestamp_mask, file_meta);
+    }
+
+    /**
+     * @note The loops have no dependency between the iterations and vectorize on the host (the byte swap is a shuffle)
+    */
+    template <u32 DescShift>
+    static void decode_descs_of(const u8 *__restrict descs, u32 count, u32 *__restrict sector, u32 *__restrict offset, u64 *__restrict timestamp){
+        if(!sector || !offset){
+            for(u32 i = 0x0; i < count; i++){
+                const u8 *desc = descs + (i << DescShift);
+                timestamp[i] = ((isacfs_load_be64(desc) & timestamp_mask) << ISACFS_MS_BITS) | (DescShift == ISACFS_DESC_16B_SHIFT ? __isacfs_desc_ms(desc) : 0x0);
+            }
+            return;
+        }
+        for(u32 i = 0x0; i < count; i++){
+            const u8 *desc = descs + (i << DescShift);
+            u64 desc_u64 = isacfs_load_be64(desc);
+            sector[i] = desc_u64 >> sector_shift;
+            offset[i] = (desc_u64 >> offset_shift) & offset_mask;
+            timestamp[i] = ((desc_u64 & timestamp_mask) << ISACFS_MS_BITS) | (DescShift == ISACFS_DESC_16B_SHIFT ? __isacfs_desc_ms(desc) : 0x0);
+        }
+    }
+
+    static void decode_descs(const u8 *__restrict descs, u32 count, u32 desc_shift, u32 *__restrict sector, u32 *__restrict offset, u64 *__restrict timestamp){
+        if(desc_shift == ISACFS_DESC_16B_SHIFT){
+            decode_descs_of<ISACFS_DESC_16B_SHIFT>(descs, count, sector, offset, timestamp);
+        }
+        else {
+            decode_descs_of<ISACFS_DESC_8B_SHIFT>(descs, count, sector, offset, timestamp);
+        }
+    }
+
+    /**
+     * @note The sequence numbers of the 16B descriptors are left as they are
+    */
+    static void encode_descs(u8 *__restrict descs, u32 count, u32 desc_shift, const u32 *__restrict sector, const u32 *__restrict offset, const u64 *__restrict timestamp){
+        for(u32 i = 0x0; i < count; i++){
+            u8 *desc = descs + (i << desc_shift);
+            isacfs_store_be64(desc, ((u64)sector[i] << sector_shift) | ((u64)offset[i] << offset_shift) | ((timestamp[i] >> ISACFS_MS_BITS) & timestamp_mask));
+            if(desc_shift == ISACFS_DESC_16B_SHIFT){
+                __isacfs_desc_put_ms(desc, timestamp[i] & ((0x1U << ISACFS_MS_BITS) - 0x1));
+            }
+        }
+    }
+
+    static void put_addr_5B(u8 *blk_5B, u32 sector, u32 offset){
+        u64 blk_5B_u64 = ((u64)sector << sector_shift) | ((u64)offset << offset_shift);
+        for(u8 i = 0x0; i < 0x5; i++){
+            blk_5B[i] = blk_5B_u64 >> (56U - (i << 0x3));
+        }
+    }
+
+    static void get_addr_5B(const u8 *blk_5B, u32 *sector, u32 *offset){
+        u64 blk_5B_u64 = 0x0;
+        for(u8 i = 0x0; i < 0x5; i++){
+            blk_5B_u64 |= (u64)blk_5B[i] << (56U - (i << 0x3));
+        }
+        *sector = blk_5B_u64 >> sector_shift;
+        *offset = (blk_5B_u64 >> offset_shift) & offset_mask;
+    }
+
+    static const isacfs_engine_ops_t ops;
+};
+
+template <u32 SectorSize, u8 SectorAddrBits, u8 OffsetAddrBits>
+const isacfs_engine_ops_t isacfs_engine<SectorSize, SectorAddrBits, OffsetAddrBits>::ops = {
+    isacfs_engine<SectorSize, SectorAddrBits, OffsetAddrBits>::encode_desc,
+    isacfs_engine<SectorSize, SectorAddrBits, OffsetAddrBits>::decode_desc,
+    isacfs_engine<SectorSize, SectorAddrBits, OffsetAddrBits>::put_addr_5B,
+    isacfs_engine<SectorSize, SectorAddrBits, OffsetAddrBits>::get_addr_5B,
+    isacfs_engine<SectorSize, SectorAddrBits, OffsetAddrBits>::decode_descs,
+    isacfs_engine<SectorSize, SectorAddrBits, OffsetAddrBits>::encode_descs
+};
+
+/**
+ * @brief Instantiations for every sector address width up to SectorAddrBits (the card capacity decides it at runtime)
+*/
+template <u32 SectorSize, u8 OffsetAddrBits, u8 SectorAddrBits>
+struct isacfs_engine_table {
+    static const isacfs_engine_ops_t *select(u8 sector_addr_width){
+        if(sector_addr_width == SectorAddrBits){
+            return &isacfs_engine<SectorSize, SectorAddrBits, OffsetAddrBits>::ops;
+        }
+        return isacfs_engine_table<SectorSize, OffsetAddrBits, SectorAddrBits - 0x1>::select(sector_addr_width);
+    }
+};
+
+template <u32 SectorSize, u8 OffsetAddrBits>
+struct isacfs_engine_table<SectorSize, OffsetAddrBits, 0x0> {
+    static const isacfs_engine_ops_t *select(u8){
+        return NULL;
+    }
+};
+
+/**
+ * @brief Specialized codec for the card geometry - 512B sectors (every SDHC/SDXC card), any capacity up to 256GiB
+ * @returns NULL if there is none (use the runtime-detected geometry)
+*/
+inline const isacfs_engine_ops_t *isacfs_engine_select(u32 sector_size, u8 sector_addr_width, u8 offset_addr_width){
+    if(sector_size != 0x200 || offset_addr_width != 0x9 || sector_addr_width + offset_addr_width > 38U){
+        return NULL;
+    }
+    return isacfs_engine_table<0x200, 0x9, 38U - 0x9>::select(sector_addr_width);
+}
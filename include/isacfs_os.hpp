@@ -0,0 +1,61 @@
+#pragma once
+#include "microSD.hpp"
+
+#define ISACFS_WAIT_FOREVER 0xFFFFFFFFU
+#define ISACFS_DMA_ALIGN 0x40 // cache line of the ESP32-S3 (twice the one of the ESP32)
+
+/**
+ * @brief Binary semaphore (FreeRTOS on the target, std::condition_variable on the host)
+*/
+typedef struct isacfs_event isacfs_event_t;
+
+isacfs_event_t *isacfs_event_create();
+void isacfs_event_destroy(isacfs_event_t *event);
+void isacfs_event_give(isacfs_event_t *event);
+
+/**
+ * @returns false on timeout
+*/
+bool isacfs_event_take(isacfs_event_t *event, uint32_t timeout_ms);
+
+/**
+ * @brief Mutex (FreeRTOS recursive mutex on the target, std::recursive_mutex on the host)
+*/
+typedef struct isacfs_mutex isacfs_mutex_t;
+
+isacfs_mutex_t *isacfs_mutex_create();
+void isacfs_mutex_destroy(isacfs_mutex_t *mutex);
+void isacfs_mutex_lock(isacfs_mutex_t *mutex);
+void isacfs_mutex_unlock(isacfs_mutex_t *mutex);
+
+/**
+ * @brief Memory the card driver can DMA to and from, ISACFS_DMA_ALIGN-aligned (internal RAM on the target)
+ * @returns NULL if out of such memory
+*/
+void *isacfs_dma_alloc(size_t size);
+
+void isacfs_dma_free(void *buf);
+
+/**
+ * @brief Whether the card driver transfers straight from/to "buf" - DMA-capable and word-aligned
+ * @note The ESP32 SDMMC driver splits a transfer from/to any other buffer into single-sector ones through a bounce
+ *       sector of its own; the host build applies the same alignment rule so that the same paths run there
+*/
+bool isacfs_dma_capable(const void *buf);
+
+/**
+ * @brief Worker task (FreeRTOS task on the target, std::thread on the host)
+*/
+typedef struct isacfs_task isacfs_task_t;
+
+/**
+ * @param stack_size in bytes (ignored on the host)
+ * @param priority FreeRTOS priority (ignored on the host)
+ * @returns NULL on failure
+*/
+isacfs_task_t *isacfs_task_start(void (*fn)(void *), void *arg, const char *name, uint32_t stack_size, uint32_t priority);
+
+/**
+ * @brief Wait for "fn" to return and release the task
+*/
+void isacfs_task_join(isacfs_task_t *task);
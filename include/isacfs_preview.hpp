@@ -0,0 +1,69 @@
+#pragma once
+#include "isacfs.hpp"
+
+/**
+ * @brief Preview tier next to the frames - small previews (thumbnails) for scrubbing through a recording
+ * @note The previews go to an instance of their own, formatted for their size (e.g. a stream of "isacfs_streams" next to
+ *       the stream of the frames), so that a time range of previews lies packed in its own region of the card and
+ *       comes in a few big reads instead of reading every full frame.
+ * @note A preview is stored under the key of the descriptor of its frame - the same timestamp (and millisecond) -
+ *       so the frame's descriptor finds its preview with a search of the preview log. The other way round, a preview
+ *       starts with a 20B header holding the data address, size and sequence number of its frame: "isacfs_read_file"
+ *       reads the frame from there without searching the log of the frames.
+ * @note Format the preview instance with the descriptor format of the frames (the milliseconds of the key).
+*/
+typedef struct isacfs_preview isacfs_preview_t;
+
+#define ISACFS_PREVIEW_HEADER_SIZE 0x14
+
+typedef struct {
+    u32 every_nth; // a decimated preview of every N-th frame (0 - only the previews handed over by the caller)
+    /* decimation of raw frames (width * height pixels of "bytes_per_pixel", row after row) */
+    u32 width;
+    u32 height;
+    u32 bytes_per_pixel;
+    u32 factor; // every factor-th pixel of every factor-th row
+} isacfs_preview_config_t;
+
+/**
+ * @param previews the instance the previews go to
+*/
+esp_err_t isacfs_preview_open(isacfs_preview_t **preview, isacfs_t *previews, const isacfs_preview_config_t *config);
+
+void isacfs_preview_close(isacfs_preview_t *preview);
+
+/**
+ * @brief Write the frame with "isacfs_write_file" (the instance bound to the calling task), then its preview
+ * @param thumb the preview handed over by the caller (NULL - the decimated frame, on every "every_nth"-th frame)
+ * @returns the error of the preview if only the preview failed (the frame is written then)
+*/
+esp_err_t isacfs_preview_write_file(isacfs_preview_t *preview, isacfs_file_meta *file_meta, const u8 *buffer, u32 buf_sz, const u8 *thumb = NULL, u32 thumb_sz = 0x0);
+
+/**
+ * @brief "isacfs_sync" of the preview instance
+*/
+esp_err_t isacfs_preview_sync(isacfs_preview_t *preview);
+
+/**
+ * @brief Called by "isacfs_preview_range" for every preview of the range
+ * @param frame_meta the frame of the preview - timestamp, data address, size and sequence, ready for "isacfs_read_file"
+ *        (sector and offset are UNKNOWN_SECTOR&UNKNOWN_OFFSET if "thumb" is NULL)
+ * @param thumb view of the preview, valid until the callback returns (NULL for a preview bigger than the buffer)
+ * @returns false to stop
+*/
+typedef bool (*isacfs_preview_cb_t)(const isacfs_file_meta *frame_meta, const u8 *thumb, u32 thumb_sz, void *user);
+
+/**
+ * @brief Hand out the previews of the frames with a timestamp in [t_begin, t_end] (see "isacfs_read_range")
+ * @param buffer the previews are read in multi-block transfers as big as it is
+ * @returns ESP_ERR_NOT_FOUND if no preview falls into the range
+*/
+esp_err_t isacfs_preview_range(isacfs_preview_t *preview, const isacfs_file_meta *t_begin, const isacfs_file_meta *t_end, u8 *buffer, u32 buffer_size,
+                               isacfs_preview_cb_t cb, void *user);
+
+/**
+ * @brief Read the preview of the frame described by "frame_meta" (found by its timestamp)
+ * @param[out] thumb_sz size of the preview
+ * @returns ESP_ERR_NOT_FOUND if the frame has no preview, ESP_ERR_INVALID_SIZE if the preview is bigger than "out_size"
+*/
+esp_err_t isacfs_preview_read(isacfs_preview_t *preview, const isacfs_file_meta *frame_meta, u8 *out, u32 out_size, u32 *thumb_sz);
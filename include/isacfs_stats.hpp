@@ -0,0 +1,76 @@
+#pragma once
+#include "isacfs.hpp"
+
+/**
+ * @brief I/O and latency instrumentation, compiled in with -DISACFS_STATS (the hooks are empty macros otherwise)
+ * @note The counters live in static memory and are bumped without locking - the hot path never allocates or blocks,
+ *       a count may be lost when two tasks race on the same counter
+*/
+
+#define ISACFS_STATS_BUCKETS 24 // bucket i counts latencies in [2^i, 2^(i+1)) us (bucket 0 also 0us), the last one everything above
+
+typedef enum {
+    isacfs_op_write_file,
+    isacfs_op_read_file,
+    isacfs_op_file_desc, // descriptor lookup (timestamp search included)
+    isacfs_op_format,
+    isacfs_op_init,
+    isacfs_op_card_read, // micro_sd_read_sectors
+    isacfs_op_card_write, // micro_sd_write_sectors
+    isacfs_op_card_erase, // micro_sd_erase_sectors
+    ISACFS_OP_COUNT
+} isacfs_op_t;
+
+typedef struct {
+    u32 count;
+    u32 errors;
+    u64 total_us;
+    u32 max_us;
+    u32 hist[ISACFS_STATS_BUCKETS];
+} isacfs_op_stats_t;
+
+typedef struct {
+    u64 sectors_read;
+    u64 sectors_written;
+    u64 sectors_erased;
+    u32 rmw_cycles; // partial sectors read back to be patched
+    u32 marker_shifts; // FUTURE_WRITE marker moves
+    u32 journal_flushes; // metadata sector writes
+    u64 bounced_sectors; // sectors copied through a bounce buffer of the pool (the caller buffer wasn't DMA-capable)
+    u32 pool_misses; // pool buffers asked for while all of them were taken (a heap buffer was used instead)
+    isacfs_op_stats_t ops[ISACFS_OP_COUNT];
+} isacfs_stats_t;
+
+/**
+ * @brief Copy the counters (no lock - a snapshot taken while recording may be a few counts off between fields)
+ * @returns ESP_ERR_NOT_SUPPORTED if built without ISACFS_STATS
+*/
+esp_err_t isacfs_stats_snapshot(isacfs_stats_t *stats);
+
+void isacfs_stats_reset();
+
+/**
+ * @brief Serialize a snapshot compactly: "IS" magic, version byte, then every field as an unsigned LEB128 varint
+ *        in the declaration order of isacfs_stats_t (an empty histogram bucket takes 1 byte)
+ * @returns number of bytes written, 0 if "out" is too small
+*/
+size_t isacfs_stats_dump(const isacfs_stats_t *stats, u8 *out, size_t out_size);
+
+/**
+ * @brief Print a snapshot over Serial, one line per operation with its non-empty histogram buckets
+*/
+void isacfs_stats_print(const isacfs_stats_t *stats);
+
+#ifdef ISACFS_STATS
+void __isacfs_stats_op(isacfs_op_t op, u64 elapsed_us, bool ok);
+extern isacfs_stats_t __isacfs_stats;
+
+/* timed on the clock of the card (see "micro_sd_clock_us_on") - the simulated time on the host */
+#define ISACFS_STATS_BEGIN(t0, card) u64 t0 = micro_sd_clock_us_on(card)
+#define ISACFS_STATS_END(op, t0, card, ok) __isacfs_stats_op(op, micro_sd_clock_us_on(card) - (t0), ok)
+#define ISACFS_STATS_ADD(field, n) (__isacfs_stats.field += (n))
+#else
+#define ISACFS_STATS_BEGIN(t0, card)
+#define ISACFS_STATS_END(op, t0, card, ok)
+#define ISACFS_STATS_ADD(field, n)
+#endif
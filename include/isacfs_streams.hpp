@@ -0,0 +1,58 @@
+#pragma once
+#include "isacfs.hpp"
+
+/**
+ * @brief Several streams (channels) on one card, e.g. a visible and a thermal camera
+ * @note Every stream is a complete isacfs of its own (superblock, descriptor log, write cursors, time search and
+ *       iteration), on a block device of its own that spans the whole card. That device is mapped onto the card
+ *       in extents of an allocation unit - a physical extent is claimed the first time the stream writes into it,
+ *       so the streams share the free space instead of splitting it up front, and the writes of a stream stay
+ *       sequential within its extents.
+ * @note Bind the instance of a stream (or start an "isacfs_writer" on it) on the capture task of that stream - the
+ *       streams write concurrently; only claiming an extent (once per allocation unit) takes the lock of the card.
+ * @note Card layout: sector 0 - the stream table, sector 1 on - the extent table (4B per extent: the stream and
+ *       its logical extent, 0 - free), then the extents, aligned to the extent size
+*/
+typedef struct isacfs_streams isacfs_streams_t;
+
+#define ISACFS_MAX_STREAMS 0x8
+#define ISACFS_STREAMS_DEFAULT_EXTENT_SIZE 0x400000 // the allocation unit of the SDHC/SDXC cards
+
+/**
+ * @brief Lay out the stream and extent tables - every stream starts out empty and unformatted
+ * @param extent_size a power of 2 multiple of the sector size (0 - ISACFS_STREAMS_DEFAULT_EXTENT_SIZE)
+ * @param max_extents a cap per stream (NULL or 0 - the whole card); required for isacfs_layout_loop streams - a loop
+ *        stream fills its device before wrapping, so the caps of the loop streams must add up to at most the card
+ * @returns ESP_ERR_INVALID_SIZE if the card holds too few extents or more than 0xFFFF
+*/
+esp_err_t isacfs_streams_format(const micro_sd_backend_t *card, u32 streams_count, u32 extent_size = 0x0, const u32 *max_extents = NULL);
+
+/**
+ * @brief Load the stream and extent tables and create an instance per stream (see "isacfs_open"), nothing else is read yet
+ * @returns ESP_ERR_NOT_FOUND if "isacfs_streams_format" hasn't been run on the card
+*/
+esp_err_t isacfs_streams_open(isacfs_streams_t **streams, const micro_sd_backend_t *card);
+
+/**
+ * @brief Close the instances of the streams (stop their writers first)
+*/
+void isacfs_streams_close(isacfs_streams_t *streams);
+
+u32 isacfs_streams_count(const isacfs_streams_t *streams);
+
+/**
+ * @brief Instance of the stream "stream" - bind it and "isacfs_init" it (an unformatted stream needs "isacfs_format",
+ *        isacfs_format_fast - a full format would claim every extent it clears)
+*/
+isacfs_t *isacfs_stream(isacfs_streams_t *streams, u32 stream);
+
+/**
+ * @brief Extents claimed by the stream "stream" (ISACFS_MAX_STREAMS - the free extents of the card)
+*/
+u32 isacfs_streams_extents(const isacfs_streams_t *streams, u32 stream);
+
+/**
+ * @brief Give the extents of the stream "stream" back to the card - the stream is empty and unformatted afterwards
+ * @note The stream must not be in use (no writer, no iterator, not bound on another task)
+*/
+esp_err_t isacfs_streams_reset(isacfs_streams_t *streams, u32 stream);
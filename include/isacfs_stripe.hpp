@@ -0,0 +1,82 @@
+#pragma once
+#include "isacfs.hpp"
+#include "isacfs_async.hpp"
+
+/**
+ * @brief Striping (RAID-0) of the frame sequence over several cards
+ * @note Every card holds a complete isacfs of its own (superblock, descriptor log, data region) and can be read alone.
+ *       Frames rotate over the cards - "frames_per_card" consecutive frames go to one card, then to the next one.
+ *       A writer task per card writes its frames while the other cards write theirs, so the busy time of one card
+ *       overlaps with the transfers to the others.
+ * @note Reading merges the descriptor logs of the cards back into the timestamp order; frames with the same timestamp
+ *       come in the rotation order.
+*/
+typedef struct isacfs_stripe isacfs_stripe_t;
+
+/**
+ * @brief Create an instance on every card (see "isacfs_open"), nothing is read from the cards yet
+ * @param frames_per_card consecutive frames written to a card before moving to the next one (0 is taken as 1)
+*/
+esp_err_t isacfs_stripe_open(isacfs_stripe_t **stripe, const micro_sd_backend_t *const *cards, u32 cards_count, u32 frames_per_card);
+
+/**
+ * @brief "isacfs_init" on every card
+ * @returns the first error
+*/
+isacfs_err_t isacfs_stripe_init(isacfs_stripe_t *stripe);
+
+/**
+ * @brief "isacfs_format" on every card (call "isacfs_stripe_init" first, and again afterwards)
+*/
+esp_err_t isacfs_stripe_format(isacfs_stripe_t *stripe, isacfs_format_mode_t mode = isacfs_format_full, isacfs_layout_t layout = isacfs_layout_fixed, u32 avg_file_size = 0x0,
+                               isacfs_desc_format_t desc_format = isacfs_desc_8B);
+
+/**
+ * @brief Start a writer task per card (see "isacfs_writer_start")
+ * @note If one of them fails to start, the ones already started are stopped
+*/
+esp_err_t isacfs_stripe_start(isacfs_stripe_t *stripe, u32 queue_len, u32 stack_size, u32 priority);
+
+/**
+ * @brief Queue a frame for the card whose turn it is (single producer, never blocks)
+ * @note "buffer" belongs to isacfs until "cb" is called, on the writer task of the card
+ * @returns ESP_ERR_NO_MEM if the queue of that card is full - the frame is not taken and the rotation stays put
+*/
+esp_err_t isacfs_stripe_write_file(isacfs_stripe_t *stripe, const isacfs_file_meta *file_meta, const u8 *buffer, u32 buf_sz, isacfs_write_cb_t cb, void *user);
+
+/**
+ * @brief Barrier - wait until the queued frames are written and their descriptors are on all the cards
+ * @returns the first error
+*/
+esp_err_t isacfs_stripe_flush(isacfs_stripe_t *stripe);
+
+/**
+ * @brief Instance of the card "card" (bind it to use the single-card functions on it)
+*/
+isacfs_t *isacfs_stripe_card(isacfs_stripe_t *stripe, u32 card);
+
+/**
+ * @brief Flush, stop the writer tasks and close the instances
+*/
+void isacfs_stripe_close(isacfs_stripe_t *stripe);
+
+/**
+ * @brief Iterator over the striped sequence in the timestamp order (a k-way merge of an "isacfs_iter" per card)
+*/
+typedef struct isacfs_stripe_iter isacfs_stripe_iter_t;
+
+/**
+ * @param key first frame not older than "key" (NULL - from the oldest frame on)
+ * @param max_frame_size bigger frames are reported with ESP_ERR_INVALID_SIZE
+*/
+esp_err_t isacfs_stripe_iter_open(isacfs_stripe_iter_t **iter, isacfs_stripe_t *stripe, const isacfs_file_meta *key, u32 max_frame_size);
+
+/**
+ * @brief Hand out the next frame with its timestamp and size
+ * @param[out] data valid until the next call
+ * @param[out] card the card holding the frame (optional)
+ * @returns ESP_ERR_NOT_FOUND once all the cards are through
+*/
+esp_err_t isacfs_stripe_iter_next(isacfs_stripe_iter_t *iter, isacfs_file_meta *file_meta, const u8 **data, u32 *card);
+
+void isacfs_stripe_iter_close(isacfs_stripe_iter_t *iter);
@@ -1,14 +1,71 @@
+#pragma once
+#ifdef ISACFS_HOST
+#include "host_compat.hpp"
+#else
 #include <Arduino.h>
 #include "driver/sdmmc_host.h"
 #include "driver/sdmmc_defs.h"
 #include "sdmmc_cmd.h"
 #include "esp_vfs_fat.h"
+#endif
+
+/**
+ * @brief Block device the micro_sd_* functions are routed to
+ * @note "ctx" is passed back to every callback
+*/
+typedef struct {
+    esp_err_t (*read_sectors)(void *ctx, void *dst, size_t start_sector, size_t sector_count);
+    esp_err_t (*write_sectors)(void *ctx, const void *src, size_t start_sector, size_t sector_count);
+    esp_err_t (*erase_sectors)(void *ctx, size_t start_sector, size_t sector_count); // NULL - not supported
+    int (*get_sectors_count)(void *ctx);
+    int (*get_sector_size)(void *ctx);
+    void (*print_info)(void *ctx);
+    uint64_t (*clock_us)(void *ctx); // NULL - micros(); a simulated card keeps the time of its own
+    void *ctx;
+} micro_sd_backend_t;
+
+/**
+ * @brief Route the micro_sd_* functions to "backend" (the SDMMC card on the target by default)
+*/
+void micro_sd_set_backend(const micro_sd_backend_t *backend);
 
 esp_err_t init_sdcard();
+
+/**
+ * @brief Bring up the card in SDMMC slot "slot" (0 or 1) without mounting a FAT volume, for several cards at once
+ * @note Use instead of "init_sdcard"; the slot pins are the SDMMC_SLOT_CONFIG_DEFAULT ones (on the ESP32 the slot 0
+ *       lines are shared with the SPI flash of most modules)
+ * @param[out] backend block device of the card (see the micro_sd_*_on functions)
+ * @returns ESP_ERR_NOT_SUPPORTED on the host
+*/
+esp_err_t init_sdcard_slot(int slot, const micro_sd_backend_t **backend);
+
 esp_err_t micro_sd_read_sectors(void *dst, size_t start_sector, size_t sector_count);
 esp_err_t micro_sd_write_sectors(const void *src, size_t start_sector, size_t sector_count);
+
+/**
+ * @brief Erase (CMD38) the sectors - they read back as zeroes
+ * @returns ESP_ERR_NOT_SUPPORTED if the card/backend can't erase
+*/
+esp_err_t micro_sd_erase_sectors(size_t start_sector, size_t sector_count);
 void micro_sd_print_csd();
 int micro_sd_get_sectors_count();
 int micro_sd_get_sector_size();
 uint8_t micro_sd_get_sector_addr_width();
 int micro_sd_get_offset_addr_width();
+
+/**
+ * @brief The micro_sd_* functions on a given block device (NULL - the one set with "micro_sd_set_backend")
+*/
+esp_err_t micro_sd_read_sectors_on(const micro_sd_backend_t *backend, void *dst, size_t start_sector, size_t sector_count);
+esp_err_t micro_sd_write_sectors_on(const micro_sd_backend_t *backend, const void *src, size_t start_sector, size_t sector_count);
+esp_err_t micro_sd_erase_sectors_on(const micro_sd_backend_t *backend, size_t start_sector, size_t sector_count);
+int micro_sd_get_sectors_count_on(const micro_sd_backend_t *backend);
+int micro_sd_get_sector_size_on(const micro_sd_backend_t *backend);
+uint8_t micro_sd_get_sector_addr_width_on(const micro_sd_backend_t *backend);
+int micro_sd_get_offset_addr_width_on(const micro_sd_backend_t *backend);
+
+/**
+ * @brief Microseconds on the clock the card runs on - the time its commands take
+*/
+uint64_t micro_sd_clock_us_on(const micro_sd_backend_t *backend);
@@ -0,0 +1,72 @@
+#pragma once
+#include "microSD.hpp"
+
+/**
+ * @brief Cost model of the simulated card (in microseconds)
+ * @note A write of up to "small_write_sectors" sectors that doesn't continue the previous write is a small random write
+ * @note A sector written over old data costs "overwrite_sector_us" on top - the card has to clear it first, an erased
+ *       sector (erase command, or never written since the image was opened) takes the data right away
+ * @note A transfer from/to a buffer that isn't word-aligned costs a command per sector - the ESP32 SDMMC driver sends
+ *       such buffers sector by sector through a DMA-capable bounce sector of its own
+*/
+typedef struct {
+    uint32_t cmd_overhead_us;
+    uint32_t read_sector_us;
+    uint32_t write_sector_us;
+    uint32_t random_write_penalty_us;
+    uint32_t small_write_sectors;
+    uint32_t erase_mib_us; // per MiB erased, on top of the command overhead
+    uint32_t overwrite_sector_us;
+} micro_sd_sim_latency_t;
+
+typedef struct {
+    uint64_t commands;
+    uint64_t read_commands;
+    uint64_t write_commands;
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+    uint64_t random_writes;
+    uint64_t sectors_overwritten; // written over old data
+    uint64_t erase_commands;
+    uint64_t sectors_erased;
+    uint64_t busy_us; // simulated time spent in the card
+} micro_sd_sim_stats_t;
+
+typedef struct micro_sd_sim micro_sd_sim_t;
+
+/**
+ * @brief Open (create if needed) a card image of "sector_count" 512B sectors
+ * @param use_mmap map the image into memory instead of using pread/pwrite
+ * @returns NULL on failure
+*/
+micro_sd_sim_t *micro_sd_sim_open(const char *image_path, size_t sector_count, bool use_mmap);
+
+/**
+ * @brief Open an image like "micro_sd_sim_open", but with a card that has no erase command
+*/
+micro_sd_sim_t *micro_sd_sim_open_no_erase(const char *image_path, size_t sector_count, bool use_mmap);
+void micro_sd_sim_close(micro_sd_sim_t *sim);
+
+/**
+ * @brief Backend routing the micro_sd_* functions to "sim" (pass it to "micro_sd_set_backend")
+*/
+const micro_sd_backend_t *micro_sd_sim_backend(micro_sd_sim_t *sim);
+
+/**
+ * @brief Take every sector for holding old data, like on a card that has been written full before (the image is unchanged)
+*/
+void micro_sd_sim_mark_written(micro_sd_sim_t *sim);
+
+void micro_sd_sim_set_latency(micro_sd_sim_t *sim, const micro_sd_sim_latency_t *latency);
+void micro_sd_sim_get_stats(const micro_sd_sim_t *sim, micro_sd_sim_stats_t *stats);
+void micro_sd_sim_reset_stats(micro_sd_sim_t *sim);
+
+/**
+ * @brief Simulated time (in microseconds) - advanced only by the card commands
+*/
+uint64_t micro_sd_sim_clock_us(const micro_sd_sim_t *sim);
+
+/**
+ * @brief Default cost model, roughly a class 10 card on a 4-bit 40MHz SDMMC bus
+*/
+extern const micro_sd_sim_latency_t MICRO_SD_SIM_DEFAULT_LATENCY;
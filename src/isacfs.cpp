@@ -1,167 +1,627 @@
-#include "microSD.hpp"
+#include "isacfs.hpp"
+#include "isacfs_engine.hpp"
+#include "isacfs_os.hpp"
+#include "isacfs_stats.hpp"
+#include <atomic>
+#include <new>
 
-#define UNKNOWN_SECTOR 0x0
-#define UNKNOWN_OFFSET 0x0
-#define YEAR_DIFF_REF 2023
 #define FILE_LEAP 3600 
-
-typedef unsigned long long u64;
-typedef unsigned int u32;
-typedef unsigned char u8;
-typedef enum
-{
-    isacfs_ok,
-    isacfs_256GiB_limit_exceeded,
-    isacfs_fail
-} isacfs_err_t;
+#define META_START_OFFSET 0x10 // superblock: DATA_START(5B), FUTURE_WRITE(5B), AVG_FILE_SIZE(4B), DATA_LAYOUT(1B), descriptor size(1B)
+#define DEFAULT_AVG_FILE_SIZE (0x1 << 14U)
+#define AVG_FILE_SIZE_EWMA_SHIFT 0x4 // every new frame weighs 1/16 in the running average
+#define META_TRAILER_SIZE 0x10 // magic(2B), FORMAT_GENERATION(4B), written slots count(1B), META_LAP(1B), data head(5B), loop tail(3B)
+#define META_MAGIC 0x15AC
+#define CLEAR_CHUNK_SECTORS 0x40
+#define JOURNAL_MAX_PENDING_FILES 0x0 // 0 - flush only when the metadata sector fills
+#define JOURNAL_MAX_PENDING_MS 1000U
+#define FENCE_CACHE_SIZE 0x40
+#define ITER_TASK_STACK_SIZE 4096U
+#define ITER_TASK_PRIORITY 5U
+#define GROUP_COMMIT_MIN_SEGMENT (0x1 << 16U) // 64KiB
+#define GROUP_COMMIT_MAX_SEGMENT (0x1 << 22U) // 4MiB - the allocation unit of the big cards
+#define GROUP_COMMIT_BYTES_PER_FILE 0x400 // staged descriptors per segment: 1 per 1KiB, the segment is committed early beyond that
+#define RANGE_MAX_FRAMES 0x100 // frames handed out per data read at most
+#define LOOP_EVICT_AHEAD (0x1 << 20U) // isacfs_layout_loop: bytes freed beyond the frame whenever the tail has to move (1 tail store per MiB)
+#define PREERASE_DEFAULT_CHUNK (0x1 << 22U) // 4MiB - the allocation unit of the big cards
+#define LOOP_TAIL_BITS 24U // the tail (metadata sector|slot) in the trailer
+
+#ifdef ISACFS_SECTOR_SIZE // the sector size is fixed at compile time (-DISACFS_SECTOR_SIZE=512), other cards are rejected
+static constexpr u32 SECTOR_SIZE = ISACFS_SECTOR_SIZE;
+static constexpr u8 OFFSET_ADDR_WIDTH = __builtin_ctz(ISACFS_SECTOR_SIZE);
+static_assert(SECTOR_SIZE == (0x1U << OFFSET_ADDR_WIDTH), "ISACFS_SECTOR_SIZE has to be a power of 2");
+#endif
+
+/* sector buffer pool (one DMA-capable allocation per instance): the resident sectors, the scratch sectors, the bounce buffers */
+#define SECTOR_BUFS_COUNT 0x4
+#define POOL_SCRATCH_COUNT 0x4 // single sectors handed out by "isacfs_pool_buf"
+#define POOL_BOUNCE_COUNT 0x2 // a writer and a reader task
+#ifndef ISACFS_BOUNCE_SECTORS
+#define ISACFS_BOUNCE_SECTORS 0x8 // a transfer from/to a caller buffer the driver can't DMA goes in multi-block chunks of that many sectors
+#endif
+#define POOL_SECTORS (SECTOR_BUFS_COUNT + POOL_SCRATCH_COUNT + POOL_BOUNCE_COUNT * ISACFS_BOUNCE_SECTORS)
+#define POOL_ALL_FREE ((0x1U << (POOL_SCRATCH_COUNT + POOL_BOUNCE_COUNT)) - 0x1U)
+
+/* group commit (staging arena mirroring an AU-aligned segment of the data region) */
 typedef struct {
-    u32 sector = 0x0;
-    u32 offset = 0x0;
-    u8 year_diff;
-    u8 month;
-    u8 day;
-    u8 hour;
-    u8 minute;
-    u8 second;
-    //u8 index;
+    isacfs_file_meta file_meta;
+    u64 data_head; // CURR_WRITE_DATA once the file is in the log
+} isacfs_staged_file_t;
 
-} isacfs_file_meta;
+/* fence cache (first timestamp of the probed metadata sectors, direct-mapped) */
+typedef struct {
+    u32 sector;
+    u64 first_ts;
+    bool valid;
+} isacfs_fence_t;
 
-static u32 SECTOR_COUNT;//= 0x1 << 23U;
-static u32 SECTOR_SIZE;//= 0x200;
-static u32 AVG_FILE_SIZE = 0x1 << 14U;
-static u8 SECTOR_ADDR_WIDTH;
-static u8 OFFSET_ADDR_WIDTH;
-static u8 YEAR_DIFF_WIDTH;
+/**
+ * @brief Filesystem state of a card
+ * @note The code below reaches the members of the instance bound to the calling task by their upper-case names
+*/
+struct isacfs {
+    const micro_sd_backend_t* card = NULL; // NULL - the one set with "micro_sd_set_backend"
+
+    u32 sector_count;
+#ifndef ISACFS_SECTOR_SIZE
+    u32 sector_size;
+    u8 offset_addr_width;
+#endif
+    u32 avg_file_size = DEFAULT_AVG_FILE_SIZE; // running estimate, stored in the superblock along with FUTURE_WRITE
+    u8 sector_addr_width;
+    u8 year_diff_width;
+    u8 desc_shift = ISACFS_DESC_8B_SHIFT; // descriptors of 1 << desc_shift bytes (format-time choice, stored in the superblock)
+
+    /* descriptor & address codec of the card geometry (see "isacfs_engine") */
+    const isacfs_engine_ops_t* engine = NULL;
+
+    u32 curr_write_meta_sector;
+    u32 curr_write_meta_offset;
+    u8 meta_lap; // how many times the descriptor ring wrapped (mod 256)
+    u32 next_sequence; // isacfs_desc_16B: sequence number of the next descriptor (its slot in the log since the format)
+
+    u32 curr_write_data_sector;
+    u32 curr_write_data_offset;
+
+    /* isacfs_layout_loop: oldest live descriptor - the frames from it up to CURR_WRITE_META are intact */
+    u32 tail_meta_sector;
+    u32 tail_meta_offset;
+    u8* tail_buf = NULL; // resident copy of the metadata sector TAIL_META points into
+    u32 tail_buf_sector;
+    bool tail_buf_valid = false;
+
+    /* format_critical (stored on the card)*/
+    u32 format_generation; // in the trailer of every metadata sector (the one of the sector 0 belongs to the superblock)
+    u32 data_start_sector;
+    u32 data_start_offset;
+    u32 future_write_meta_sector;
+    u32 future_write_meta_offset;
+    isacfs_layout_t data_layout = isacfs_layout_fixed;
+
+    /* streaming write state */
+    u8* data_tail_buf = NULL; // resident copy of the sector that CURR_WRITE_DATA points into
+    u32 data_tail_sector;
+    bool data_tail_valid = false;
+
+    /* scratch sector of the lookups (the write path takes "isacfs_pool_buf" ones - a reader task may run beside the writer task) */
+    u8* read_sector_buf = NULL;
+    u64* read_timestamps_buf = NULL; // packed timestamps of the descriptors in READ_SECTOR_BUF
+    isacfs_mutex_t* lookup_lock = NULL; // the two above, FENCE_CACHE and the journal as the lookups see it (see "isacfs_lookup_guard")
+
+    /* metadata journal (resident copy of the sector that CURR_WRITE_META points into) */
+    u8* meta_journal_buf = NULL;
+    u32 meta_journal_sector;
+    bool meta_journal_valid = false;
+    u32 meta_journal_pending = 0x0; // descriptors not yet on the card
+    unsigned long meta_journal_last_flush_ms = 0x0;
+    u32 journal_max_files = JOURNAL_MAX_PENDING_FILES;
+    u32 journal_max_ms = JOURNAL_MAX_PENDING_MS;
+
+    /* group commit */
+    u8* gc_arena = NULL; // NULL - every file goes to the card as it arrives
+    u32 gc_segment_sectors;
+    u32 gc_segment_sector; // first sector of the segment in the arena
+    bool gc_segment_valid = false;
+    u32 gc_dirty_first; // staged sectors not yet on the card [GC_DIRTY_FIRST, GC_DIRTY_END)
+    u32 gc_dirty_end;
+    u64 gc_data_head; // CURR_WRITE_DATA including the staged files
+    isacfs_staged_file_t* gc_files = NULL; // staged files, their descriptors go to the log once their data is on the card
+    u32 gc_files_count = 0x0;
+    u32 gc_files_cap;
+
+    /* pre-erase ahead of the write heads (see "isacfs_preerase_config") */
+    u32 preerase_distance = 0x0; // 0 - off
+    u32 preerase_chunk_sectors;
+    u32 preerase_data_sector; // first sector not erased ahead of the data head (isacfs_layout_converging: last erased one below it)
+    bool preerase_data_valid = false;
+    u32 preerase_meta_sector; // first metadata sector not erased ahead of CURR_WRITE_META
+    bool preerase_meta_valid = false;
+
+    isacfs_fence_t fence_cache[FENCE_CACHE_SIZE];
+
+    /* the sector buffers above and the ones of "isacfs_pool_buf", allocated once */
+    u8* pool = NULL;
+    std::atomic<u32> pool_free{POOL_ALL_FREE}; // bit i - scratch sector i (bounce buffer i - POOL_SCRATCH_COUNT) is free
+
+#ifdef ISACFS_SECTOR_SIZE
+    alignas(ISACFS_DMA_ALIGN) u8 static_pool[POOL_SECTORS * ISACFS_SECTOR_SIZE];
+    u64 static_timestamps_buf[(ISACFS_SECTOR_SIZE - META_TRAILER_SIZE) >> 0x3];
+#endif
+};
+
+/* the instance on the card set with "micro_sd_set_backend", every task starts bound to it */
+static isacfs_t DEFAULT_FS;
+static thread_local isacfs_t* FS = &DEFAULT_FS;
+
+#define CARD (FS->card)
+#define SECTOR_COUNT (FS->sector_count)
+#ifndef ISACFS_SECTOR_SIZE
+#define SECTOR_SIZE (FS->sector_size)
+#define OFFSET_ADDR_WIDTH (FS->offset_addr_width)
+#endif
+#define AVG_FILE_SIZE (FS->avg_file_size)
+#define SECTOR_ADDR_WIDTH (FS->sector_addr_width)
+#define YEAR_DIFF_WIDTH (FS->year_diff_width)
+#define DESC_SHIFT (FS->desc_shift)
+#define DESC_SIZE (0x1U << DESC_SHIFT)
+#define ENGINE (FS->engine)
+#define CURR_WRITE_META_SECTOR (FS->curr_write_meta_sector)
+#define CURR_WRITE_META_OFFSET (FS->curr_write_meta_offset)
+#define META_LAP (FS->meta_lap)
+#define NEXT_SEQUENCE (FS->next_sequence)
+#define CURR_WRITE_DATA_SECTOR (FS->curr_write_data_sector)
+#define CURR_WRITE_DATA_OFFSET (FS->curr_write_data_offset)
+#define TAIL_META_SECTOR (FS->tail_meta_sector)
+#define TAIL_META_OFFSET (FS->tail_meta_offset)
+#define TAIL_BUF (FS->tail_buf)
+#define TAIL_BUF_SECTOR (FS->tail_buf_sector)
+#define TAIL_BUF_VALID (FS->tail_buf_valid)
+#define FORMAT_GENERATION (FS->format_generation)
+#define DATA_START_SECTOR (FS->data_start_sector)
+#define DATA_START_OFFSET (FS->data_start_offset)
+#define FUTURE_WRITE_META_SECTOR (FS->future_write_meta_sector)
+#define FUTURE_WRITE_META_OFFSET (FS->future_write_meta_offset)
+#define DATA_LAYOUT (FS->data_layout)
+#define DATA_TAIL_BUF (FS->data_tail_buf)
+#define DATA_TAIL_SECTOR (FS->data_tail_sector)
+#define DATA_TAIL_VALID (FS->data_tail_valid)
+#define READ_SECTOR_BUF (FS->read_sector_buf)
+#define READ_TIMESTAMPS_BUF (FS->read_timestamps_buf)
+#define META_JOURNAL_BUF (FS->meta_journal_buf)
+#define META_JOURNAL_SECTOR (FS->meta_journal_sector)
+#define META_JOURNAL_VALID (FS->meta_journal_valid)
+#define META_JOURNAL_PENDING (FS->meta_journal_pending)
+#define META_JOURNAL_LAST_FLUSH_MS (FS->meta_journal_last_flush_ms)
+#define JOURNAL_MAX_FILES (FS->journal_max_files)
+#define JOURNAL_MAX_MS (FS->journal_max_ms)
+#define GC_ARENA (FS->gc_arena)
+#define GC_SEGMENT_SECTORS (FS->gc_segment_sectors)
+#define GC_SEGMENT_SECTOR (FS->gc_segment_sector)
+#define GC_SEGMENT_VALID (FS->gc_segment_valid)
+#define GC_DIRTY_FIRST (FS->gc_dirty_first)
+#define GC_DIRTY_END (FS->gc_dirty_end)
+#define GC_DATA_HEAD (FS->gc_data_head)
+#define GC_FILES (FS->gc_files)
+#define GC_FILES_COUNT (FS->gc_files_count)
+#define GC_FILES_CAP (FS->gc_files_cap)
+#define PREERASE_DISTANCE (FS->preerase_distance)
+#define PREERASE_CHUNK_SECTORS (FS->preerase_chunk_sectors)
+#define PREERASE_DATA_SECTOR (FS->preerase_data_sector)
+#define PREERASE_DATA_VALID (FS->preerase_data_valid)
+#define PREERASE_META_SECTOR (FS->preerase_meta_sector)
+#define PREERASE_META_VALID (FS->preerase_meta_valid)
+#define FENCE_CACHE (FS->fence_cache)
+#define LOOKUP_LOCK (FS->lookup_lock)
 
-static u32 CURR_WRITE_META_SECTOR;
-static u32 CURR_WRITE_META_OFFSET;
+/**
+ * @brief Bind an instance to the calling task for the current scope
+*/
+struct isacfs_scope {
+    isacfs_t* prev;
+    isacfs_scope(isacfs_t* fs) : prev(FS) { FS = fs; }
+    ~isacfs_scope(){ FS = prev; }
+};
 
-static u32 CURR_WRITE_DATA_SECTOR;
-static u32 CURR_WRITE_DATA_OFFSET;
+/**
+ * @brief A scratch sector or a bounce buffer (ISACFS_BOUNCE_SECTORS) of the pool of the bound instance for the current scope
+ * @note Claimed with a compare-and-swap, no lock; if all of them are taken (or there is no pool yet), the handle gets
+ *       a DMA-capable heap buffer of its own - "data()" is NULL only if that fails too
+*/
+struct isacfs_pool_buf {
+    isacfs_t* fs;
+    u32 bit; // the pool bit, POOL_SCRATCH_COUNT + POOL_BOUNCE_COUNT - a heap buffer
+    u32 sectors;
+    u8* buf;
+
+    isacfs_pool_buf(bool bounce) : fs(FS), bit(POOL_SCRATCH_COUNT + POOL_BOUNCE_COUNT), sectors(bounce ? ISACFS_BOUNCE_SECTORS : 0x1), buf(NULL) {
+        u32 mask = bounce ? POOL_ALL_FREE & ~((0x1U << POOL_SCRATCH_COUNT) - 0x1U) : (0x1U << POOL_SCRATCH_COUNT) - 0x1U;
+        u32 free_bits = fs->pool ? fs->pool_free.load() : 0x0;
+        while(free_bits & mask){
+            u32 i = __builtin_ctz(free_bits & mask);
+            if(fs->pool_free.compare_exchange_weak(free_bits, free_bits & ~(0x1U << i))){
+                bit = i;
+                u32 first = i < POOL_SCRATCH_COUNT ? SECTOR_BUFS_COUNT + i : SECTOR_BUFS_COUNT + POOL_SCRATCH_COUNT + (i - POOL_SCRATCH_COUNT) * ISACFS_BOUNCE_SECTORS;
+                buf = fs->pool + first * SECTOR_SIZE;
+                return;
+            }
+        }
+        ISACFS_STATS_ADD(pool_misses, 0x1);
+        buf = (u8*)isacfs_dma_alloc(sectors * SECTOR_SIZE);
+    }
+    ~isacfs_pool_buf(){
+        if(bit < POOL_SCRATCH_COUNT + POOL_BOUNCE_COUNT){
+            fs->pool_free.fetch_or(0x1U << bit);
+        }
+        else {
+            isacfs_dma_free(buf);
+        }
+    }
+    isacfs_pool_buf(const isacfs_pool_buf&) = delete;
+    isacfs_pool_buf& operator=(const isacfs_pool_buf&) = delete;
+    u8* data() const { return buf; }
+};
 
-/* format_critical (stored on the card)*/
-static u32 DATA_START_SECTOR;
-static u32 DATA_START_OFFSET;
-static u32 FUTURE_WRITE_META_SECTOR;
-static u32 FUTURE_WRITE_META_OFFSET;
+/**
+ * @brief Hold the lookup lock of the bound instance for the current scope
+ * @note The lookups of every task bound to the instance share its scratch sector and fence cache, and the writer
+ *       drops fences as it rewrites metadata sectors. The lock is recursive - a lookup may call another one.
+*/
+struct isacfs_lookup_guard {
+    isacfs_mutex_t* lock;
+    isacfs_lookup_guard() : lock(LOOKUP_LOCK) {
+        if(lock){
+            isacfs_mutex_lock(lock);
+        }
+    }
+    ~isacfs_lookup_guard(){
+        if(lock){
+            isacfs_mutex_unlock(lock);
+        }
+    }
+    isacfs_lookup_guard(const isacfs_lookup_guard&) = delete;
+    isacfs_lookup_guard& operator=(const isacfs_lookup_guard&) = delete;
+};
 
 /**
- * @brief Deduce using AVG_FILE_SIZE (in bytes)
- * @param[out] avg_file_sectors
- * @param[out] avg_file_offset
+ * @brief Write "count" sectors from a caller buffer - straight if the driver can DMA from it, in multi-block chunks
+ *        through a bounce buffer of the pool otherwise (instead of the driver's single-block writes)
 */
-void __isacfs_deduce_avg_file_storage(u32* avg_file_sectors, u32* avg_file_offset){
-    *avg_file_sectors = AVG_FILE_SIZE >> OFFSET_ADDR_WIDTH;
-    *avg_file_offset = AVG_FILE_SIZE - (*avg_file_sectors) << OFFSET_ADDR_WIDTH;
+esp_err_t __isacfs_card_write(const u8* src, u32 sector_no, u32 count){
+    if(isacfs_dma_capable(src)){
+        return micro_sd_write_sectors_on(CARD, src, sector_no, count);
+    }
+    isacfs_pool_buf bounce(true);
+    if(!bounce.data()){
+        return ESP_ERR_NO_MEM;
+    }
+    ISACFS_STATS_ADD(bounced_sectors, count);
+    esp_err_t res = ESP_OK;
+    while(count && res == ESP_OK){
+        u32 n = count < bounce.sectors ? count : bounce.sectors;
+        memcpy(bounce.data(), src, (size_t)n << OFFSET_ADDR_WIDTH);
+        res = micro_sd_write_sectors_on(CARD, bounce.data(), sector_no, n);
+        src += (size_t)n << OFFSET_ADDR_WIDTH;
+        sector_no += n;
+        count -= n;
+    }
+    return res;
 }
 
 /**
- * @brief Obtain CURR_WRITE_DATA using CURR_WRITE_META-8/CURR_WRITE_META
- * @param sector sector 0. Reused as a sector buffer if the prev_write_meta_sector is beyond the sector 0
+ * @brief Read "count" sectors into a caller buffer (see "__isacfs_card_write")
 */
-esp_err_t __isacfs_compute_curr_write_data_loc(const u8* sector){
+esp_err_t __isacfs_card_read(u8* dst, u32 sector_no, u32 count){
+    if(isacfs_dma_capable(dst)){
+        return micro_sd_read_sectors_on(CARD, dst, sector_no, count);
+    }
+    isacfs_pool_buf bounce(true);
+    if(!bounce.data()){
+        return ESP_ERR_NO_MEM;
+    }
+    ISACFS_STATS_ADD(bounced_sectors, count);
     esp_err_t res = ESP_OK;
+    while(count && res == ESP_OK){
+        u32 n = count < bounce.sectors ? count : bounce.sectors;
+        res = micro_sd_read_sectors_on(CARD, bounce.data(), sector_no, n);
+        memcpy(dst, bounce.data(), (size_t)n << OFFSET_ADDR_WIDTH);
+        dst += (size_t)n << OFFSET_ADDR_WIDTH;
+        sector_no += n;
+        count -= n;
+    }
+    return res;
+}
 
-    if(CURR_WRITE_META_OFFSET == 0xA && CURR_WRITE_META_SECTOR == 0x0){
-        CURR_WRITE_DATA_SECTOR = DATA_START_SECTOR;
-        CURR_WRITE_DATA_OFFSET = DATA_START_OFFSET;
+/**
+ * @brief Offset of the first descriptor slot in a metadata sector
+*/
+u32 __isacfs_meta_first_offset(u32 sector){
+    return sector ? 0x0 : META_START_OFFSET;
+}
+
+/**
+ * @brief Number of the descriptor slots in a metadata sector (the trailer follows them)
+*/
+u32 __isacfs_meta_slots_count(u32 sector){
+    return (SECTOR_SIZE - META_TRAILER_SIZE - __isacfs_meta_first_offset(sector)) >> DESC_SHIFT;
+}
+
+/**
+ * @brief Width of the slot index in a stored loop tail
+*/
+u32 __isacfs_loop_slot_bits(){
+    return 32U - __builtin_clz(__isacfs_meta_slots_count(0x1) - 0x1);
+}
+
+/**
+ * @brief Store the tail (TAIL_META) in the trailer of a metadata sector - isacfs_layout_loop only, the bytes stay 0 otherwise
+*/
+void __isacfs_meta_trailer_put_tail(u8* sector){
+    if(DATA_LAYOUT != isacfs_layout_loop){
+        return;
     }
-    else {
-        u32 prev_write_meta_sector = CURR_WRITE_META_SECTOR;
-        u32 prev_write_meta_offset = CURR_WRITE_META_OFFSET - 0x8;
-        if(prev_write_meta_offset >= CURR_WRITE_META_OFFSET){
-            prev_write_meta_sector--;
-            //prev_write_data_offset = SECTOR_SIZE - (0x8 - (prev_write_data_offset + 0x8));
-            //prev_write_meta_offset = SECTOR_SIZE + prev_write_meta_offset; // treat like `prev_write_data_offset` was negative (mod 2^32 arithmetic)
-            prev_write_meta_offset += SECTOR_SIZE; //simplify
-        }
+    u8* trailer = sector + SECTOR_SIZE - META_TRAILER_SIZE;
+    u32 slot = (TAIL_META_OFFSET - __isacfs_meta_first_offset(TAIL_META_SECTOR)) >> DESC_SHIFT;
+    u32 tail = (TAIL_META_SECTOR << __isacfs_loop_slot_bits()) | slot;
+    trailer[0xD] = tail >> 16U;
+    trailer[0xE] = (tail >> 8U) & 0xFF;
+    trailer[0xF] = tail & 0xFF;
+}
 
-        // prev_write_meta are ready 
+/**
+ * @brief Get the tail stored in the trailer of a metadata sector
+*/
+void __isacfs_meta_trailer_tail(const u8* sector, u32* tail_sector, u32* tail_offset){
+    const u8* trailer = sector + SECTOR_SIZE - META_TRAILER_SIZE;
+    u32 tail = ((u32)trailer[0xD] << 16U) | ((u32)trailer[0xE] << 8U) | trailer[0xF];
+    u32 slot_bits = __isacfs_loop_slot_bits();
+    *tail_sector = tail >> slot_bits;
+    *tail_offset = __isacfs_meta_first_offset(*tail_sector) + ((tail & ((0x1U << slot_bits) - 0x1)) << DESC_SHIFT);
+}
 
-        if(prev_write_meta_sector != 0x0){
-            res = micro_sd_read_sectors((u8*)sector, prev_write_meta_sector, 0x1);
-            if(res != ESP_OK){
-                return res;
-            }
-        }
+/**
+ * @brief Tag a metadata sector with the format generation, the number of the descriptors in it, META_LAP,
+ *        CURR_WRITE_DATA (the end of the data of its last descriptor) and the loop tail
+*/
+void __isacfs_meta_trailer_put(u8* sector, u32 slots_written){
+    u8* trailer = sector + SECTOR_SIZE - META_TRAILER_SIZE;
+    trailer[0x0] = META_MAGIC >> 0x8;
+    trailer[0x1] = META_MAGIC & 0xFF;
+    trailer[0x2] = FORMAT_GENERATION >> 24U;
+    trailer[0x3] = (FORMAT_GENERATION >> 16U) & 0xFF;
+    trailer[0x4] = (FORMAT_GENERATION >> 8U) & 0xFF;
+    trailer[0x5] = FORMAT_GENERATION & 0xFF;
+    trailer[0x6] = slots_written;
+    trailer[0x7] = META_LAP;
+    ENGINE->put_addr_5B(trailer + 0x8, CURR_WRITE_DATA_SECTOR, CURR_WRITE_DATA_OFFSET);
+    __isacfs_meta_trailer_put_tail(sector);
+}
 
-        u64 blk_5B_u64 = (((u64)(sector[prev_write_meta_offset])) << 56U) | (((u64)(sector[prev_write_meta_offset + 0x1])) << 48U);
-            blk_5B_u64 |= (((u64)(sector[prev_write_meta_offset+0x2])) << 40U) | (((u64)(sector[prev_write_meta_offset + 0x3])) << 32U);
-            blk_5B_u64 |= (((u64)(sector[prev_write_meta_offset + 0x4])) << 24U);
+/**
+ * @brief Get the META_LAP and the data head stored in the trailer of a metadata sector
+*/
+void __isacfs_meta_trailer_head(const u8* sector, u8* lap, u32* data_sector, u32* data_offset){
+    const u8* trailer = sector + SECTOR_SIZE - META_TRAILER_SIZE;
+    *lap = trailer[0x7];
+    ENGINE->get_addr_5B(trailer + 0x8, data_sector, data_offset);
+}
 
-        u32 prev_write_data_sector = blk_5B_u64 >> (64U - SECTOR_ADDR_WIDTH);
-        blk_5B_u64 <<= SECTOR_ADDR_WIDTH;
-        u32 prev_write_data_offset = blk_5B_u64 >> (64U - OFFSET_ADDR_WIDTH);
+/**
+ * @brief Get the format generation of a metadata sector
+ * @returns false if the sector doesn't carry a trailer
+*/
+bool __isacfs_meta_trailer_generation(const u8* sector, u32* generation){
+    const u8* trailer = sector + SECTOR_SIZE - META_TRAILER_SIZE;
+    if(((trailer[0x0] << 0x8) | trailer[0x1]) != META_MAGIC){
+        return false;
+    }
+    *generation = ((u32)trailer[0x2] << 24U) | ((u32)trailer[0x3] << 16U) | ((u32)trailer[0x4] << 8U) | trailer[0x5];
+    return true;
+}
 
-        // prev_write_data are ready
-        //add AVG_FILE_SIZE to the prev_write_data to obtain CURR_WRITE_DATA
+/**
+ * @brief Number of the descriptors in a metadata sector of the current format generation (0 for a stale sector)
+*/
+u32 __isacfs_meta_trailer_count(const u8* sector){
+    u32 generation;
+    if(!__isacfs_meta_trailer_generation(sector, &generation) || generation != FORMAT_GENERATION){
+        return 0x0;
+    }
+    return sector[SECTOR_SIZE - META_TRAILER_SIZE + 0x6];
+}
 
-        u32 avg_file_sectors;
-        u32 avg_file_offset;
-        __isacfs_deduce_avg_file_storage(&avg_file_sectors, &avg_file_offset);
+/**
+ * @brief Where the descriptor ring wraps - at DATA_START with isacfs_layout_loop, at the end of the card otherwise
+*/
+u32 __isacfs_meta_ring_end(){
+    return DATA_LAYOUT == isacfs_layout_loop ? DATA_START_SECTOR : SECTOR_COUNT;
+}
 
-        CURR_WRITE_DATA_SECTOR = prev_write_data_sector + avg_file_sectors;
-        CURR_WRITE_DATA_OFFSET = prev_write_data_offset + avg_file_offset;
-        
-        if(CURR_WRITE_DATA_SECTOR >= SECTOR_COUNT){ // WARNING - check for bugs in the future
-            CURR_WRITE_DATA_SECTOR = 0x0;
-            CURR_WRITE_DATA_OFFSET = 0xA;
-        }
-        else if(CURR_WRITE_DATA_OFFSET >= SECTOR_SIZE){
-            CURR_WRITE_DATA_OFFSET -= SECTOR_SIZE;
+/**
+ * @brief Move a meta location to the next descriptor slot
+ * @note Descriptors never straddle a sector boundary: sector 0 holds them from META_START_OFFSET on, the other sectors from 0,
+ *       the last META_TRAILER_SIZE bytes of every metadata sector are its trailer
+*/
+void __isacfs_advance_meta_loc(u32* sector, u32* offset){
+    *offset += DESC_SIZE;
+    if(*offset + DESC_SIZE > SECTOR_SIZE - META_TRAILER_SIZE){
+        (*sector)++;
+        *offset = 0x0;
+        if(*sector >= __isacfs_meta_ring_end()){
+            *sector = 0x0;
+            *offset = META_START_OFFSET;
         }
     }
-    return res;
 }
 
 /**
- * @note "init_sdcard" has to be called first
- * @note does not push forward te FUTURE_WRITE marker
+ * @brief Move a meta location to the previous descriptor slot (inverse of "__isacfs_advance_meta_loc")
 */
-isacfs_err_t isacfs_init()
-{
-    SECTOR_COUNT = micro_sd_get_sectors_count();
-    SECTOR_SIZE = micro_sd_get_sector_size();
+void __isacfs_retreat_meta_loc(u32* sector, u32* offset){
+    if(*sector == 0x0 && *offset == META_START_OFFSET){
+        *sector = __isacfs_meta_ring_end();
+        *offset = 0x0;
+    }
+    if(*offset == 0x0){
+        (*sector)--;
+        *offset = __isacfs_meta_first_offset(*sector) + ((__isacfs_meta_slots_count(*sector) - 0x1) << DESC_SHIFT);
+    }
+    else {
+        *offset -= DESC_SIZE;
+    }
+}
 
-    SECTOR_ADDR_WIDTH = micro_sd_get_sector_addr_width();
-    OFFSET_ADDR_WIDTH = micro_sd_get_offset_addr_width();
-    if(SECTOR_ADDR_WIDTH + OFFSET_ADDR_WIDTH > 38U){
-        return isacfs_256GiB_limit_exceeded;
+/**
+ * @brief Where the first frame goes - DATA_START, or the end of the card when the frames grow down towards the descriptors
+*/
+void __isacfs_data_origin(u32* sector, u32* offset){
+    if(DATA_LAYOUT == isacfs_layout_converging){
+        *sector = SECTOR_COUNT;
+        *offset = 0x0;
+        return;
     }
-    YEAR_DIFF_WIDTH = 38U - SECTOR_ADDR_WIDTH - OFFSET_ADDR_WIDTH;
+    *sector = DATA_START_SECTOR;
+    *offset = DATA_START_OFFSET;
+}
 
-    /* Load DATA_START and CURR_WRITE = FUTURE_WRITE */
-    u8 sector0[SECTOR_SIZE];
-    if(micro_sd_read_sectors(sector0, 0x0, 0x1) != ESP_OK){
-        Serial.println("ERROR WHILE READING SECTOR 0 [in isacfs_init()]");
-        return isacfs_fail;
+/**
+ * @brief Size of the data ring of isacfs_layout_loop in bytes ([DATA_START, end of the card))
+*/
+u64 __isacfs_loop_ring_bytes(){
+    return ((u64)(SECTOR_COUNT - DATA_START_SECTOR)) << OFFSET_ADDR_WIDTH;
+}
+
+/**
+ * @brief Map a data sector past the end of the card back into the data ring (isacfs_layout_loop, unchanged otherwise)
+*/
+u32 __isacfs_wrap_data_sector(u32 sector_no){
+    if(DATA_LAYOUT == isacfs_layout_loop && sector_no >= SECTOR_COUNT){
+        sector_no -= SECTOR_COUNT - DATA_START_SECTOR;
     }
+    return sector_no;
+}
 
-    u64 blk_5B_u64 = (((u64)sector0[0x0]) << 56U) | (((u64)sector0[0x1]) << 48U) | (((u64)sector0[0x2]) << 40U) | (((u64)sector0[0x3]) << 32U);
-    blk_5B_u64 |= (((u64)sector0[0x4]) << 24U);
+/**
+ * @brief Number of the bytes from the byte address "start" up to "end" (isacfs_layout_loop: around the end of the card)
+*/
+u64 __isacfs_data_span(u64 start, u64 end){
+    if(DATA_LAYOUT == isacfs_layout_loop && end < start){
+        end += __isacfs_loop_ring_bytes();
+    }
+    return end - start;
+}
 
-    DATA_START_SECTOR = blk_5B_u64 >> (64U - SECTOR_ADDR_WIDTH);
-    blk_5B_u64 <<= SECTOR_ADDR_WIDTH;
-    DATA_START_OFFSET = blk_5B_u64 >> (64U - OFFSET_ADDR_WIDTH);
+/**
+ * @brief Store the running average frame size in the superblock (sector 0 buffer)
+*/
+void __isacfs_put_avg_file_size(u8* sector0){
+    sector0[0xA] = AVG_FILE_SIZE >> 24U;
+    sector0[0xB] = (AVG_FILE_SIZE >> 16U) & 0xFF;
+    sector0[0xC] = (AVG_FILE_SIZE >> 8U) & 0xFF;
+    sector0[0xD] = AVG_FILE_SIZE & 0xFF;
+}
 
-    blk_5B_u64 = (((u64)sector0[0x5]) << 56U) | (((u64)sector0[0x6]) << 48U) | (((u64)sector0[0x7]) << 40U) | (((u64)sector0[0x8]) << 32U);
-    blk_5B_u64 |= (((u64)sector0[0x9]) << 24U);
+/**
+ * @brief Check if a metadata sector was written in this format generation during the given lap and holds descriptors
+*/
+bool __isacfs_meta_sector_of_lap(const u8* sector, u8 lap){
+    u8 sector_lap;
+    u32 data_sector;
+    u32 data_offset;
+    __isacfs_meta_trailer_head(sector, &sector_lap, &data_sector, &data_offset);
+    return __isacfs_meta_trailer_count(sector) && sector_lap == lap;
+}
 
-    FUTURE_WRITE_META_SECTOR = blk_5B_u64 >> (64U - SECTOR_ADDR_WIDTH);
-    blk_5B_u64 <<= SECTOR_ADDR_WIDTH;
-    FUTURE_WRITE_META_OFFSET = blk_5B_u64 >> (64U - OFFSET_ADDR_WIDTH);
+/**
+ * @brief Find the real write head (CURR_WRITE_META, CURR_WRITE_DATA, META_LAP) and the loop tail after a reboot
+ * @note Everything before the last checkpoint (FUTURE_WRITE - FILE_LEAP descriptors) is durable, because the journal
+ *       is flushed before the write head passes the marker. The metadata sectors between the checkpoint and the marker
+ *       hold descriptors of this lap up to the real head, so the last of them is bisected in O(log FILE_LEAP) sector reads.
+ *       Its trailer tells how many descriptors it holds and where their data ends.
+ * @param sector sector buffer
+*/
+esp_err_t __isacfs_recover_tail(u8* sector){
+    esp_err_t res = ESP_OK;
+    if(FUTURE_WRITE_META_SECTOR == 0x0 && FUTURE_WRITE_META_OFFSET == META_START_OFFSET){ // nothing written since the format
+        CURR_WRITE_META_SECTOR = 0x0;
+        CURR_WRITE_META_OFFSET = META_START_OFFSET;
+        __isacfs_data_origin(&CURR_WRITE_DATA_SECTOR, &CURR_WRITE_DATA_OFFSET);
+        META_LAP = 0x0;
+        TAIL_META_SECTOR = 0x0;
+        TAIL_META_OFFSET = META_START_OFFSET;
+        return res;
+    }
 
-    CURR_WRITE_META_SECTOR = FUTURE_WRITE_META_SECTOR;
-    CURR_WRITE_META_OFFSET = FUTURE_WRITE_META_OFFSET;
+    u32 cp_sector = FUTURE_WRITE_META_SECTOR;
+    u32 cp_offset = FUTURE_WRITE_META_OFFSET;
+    for(u32 i = 0x0; i < FILE_LEAP; i++){
+        __isacfs_retreat_meta_loc(&cp_sector, &cp_offset);
+    }
 
-    /* Calculate CURR_WRITE_DATA */
-    if(__isacfs_compute_curr_write_data_loc(sector0) != ESP_OK){
-        Serial.println("ERROR WHILE READING A SECTOR [in isacfs_init()]");
-        return isacfs_fail;
+    /* the head is at least at the checkpoint - the sector before it tells the lap and the data head there */
+    u32 anchor_sector = cp_sector;
+    u32 anchor_offset = cp_offset;
+    __isacfs_retreat_meta_loc(&anchor_sector, &anchor_offset);
+    res = micro_sd_read_sectors_on(CARD, sector, anchor_sector, 0x1);
+    if(res != ESP_OK){
+        return res;
+    }
+    u8 anchor_lap = 0x0;
+    CURR_WRITE_META_SECTOR = cp_sector;
+    CURR_WRITE_META_OFFSET = cp_offset;
+    __isacfs_data_origin(&CURR_WRITE_DATA_SECTOR, &CURR_WRITE_DATA_OFFSET);
+    TAIL_META_SECTOR = 0x0;
+    TAIL_META_OFFSET = META_START_OFFSET;
+    if(__isacfs_meta_trailer_count(sector)){
+        __isacfs_meta_trailer_head(sector, &anchor_lap, &CURR_WRITE_DATA_SECTOR, &CURR_WRITE_DATA_OFFSET);
+        __isacfs_meta_trailer_tail(sector, &TAIL_META_SECTOR, &TAIL_META_OFFSET);
+    }
+    else {
+        anchor_sector = 0x0; // the checkpoint is the start of the first lap
+    }
+    META_LAP = anchor_lap + (cp_sector < anchor_sector ? 0x1 : 0x0);
+
+    /* bisect the last sector of this lap in [cp_sector, FUTURE_WRITE_META_SECTOR] */
+    u32 window = FUTURE_WRITE_META_SECTOR >= cp_sector ? FUTURE_WRITE_META_SECTOR - cp_sector + 0x1
+                                                       : __isacfs_meta_ring_end() - cp_sector + FUTURE_WRITE_META_SECTOR + 0x1;
+    int lo = -1; // last known sector of this lap
+    int hi = window; // first known sector beyond the head
+    while(hi - lo > 0x1){
+        int mid = lo + ((hi - lo) >> 0x1);
+        u32 sector_no = cp_sector + mid;
+        if(sector_no >= __isacfs_meta_ring_end()){
+            sector_no -= __isacfs_meta_ring_end();
+        }
+        res = micro_sd_read_sectors_on(CARD, sector, sector_no, 0x1);
+        if(res != ESP_OK){
+            return res;
+        }
+        if(__isacfs_meta_sector_of_lap(sector, anchor_lap + (sector_no < anchor_sector ? 0x1 : 0x0))){
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if(lo < 0x0){
+        return res; // nothing written after the checkpoint
     }
 
-    return isacfs_ok;
+    u32 last_sector = cp_sector + lo;
+    if(last_sector >= __isacfs_meta_ring_end()){
+        last_sector -= __isacfs_meta_ring_end();
+    }
+    res = micro_sd_read_sectors_on(CARD, sector, last_sector, 0x1);
+    if(res != ESP_OK){
+        return res;
+    }
+    __isacfs_meta_trailer_head(sector, &META_LAP, &CURR_WRITE_DATA_SECTOR, &CURR_WRITE_DATA_OFFSET);
+    __isacfs_meta_trailer_tail(sector, &TAIL_META_SECTOR, &TAIL_META_OFFSET);
+    CURR_WRITE_META_SECTOR = last_sector;
+    CURR_WRITE_META_OFFSET = __isacfs_meta_first_offset(last_sector) + ((__isacfs_meta_trailer_count(sector) - 0x1) << DESC_SHIFT);
+    __isacfs_advance_meta_loc(&CURR_WRITE_META_SECTOR, &CURR_WRITE_META_OFFSET);
+    if(CURR_WRITE_META_SECTOR < last_sector){
+        META_LAP++;
+    }
+    return res;
 }
 
 /**
@@ -169,10 +629,9 @@ isacfs_err_t isacfs_init()
  * @param[in] file_meta_p in
  * @param[out] desc_8B_blk out
 */
-void /*const u8**/ __isacfs_file_meta__to__desc_8B_blk(isacfs_file_meta* file_meta_p, u8* desc_8B_blk){
+void /*const u8**/ __isacfs_file_meta__to__desc_8B_blk(const isacfs_file_meta* file_meta_p, u8* desc_8B_blk){
     //static u8 desc_8B_blk[0x8];
-    static u64 desc_u64;
-    desc_u64 = (u64)(file_meta_p->sector) << (64U - SECTOR_ADDR_WIDTH);
+    u64 desc_u64 = (u64)(file_meta_p->sector) << (64U - SECTOR_ADDR_WIDTH);
     desc_u64 |= (u64)(file_meta_p->offset) << (64U - SECTOR_ADDR_WIDTH - OFFSET_ADDR_WIDTH);
     /*
         desc_u64 |= (u64)(file_meta_p->year_diff) << (64U - SECTOR_ADDR_WIDTH - OFFSET_ADDR_WIDTH - YEAR_DIFF_WIDTH);
@@ -185,14 +644,7 @@ void /*const u8**/ __isacfs_file_meta__to__desc_8B_blk(isacfs_file_meta* file_me
     desc_u64 |= (u64)(file_meta_p->minute) << 6U; //drop 6
     desc_u64 |= (u64)(file_meta_p->second); //drop 6
 
-    desc_8B_blk[0x0] = desc_u64 >> 56U;
-    desc_8B_blk[0x1] = (desc_u64 >> 48U) & 0xFF;
-    desc_8B_blk[0x2] = (desc_u64 >> 40U) & 0xFF;
-    desc_8B_blk[0x3] = (desc_u64 >> 32U) & 0xFF;
-    desc_8B_blk[0x4] = (desc_u64 >> 24U) & 0xFF;
-    desc_8B_blk[0x5] = (desc_u64 >> 16U) & 0xFF;
-    desc_8B_blk[0x6] = (desc_u64 >> 8U) & 0xFF;
-    desc_8B_blk[0x7] = desc_u64 & 0xFF;
+    isacfs_store_be64(desc_8B_blk, desc_u64);
 
     //return desc_8B_blk;
 }
@@ -202,16 +654,13 @@ void /*const u8**/ __isacfs_file_meta__to__desc_8B_blk(isacfs_file_meta* file_me
 */
 void /*const isacfs_file_meta**/ __desc_8B_blk__to__isacfs_file_meta(const u8* desc_8B_blk, isacfs_file_meta* file_meta){
     //static isacfs_file_meta *file_meta; //it was uninitialized!
-    static u64 desc_u64;
-
-    desc_u64 = (((u64)(desc_8B_blk[0])) << 56U) | (((u64)(desc_8B_blk[1])) << 48U) | (((u64)(desc_8B_blk[2])) << 40U) | (((u64)(desc_8B_blk[3])) << 32U);
-    desc_u64 |= (((u64)(desc_8B_blk[4])) << 24U) | (((u64)(desc_8B_blk[5])) << 16U) | (((u64)(desc_8B_blk[6])) << 8U) | (u64)(desc_8B_blk[7]);
+    u64 desc_u64 = isacfs_load_be64(desc_8B_blk); // local - the codec is reentrant
 
     file_meta->sector = desc_u64 >> (64U - SECTOR_ADDR_WIDTH);
     desc_u64 <<= SECTOR_ADDR_WIDTH;
     file_meta->offset = desc_u64 >> (64U - OFFSET_ADDR_WIDTH);
     desc_u64 <<= OFFSET_ADDR_WIDTH;
-    file_meta->year_diff = desc_u64 >> (64U - YEAR_DIFF_WIDTH);
+    file_meta->year_diff = YEAR_DIFF_WIDTH ? desc_u64 >> (64U - YEAR_DIFF_WIDTH) : 0x0; // no year bits on the 256GiB cards
     desc_u64 <<= YEAR_DIFF_WIDTH;
 
     file_meta->month = desc_u64 >> 60U;
@@ -228,272 +677,2582 @@ void /*const isacfs_file_meta**/ __desc_8B_blk__to__isacfs_file_meta(const u8* d
 }
 
 /**
- * @brief Fills all the sectors with zeroes
+ * @brief Decode "count" consecutive descriptors into a struct of arrays (runtime-detected geometry)
 */
-esp_err_t __isacfs_clear_all_sectors(){
-    u8 zero[SECTOR_SIZE];
-    memset(zero, 0x0, SECTOR_SIZE); //neccessary?
-    esp_err_t res = isacfs_ok;
-    for (u32 i = 0x0; i < SECTOR_COUNT; i++){
-        res = micro_sd_write_sectors(zero, i, 0x1);
-        if(res != ESP_OK){
-            return res;
+void __isacfs_decode_descs(const u8* __restrict descs, u32 count, u32 desc_shift, u32* __restrict sector, u32* __restrict offset, u64* __restrict timestamp){
+    u32 sector_shift = 64U - SECTOR_ADDR_WIDTH;
+    u32 offset_shift = sector_shift - OFFSET_ADDR_WIDTH;
+    u64 offset_mask = SECTOR_SIZE - 0x1;
+    u64 timestamp_mask = (0x1ULL << offset_shift) - 0x1;
+    bool ms = desc_shift == ISACFS_DESC_16B_SHIFT;
+    for(u32 i = 0x0; i < count; i++){
+        const u8* desc = descs + (i << desc_shift);
+        u64 desc_u64 = isacfs_load_be64(desc);
+        if(sector && offset){
+            sector[i] = desc_u64 >> sector_shift;
+            offset[i] = (desc_u64 >> offset_shift) & offset_mask;
         }
+        timestamp[i] = ((desc_u64 & timestamp_mask) << ISACFS_MS_BITS) | (ms ? __isacfs_desc_ms(desc) : 0x0);
     }
-    return ESP_OK;
 }
 
-float __isacfs_get_deflate_coefficient(){
-    return 8.0f / (8.0f + AVG_FILE_SIZE);
+/**
+ * @brief Encode "count" descriptors from a struct of arrays (runtime-detected geometry)
+*/
+void __isacfs_encode_descs(u8* __restrict descs, u32 count, u32 desc_shift, const u32* __restrict sector, const u32* __restrict offset, const u64* __restrict timestamp){
+    u32 sector_shift = 64U - SECTOR_ADDR_WIDTH;
+    u32 offset_shift = sector_shift - OFFSET_ADDR_WIDTH;
+    u64 timestamp_mask = (0x1ULL << offset_shift) - 0x1;
+    for(u32 i = 0x0; i < count; i++){
+        u8* desc = descs + (i << desc_shift);
+        isacfs_store_be64(desc, ((u64)sector[i] << sector_shift) | ((u64)offset[i] << offset_shift) | ((timestamp[i] >> ISACFS_MS_BITS) & timestamp_mask));
+        if(desc_shift == ISACFS_DESC_16B_SHIFT){
+            __isacfs_desc_put_ms(desc, timestamp[i] & ((0x1U << ISACFS_MS_BITS) - 0x1));
+        }
+    }
 }
 
 /**
- * @brief DATA_START_SECTOR = ?, DATA_START_OFFSET = ?
+ * @brief Pack a sector&offset address into 5 bytes (runtime-detected geometry)
 */
-void __isacfs_compute_data_start(){
-    //DATA_START_SECTOR = ?
-    //DATA_START_OFFSET = ?
-
-    float deflate_coef = __isacfs_get_deflate_coefficient();
-    float psaddr = deflate_coef;
-    psaddr *= SECTOR_COUNT;
-    psaddr *= SECTOR_SIZE;
-    psaddr -= deflate_coef * 16U;
-
-    u32 addr = psaddr;
-    addr += 8U - (addr % 8U);
-
-    addr += 10U;
-
-    //DATA_START_SECTOR = addr / SECTOR_SIZE;
-    //DATA_START_OFFSET = addr - DATA_START_SECTOR * SECTOR_SIZE;
-    DATA_START_SECTOR = addr >> OFFSET_ADDR_WIDTH;
-    DATA_START_OFFSET = addr - (DATA_START_OFFSET << OFFSET_ADDR_WIDTH);
+void __isacfs_put_addr_5B(u8* blk_5B, u32 sector, u32 offset){
+    u64 blk_5B_u64 = ((u64)sector) << (64U - SECTOR_ADDR_WIDTH);
+    blk_5B_u64 |= ((u64)offset) << (64U - SECTOR_ADDR_WIDTH - OFFSET_ADDR_WIDTH);
+    blk_5B[0x0] = blk_5B_u64 >> 56U;
+    blk_5B[0x1] = (blk_5B_u64 >> 48U) & 0xFF;
+    blk_5B[0x2] = (blk_5B_u64 >> 40U) & 0xFF;
+    blk_5B[0x3] = (blk_5B_u64 >> 32U) & 0xFF;
+    blk_5B[0x4] = (blk_5B_u64 >> 24U) & 0xFF;
 }
 
 /**
- * @brief Format the card using the predefined average file size "AVG_FILE_SIZE" (in bytes)
- * @note Sector size can't be smaller than 11B
+ * @brief Unpack a 5-byte sector&offset address (runtime-detected geometry)
 */
-esp_err_t isacfs_format(){
-    esp_err_t res = ESP_OK;
-    res = __isacfs_clear_all_sectors();
-    if(res != ESP_OK){
-        return res;
-    }
-
-    __isacfs_compute_data_start();
-    FUTURE_WRITE_META_SECTOR = 0U;   /////////////////////////////////////////////
-    FUTURE_WRITE_META_OFFSET = 10U; // UPDATE them for example every 1h        //
-                                   /////////////////////////////////////////////
-    CURR_WRITE_META_SECTOR = 0U;
-    CURR_WRITE_META_OFFSET = 10U;
-
-    CURR_WRITE_DATA_SECTOR = DATA_START_SECTOR;
-    CURR_WRITE_DATA_OFFSET = DATA_START_OFFSET;
-
-    u8 sector0[SECTOR_SIZE];
-    memset(sector0, 0x0, SECTOR_SIZE); //neccessary?
-    // Write data_start and future_write into the first 5B+5B of the Sector 0x0
-    //38, 40/8=5
-    u64 blk_5B_u64 = ((u64)DATA_START_SECTOR) << (64U - SECTOR_ADDR_WIDTH);
-    blk_5B_u64 |= ((u64)DATA_START_OFFSET) << (64U - SECTOR_ADDR_WIDTH - OFFSET_ADDR_WIDTH);
-
-    sector0[0x0] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x1] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x2] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x3] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x4] = blk_5B_u64 >> 56U;
-
-    blk_5B_u64 = ((u64)FUTURE_WRITE_META_SECTOR) << (64U - SECTOR_ADDR_WIDTH);
-    blk_5B_u64 |= ((u64)FUTURE_WRITE_META_OFFSET) << (64U - SECTOR_ADDR_WIDTH - OFFSET_ADDR_WIDTH);
-
-    sector0[0x5] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x6] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x7] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x8] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x9] = blk_5B_u64 >> 56U;
-
-    return micro_sd_write_sectors(sector0, 0x0, 0x1);
+void __isacfs_get_addr_5B(const u8* blk_5B, u32* sector, u32* offset){
+    u64 blk_5B_u64 = (((u64)blk_5B[0x0]) << 56U) | (((u64)blk_5B[0x1]) << 48U) | (((u64)blk_5B[0x2]) << 40U) | (((u64)blk_5B[0x3]) << 32U);
+    blk_5B_u64 |= (((u64)blk_5B[0x4]) << 24U);
+    *sector = blk_5B_u64 >> (64U - SECTOR_ADDR_WIDTH);
+    blk_5B_u64 <<= SECTOR_ADDR_WIDTH;
+    *offset = blk_5B_u64 >> (64U - OFFSET_ADDR_WIDTH);
 }
 
-esp_err_t __isacfs_shift_future_marker(){
-    esp_err_t res = ESP_OK;
-    u32 sector_leap = (FILE_LEAP << 0x3) >> OFFSET_ADDR_WIDTH;
-    FUTURE_WRITE_META_SECTOR += sector_leap;
-    FUTURE_WRITE_META_OFFSET = (FILE_LEAP - (sector_leap << OFFSET_ADDR_WIDTH));
-
-    if(FUTURE_WRITE_META_OFFSET >> OFFSET_ADDR_WIDTH){
-        FUTURE_WRITE_META_OFFSET -= (FUTURE_WRITE_META_OFFSET >> OFFSET_ADDR_WIDTH) << OFFSET_ADDR_WIDTH;
-    }
-
-    // - and UPDATE MEMORY
+static const isacfs_engine_ops_t RUNTIME_ENGINE = {
+    __isacfs_file_meta__to__desc_8B_blk,
+    __desc_8B_blk__to__isacfs_file_meta,
+    __isacfs_put_addr_5B,
+    __isacfs_get_addr_5B,
+    __isacfs_decode_descs,
+    __isacfs_encode_descs
+};
 
-    u8 sector0[SECTOR_SIZE];
-    res = micro_sd_read_sectors(sector0, 0x0, 0x1);
-    if(res != ESP_OK){
-        return res;
+/**
+ * @brief Encode the descriptor of "file_meta" (with the millisecond and the sequence number of a 16B descriptor)
+*/
+void __isacfs_encode_desc(const isacfs_file_meta* file_meta, u8* desc){
+    ENGINE->encode_desc(file_meta, desc);
+    if(DESC_SHIFT == ISACFS_DESC_16B_SHIFT){
+        __isacfs_desc_put_ms(desc, file_meta->millisecond);
+        desc[0xA] = 0x0;
+        desc[0xB] = 0x0;
+        __isacfs_desc_put_sequence(desc, file_meta->sequence);
     }
-
-    u64 blk_5B_u64 = ((u64)FUTURE_WRITE_META_SECTOR) << (64U - SECTOR_ADDR_WIDTH);
-    blk_5B_u64 |= ((u64)FUTURE_WRITE_META_OFFSET) << (64U - SECTOR_ADDR_WIDTH - OFFSET_ADDR_WIDTH);
-
-    sector0[0x5] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x6] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x7] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x8] = blk_5B_u64 >> 56U;
-    blk_5B_u64 <<= 0x8;
-    sector0[0x9] = blk_5B_u64 >> 56U;
-
-    return micro_sd_write_sectors(sector0, 0x0, 0x1);
 }
 
+/**
+ * @brief Decode a descriptor (the millisecond and the sequence number are 0 for an 8B one)
+*/
+void __isacfs_decode_desc(const u8* desc, isacfs_file_meta* file_meta){
+    ENGINE->decode_desc(desc, file_meta);
+    bool ext = DESC_SHIFT == ISACFS_DESC_16B_SHIFT;
+    file_meta->millisecond = ext ? __isacfs_desc_ms(desc) : 0x0;
+    file_meta->sequence = ext ? __isacfs_desc_sequence(desc) : 0x0;
+}
 
 /**
- * @note "file_meta" is supposed to have sector=UNKNOWN_SECTOR, offset=UNKNOWN_OFFSET
+ * @brief NEXT_SEQUENCE from the last descriptor of the log (isacfs_desc_16B)
+ * @param sector sector buffer
 */
-esp_err_t isacfs_write_file(isacfs_file_meta* file_meta, u8* buffer, u32 buf_sz){
-    esp_err_t res = ESP_OK;
-    if(CURR_WRITE_META_SECTOR == FUTURE_WRITE_META_SECTOR && CURR_WRITE_META_OFFSET == FUTURE_WRITE_META_OFFSET){
-        //shift the FUTURE_WRITE marker
-        res = __isacfs_shift_future_marker();
-        if(res != ESP_OK){
-            return res;
-        }
+esp_err_t __isacfs_recover_sequence(u8* sector){
+    NEXT_SEQUENCE = 0x0;
+    if(DESC_SHIFT != ISACFS_DESC_16B_SHIFT || (CURR_WRITE_META_SECTOR == 0x0 && CURR_WRITE_META_OFFSET == META_START_OFFSET && !META_LAP)){
+        return ESP_OK;
     }
-
-    //obtain the sectors for the file
-    file_meta->sector = CURR_WRITE_DATA_SECTOR;
-    file_meta->offset = CURR_WRITE_DATA_OFFSET;
-
-    /* write the file into the sectors */
-    u8 sector[SECTOR_SIZE]; // I can't make it static :((
-                                 // unless I sacrificed the auto sector size detection
-                                 // and made SECTOR_SIZE predefined
-    res = micro_sd_read_sectors(sector, CURR_WRITE_META_SECTOR, 0x1);
-    if(res != ESP_OK){
-        return res;
+    u32 last_sector = CURR_WRITE_META_SECTOR;
+    u32 last_offset = CURR_WRITE_META_OFFSET;
+    __isacfs_retreat_meta_loc(&last_sector, &last_offset);
+    esp_err_t res = micro_sd_read_sectors_on(CARD, sector, last_sector, 0x1);
+    if(res == ESP_OK){
+        NEXT_SEQUENCE = __isacfs_desc_sequence(sector + last_offset) + 0x1;
     }
+    return res;
+}
 
-    //    write file meta into the sectors
-    __isacfs_file_meta__to__desc_8B_blk(file_meta, sector + CURR_WRITE_META_OFFSET);
-    res = micro_sd_write_sectors(sector, CURR_WRITE_META_SECTOR, 0x1);
-    if(res != ESP_OK){
-        return res;
+/**
+ * @brief Take the geometry of the card && set up the sector buffers and the lookup lock of the instance (once)
+ * @note Nothing is read from the card - "isacfs_format" runs it on a blank card, "isacfs_init" before the mount
+*/
+isacfs_err_t __isacfs_geometry(){
+    SECTOR_COUNT = micro_sd_get_sectors_count_on(CARD);
+#ifdef ISACFS_SECTOR_SIZE
+    if((u32)micro_sd_get_sector_size_on(CARD) != SECTOR_SIZE){
+        Serial.println("UNSUPPORTED SECTOR SIZE [in __isacfs_geometry()]");
+        return isacfs_fail;
     }
+#else
+    SECTOR_SIZE = micro_sd_get_sector_size_on(CARD);
+    OFFSET_ADDR_WIDTH = micro_sd_get_offset_addr_width_on(CARD);
+#endif
 
-    //    write file data into the sectors && update CURR_WRITE_DATA
-    res = micro_sd_read_sectors(sector, CURR_WRITE_DATA_SECTOR, 0x1);
-    if(res != ESP_OK){
-        return res;
+    SECTOR_ADDR_WIDTH = micro_sd_get_sector_addr_width_on(CARD);
+    if((u32)SECTOR_ADDR_WIDTH + OFFSET_ADDR_WIDTH > 38U){
+        return isacfs_256GiB_limit_exceeded;
     }
-    memcpy(sector + CURR_WRITE_DATA_OFFSET, 
-           buffer, 
-           SECTOR_SIZE-CURR_WRITE_DATA_OFFSET < buf_sz ? SECTOR_SIZE - CURR_WRITE_DATA_OFFSET : buf_sz);
-    res = micro_sd_write_sectors(sector, CURR_WRITE_DATA_SECTOR, 0x1);
-    if(res != ESP_OK){
-        return res;
+    YEAR_DIFF_WIDTH = 38U - SECTOR_ADDR_WIDTH - OFFSET_ADDR_WIDTH;
+    ENGINE = isacfs_engine_select(SECTOR_SIZE, SECTOR_ADDR_WIDTH, OFFSET_ADDR_WIDTH);
+    if(!ENGINE){
+        ENGINE = &RUNTIME_ENGINE;
     }
-    
-
-    if(SECTOR_SIZE-CURR_WRITE_DATA_OFFSET < buf_sz){
-        buf_sz -= SECTOR_SIZE - CURR_WRITE_DATA_OFFSET;
-        buffer += SECTOR_SIZE - CURR_WRITE_DATA_OFFSET;
-
-        u32 num_full_sectors = buf_sz >> OFFSET_ADDR_WIDTH;
-        CURR_WRITE_DATA_SECTOR++;
-        
-        res = micro_sd_write_sectors(buffer, CURR_WRITE_DATA_SECTOR, 0x1);
-        if(res != ESP_OK){
-            return res;
-        }
-
-        buf_sz -= num_full_sectors << OFFSET_ADDR_WIDTH;
-        buffer += num_full_sectors << OFFSET_ADDR_WIDTH;
-        CURR_WRITE_DATA_SECTOR += num_full_sectors;
 
-        //write last sector if anything remains in the buffer
-        if(buf_sz > 0){
-            res = micro_sd_read_sectors(sector, CURR_WRITE_DATA_SECTOR, 0x1);
-            if(res != ESP_OK){
-                return res;
-            }
-            memcpy(sector, buffer, buf_sz);
-            res = micro_sd_write_sectors(sector, CURR_WRITE_DATA_SECTOR, 0x1);
-            if(res != ESP_OK){
-                return res;
-            }
+    /* sector buffer pool - in the instance if the sector size is known at compile time (static for the default one), DMA-capable heap otherwise */
+    u8** sector_bufs[] = { &DATA_TAIL_BUF, &META_JOURNAL_BUF, &READ_SECTOR_BUF, &TAIL_BUF };
+    static_assert(sizeof(sector_bufs) / sizeof(sector_bufs[0]) == SECTOR_BUFS_COUNT, "SECTOR_BUFS_COUNT");
+#ifdef ISACFS_SECTOR_SIZE
+    FS->pool = FS->static_pool;
+    READ_TIMESTAMPS_BUF = FS->static_timestamps_buf;
+#else
+    if(!FS->pool){
+        FS->pool = (u8*)isacfs_dma_alloc(POOL_SECTORS * SECTOR_SIZE);
+        READ_TIMESTAMPS_BUF = (u64*)malloc(((SECTOR_SIZE - META_TRAILER_SIZE) >> 0x3) * sizeof(u64));
+        if(!FS->pool || !READ_TIMESTAMPS_BUF){
+            isacfs_dma_free(FS->pool);
+            free(READ_TIMESTAMPS_BUF);
+            FS->pool = NULL;
+            READ_TIMESTAMPS_BUF = NULL;
+            Serial.println("ERROR WHILE ALLOCATING THE SECTOR BUFFERS [in __isacfs_geometry()]");
+            return isacfs_fail;
         }
-        CURR_WRITE_DATA_OFFSET = buf_sz;
     }
-    else {
-        CURR_WRITE_DATA_OFFSET += buf_sz;
+#endif
+    for(u32 i = 0x0; i < SECTOR_BUFS_COUNT; i++){
+        *sector_bufs[i] = FS->pool + i * SECTOR_SIZE;
     }
-
-    // UPDATE CURR_WRITE_META  // {{{BUG!}}}
-    CURR_WRITE_META_OFFSET += 0x8;
-    if(CURR_WRITE_META_OFFSET >= SECTOR_SIZE){
-        CURR_WRITE_META_SECTOR++;
-        if(CURR_WRITE_META_SECTOR >= SECTOR_COUNT){
-            CURR_WRITE_META_SECTOR = 0x0;
-            CURR_WRITE_META_OFFSET = 0xA;
-        }
-        else {
-            CURR_WRITE_META_OFFSET -= SECTOR_SIZE;
+    if(!LOOKUP_LOCK){
+        LOOKUP_LOCK = isacfs_mutex_create();
+        if(!LOOKUP_LOCK){
+            Serial.println("ERROR WHILE CREATING THE LOOKUP LOCK [in __isacfs_geometry()]");
+            return isacfs_fail;
         }
     }
-
-    return res;
+    return isacfs_ok;
 }
 
 /**
- * @brief Fills "file_meta" with the sector & offset info - {{{IMPLEMENT}}} using quick search on dates
- * @note obtains sector, offset, size in the isacfs_file_meta structure
- * @param[in] file_meta known file info
- * @param[out] discovered_size discovered file content size
- * @param meta_sector in or out depending if it is known or not
- * @param meta_offset in or out depending if it is known or not
+ * @note "init_sdcard" has to be called first
+ * @note does not push forward te FUTURE_WRITE marker
+ * @note the write head is recovered from the descriptors between the last checkpoint and the FUTURE_WRITE marker
 */
-void  isacfs_file_desc(isacfs_file_meta* file_meta, u32* discovered_size, u32* meta_sector, u32* meta_offset){
-    if(meta_sector && meta_offset){
-        u8 sector[SECTOR_SIZE];
-        micro_sd_read_sectors(sector, *meta_sector, 0x1);
-        __desc_8B_blk__to__isacfs_file_meta(sector + *meta_offset, file_meta);
+isacfs_err_t __isacfs_init()
+{
+    isacfs_err_t geometry = __isacfs_geometry();
+    if(geometry != isacfs_ok){
+        return geometry;
     }
-    else { // search the meta sector&offset using quick search on datetime stamps
-        //{{{IMPLEMENT}}}
+    DATA_TAIL_VALID = false;
+    TAIL_BUF_VALID = false;
+    META_JOURNAL_VALID = false;
+    META_JOURNAL_PENDING = 0x0;
+    memset(FENCE_CACHE, 0x0, sizeof(FENCE_CACHE));
+
+    /* Load DATA_START, FUTURE_WRITE, AVG_FILE_SIZE and DATA_LAYOUT */
+    isacfs_pool_buf sector_buf(false);
+    u8* sector0 = sector_buf.data();
+    if(!sector0 || micro_sd_read_sectors_on(CARD, sector0, 0x0, 0x1) != ESP_OK){
+        Serial.println("ERROR WHILE READING SECTOR 0 [in isacfs_init()]");
+        return isacfs_fail;
+    }
+    if(!__isacfs_meta_trailer_generation(sector0, &FORMAT_GENERATION)){
+        Serial.println("NO ISACFS SUPERBLOCK IN SECTOR 0 [in isacfs_init()]");
+        return isacfs_fail;
     }
-}
 
-/**
- * @brief updates the meta sector&offset to enable reading the next file. {{{IMPLEMENT}}}
-*/
-void isacfs_next_meta(u32* sector, u32* offset){
-    *offset += 0x8;
-    if(*offset >= SECTOR_SIZE){
-        (*sector)++;
-        if(*sector >= ???){
-            *sector = 0x0;
-        }
+    ENGINE->get_addr_5B(sector0 + 0x0, &DATA_START_SECTOR, &DATA_START_OFFSET);
+    ENGINE->get_addr_5B(sector0 + 0x5, &FUTURE_WRITE_META_SECTOR, &FUTURE_WRITE_META_OFFSET);
+
+    AVG_FILE_SIZE = (((u32)sector0[0xA]) << 24U) | (((u32)sector0[0xB]) << 16U) | (((u32)sector0[0xC]) << 8U) | sector0[0xD];
+    if(!AVG_FILE_SIZE){
+        AVG_FILE_SIZE = DEFAULT_AVG_FILE_SIZE;
     }
+    DATA_LAYOUT = sector0[0xE] == isacfs_layout_converging || sector0[0xE] == isacfs_layout_loop ? (isacfs_layout_t)sector0[0xE] : isacfs_layout_fixed;
+    DESC_SHIFT = sector0[0xF] == 0x10 ? ISACFS_DESC_16B_SHIFT : ISACFS_DESC_8B_SHIFT; // 0 on the cards formatted before 16B descriptors
+
+    /* Find CURR_WRITE_META && CURR_WRITE_DATA */
+    if(__isacfs_recover_tail(sector0) != ESP_OK || __isacfs_recover_sequence(sector0) != ESP_OK){
+        Serial.println("ERROR WHILE READING A SECTOR [in isacfs_init()]");
+        return isacfs_fail;
+    }
+    GC_SEGMENT_VALID = false; // the staged files are lost
+    GC_FILES_COUNT = 0x0;
+    GC_DATA_HEAD = ((u64)CURR_WRITE_DATA_SECTOR << OFFSET_ADDR_WIDTH) + CURR_WRITE_DATA_OFFSET;
+    PREERASE_DATA_VALID = false;
+    PREERASE_META_VALID = false;
+
+    return isacfs_ok;
 }
 
 /**
- * Read the file based on the sector, offset and size data obtained using the "isacfs_file_desc" function
+ * @note "init_sdcard" has to be called first
 */
-void isacfs_read_file(isacfs_file_meta file_meta, void* out_buffer, u32 offset, u32 length){
-     
+isacfs_err_t isacfs_init(){
+    ISACFS_STATS_BEGIN(t0, CARD);
+    isacfs_err_t res = __isacfs_init();
+    ISACFS_STATS_END(isacfs_op_init, t0, CARD, res == isacfs_ok);
+    return res;
+}
+
+isacfs_t* isacfs_open(const micro_sd_backend_t* card){
+    isacfs_t* fs = new (std::nothrow) isacfs_t();
+    if(fs){
+        fs->card = card;
+    }
+    return fs;
+}
+
+/**
+ * @note The staged files are dropped - call "isacfs_sync" with the instance bound first
+*/
+void isacfs_close(isacfs_t* fs){
+    if(fs == &DEFAULT_FS){
+        return;
+    }
+#ifndef ISACFS_SECTOR_SIZE
+    isacfs_dma_free(fs->pool);
+    free(fs->read_timestamps_buf);
+#endif
+    isacfs_dma_free(fs->gc_arena);
+    free(fs->gc_files);
+    if(fs->lookup_lock){
+        isacfs_mutex_destroy(fs->lookup_lock);
+    }
+    delete fs;
+}
+
+isacfs_t* isacfs_bind(isacfs_t* fs){
+    isacfs_t* prev = FS;
+    FS = fs ? fs : &DEFAULT_FS;
+    return prev;
+}
+
+isacfs_t* isacfs_current(){
+    return FS;
+}
+
+/**
+ * @brief Pack the timestamp of "file_meta" like the low bits of a descriptor - packed timestamps compare like the time
+*/
+u64 isacfs_pack_timestamp(const isacfs_file_meta* file_meta){
+    return (__isacfs_pack_ts(file_meta) << ISACFS_MS_BITS) | file_meta->millisecond;
+}
+
+void isacfs_unpack_timestamp(u64 timestamp, isacfs_file_meta* file_meta){
+    __isacfs_unpack_ts(timestamp >> ISACFS_MS_BITS, file_meta);
+    file_meta->millisecond = timestamp & ((0x1U << ISACFS_MS_BITS) - 0x1);
+}
+
+void isacfs_decode_descs(const u8* descs, u32 count, u32* sector, u32* offset, u64* timestamp){
+    ENGINE->decode_descs(descs, count, DESC_SHIFT, sector, offset, timestamp);
+}
+
+void isacfs_encode_descs(u8* descs, u32 count, const u32* sector, const u32* offset, const u64* timestamp){
+    ENGINE->encode_descs(descs, count, DESC_SHIFT, sector, offset, timestamp);
+}
+
+u32 isacfs_desc_size(){
+    return DESC_SIZE;
+}
+
+/**
+ * @brief Decode all the descriptors of a metadata sector read from the card
+ * @returns number of the descriptors in it (0 for a sector of an older format generation)
+*/
+u32 isacfs_decode_meta_sector(const u8* sector, u32 sector_no, u32* data_sector, u32* data_offset, u64* timestamp){
+    u32 count = __isacfs_meta_trailer_count(sector);
+    if(count > __isacfs_meta_slots_count(sector_no)){
+        return 0x0; // not a metadata sector
+    }
+    ENGINE->decode_descs(sector + __isacfs_meta_first_offset(sector_no), count, DESC_SHIFT, data_sector, data_offset, timestamp);
+    return count;
+}
+
+/**
+ * @brief Fills "sector_count" sectors from "start_sector" on with zeroes
+ * @note Uses the erase command if the card supports it, large multi-block zero writes otherwise
+*/
+esp_err_t __isacfs_clear_sectors(u32 start_sector, u32 sector_count){
+    esp_err_t res = micro_sd_erase_sectors_on(CARD, start_sector, sector_count);
+    if(res != ESP_ERR_NOT_SUPPORTED){
+        return res;
+    }
+    u32 chunk = sector_count < CLEAR_CHUNK_SECTORS ? sector_count : CLEAR_CHUNK_SECTORS;
+    u8* zero = (u8*)isacfs_dma_alloc((size_t)chunk * SECTOR_SIZE);
+    if(!zero){
+        return ESP_ERR_NO_MEM;
+    }
+    memset(zero, 0x0, (size_t)chunk * SECTOR_SIZE);
+    res = ESP_OK;
+    while(sector_count){
+        u32 n = sector_count < chunk ? sector_count : chunk;
+        res = micro_sd_write_sectors_on(CARD, zero, start_sector, n);
+        if(res != ESP_OK){
+            break;
+        }
+        start_sector += n;
+        sector_count -= n;
+    }
+    isacfs_dma_free(zero);
+    return res;
+}
+
+/**
+ * @brief Fills all the sectors with zeroes
+*/
+esp_err_t __isacfs_clear_all_sectors(){
+    return __isacfs_clear_sectors(0x0, SECTOR_COUNT);
+}
+
+/**
+ * @brief DATA_START such that the descriptor region runs out together with the data region for AVG_FILE_SIZE frames
+ * @note DATA_START is sector-aligned - the metadata sectors end with a trailer
+*/
+void __isacfs_compute_data_start(){
+    if(DATA_LAYOUT == isacfs_layout_converging){
+        DATA_START_SECTOR = 0x0; // unused - the frames grow down from the end of the card
+        DATA_START_OFFSET = 0x0;
+        return;
+    }
+    /* meta_sectors * slots >= (SECTOR_COUNT - meta_sectors) * SECTOR_SIZE / AVG_FILE_SIZE */
+    u64 slots = __isacfs_meta_slots_count(0x1);
+    u64 card_bytes = ((u64)SECTOR_COUNT) << OFFSET_ADDR_WIDTH;
+    u64 meta_sectors = (card_bytes + slots * AVG_FILE_SIZE + SECTOR_SIZE - 0x1) / (slots * AVG_FILE_SIZE + SECTOR_SIZE);
+    if(meta_sectors < 0x1){
+        meta_sectors = 0x1;
+    }
+    if(DATA_LAYOUT == isacfs_layout_loop){
+        u64 min_sectors = (0x2 * FILE_LEAP) / slots + 0x2; // the FUTURE_WRITE marker must not lap the write head
+        u64 max_sectors = 0x1U << (LOOP_TAIL_BITS - __isacfs_loop_slot_bits()); // the tail has to fit into the trailer
+        meta_sectors = meta_sectors < min_sectors ? min_sectors : meta_sectors > max_sectors ? max_sectors : meta_sectors;
+    }
+    DATA_START_SECTOR = meta_sectors < SECTOR_COUNT ? meta_sectors : SECTOR_COUNT - 0x1;
+    DATA_START_OFFSET = 0x0;
+}
+
+/**
+ * @brief Format the card for frames of "avg_file_size" bytes on average (0 - the running estimate AVG_FILE_SIZE)
+ * @note Sector size can't be smaller than 11B
+ * @param mode isacfs_format_fast clears only the metadata sectors up to the first FUTURE_WRITE marker -
+ *        stale descriptors beyond them are told apart by the format generation in the metadata sector trailers
+ * @param desc_format the descriptor size, stored in the superblock
+ * @returns ESP_ERR_INVALID_SIZE if the card is too small for the descriptor ring of isacfs_layout_loop (2 * FILE_LEAP descriptors)
+*/
+esp_err_t __isacfs_format(isacfs_format_mode_t mode, isacfs_layout_t layout, u32 avg_file_size, isacfs_desc_format_t desc_format){
+    esp_err_t res = ESP_OK;
+    if(__isacfs_geometry() != isacfs_ok){
+        return ESP_ERR_INVALID_STATE; // the card can't carry isacfs, or no memory for the sector buffers
+    }
+
+    /* next format generation */
+    isacfs_pool_buf sector_buf(false);
+    u8* sector0 = sector_buf.data();
+    if(!sector0){
+        return ESP_ERR_NO_MEM;
+    }
+    res = micro_sd_read_sectors_on(CARD, sector0, 0x0, 0x1);
+    if(res != ESP_OK){
+        return res;
+    }
+    u32 prev_generation;
+    FORMAT_GENERATION = __isacfs_meta_trailer_generation(sector0, &prev_generation) ? prev_generation + 0x1 : 0x1;
+
+    if(avg_file_size){
+        AVG_FILE_SIZE = avg_file_size;
+    }
+    DATA_LAYOUT = layout;
+    DESC_SHIFT = desc_format == isacfs_desc_16B ? ISACFS_DESC_16B_SHIFT : ISACFS_DESC_8B_SHIFT;
+    __isacfs_compute_data_start(); // the descriptor ring of isacfs_layout_loop wraps at DATA_START
+    if(DATA_LAYOUT == isacfs_layout_loop && (DATA_START_SECTOR >= SECTOR_COUNT - 0x1 || (u64)DATA_START_SECTOR * __isacfs_meta_slots_count(0x1) <= 0x2 * FILE_LEAP)){
+        return ESP_ERR_INVALID_SIZE; // no room for the data ring, or the FUTURE_WRITE marker would lap the write head
+    }
+
+    if(mode == isacfs_format_full){
+        res = __isacfs_clear_all_sectors();
+    }
+    else {
+        u32 leap_sector = 0x0;
+        u32 leap_offset = META_START_OFFSET;
+        for(u32 i = 0x0; i < FILE_LEAP; i++){
+            __isacfs_advance_meta_loc(&leap_sector, &leap_offset);
+        }
+        res = __isacfs_clear_sectors(0x1, leap_sector);
+    }
+    if(res != ESP_OK){
+        return res;
+    }
+
+    FUTURE_WRITE_META_SECTOR = 0U;   /////////////////////////////////////////////
+    FUTURE_WRITE_META_OFFSET = META_START_OFFSET; // shifted by FILE_LEAP files    //
+                                                 /////////////////////////////////////////////
+    CURR_WRITE_META_SECTOR = 0U;
+    CURR_WRITE_META_OFFSET = META_START_OFFSET;
+    META_LAP = 0x0;
+    NEXT_SEQUENCE = 0x0;
+    TAIL_META_SECTOR = 0x0;
+    TAIL_META_OFFSET = META_START_OFFSET;
+    TAIL_BUF_VALID = false;
+
+    __isacfs_data_origin(&CURR_WRITE_DATA_SECTOR, &CURR_WRITE_DATA_OFFSET);
+    DATA_TAIL_VALID = false;
+    META_JOURNAL_VALID = false;
+    META_JOURNAL_PENDING = 0x0;
+    {
+        isacfs_lookup_guard guard;
+        memset(FENCE_CACHE, 0x0, sizeof(FENCE_CACHE));
+    }
+    GC_SEGMENT_VALID = false;
+    GC_FILES_COUNT = 0x0;
+    GC_DATA_HEAD = ((u64)CURR_WRITE_DATA_SECTOR << OFFSET_ADDR_WIDTH) + CURR_WRITE_DATA_OFFSET;
+    PREERASE_DATA_VALID = false;
+    PREERASE_META_VALID = false;
+
+    memset(sector0, 0x0, SECTOR_SIZE); //neccessary?
+    // Write data_start and future_write into the first 5B+5B of the Sector 0x0
+    //38, 40/8=5
+    ENGINE->put_addr_5B(sector0 + 0x0, DATA_START_SECTOR, DATA_START_OFFSET);
+    ENGINE->put_addr_5B(sector0 + 0x5, FUTURE_WRITE_META_SECTOR, FUTURE_WRITE_META_OFFSET);
+
+    __isacfs_put_avg_file_size(sector0);
+    sector0[0xE] = DATA_LAYOUT;
+    sector0[0xF] = DESC_SHIFT == ISACFS_DESC_16B_SHIFT ? DESC_SIZE : 0x0; // 0 - 8B, readable by the older builds
+
+    __isacfs_meta_trailer_put(sector0, 0x0);
+    return micro_sd_write_sectors_on(CARD, sector0, 0x0, 0x1);
+}
+
+esp_err_t isacfs_format(isacfs_format_mode_t mode, isacfs_layout_t layout, u32 avg_file_size, isacfs_desc_format_t desc_format){
+    ISACFS_STATS_BEGIN(t0, CARD);
+    esp_err_t res = __isacfs_format(mode, layout, avg_file_size, desc_format);
+    ISACFS_STATS_END(isacfs_op_format, t0, CARD, res == ESP_OK);
+    return res;
+}
+
+/**
+ * @brief Write the resident metadata sector to the card
+*/
+esp_err_t __isacfs_journal_flush(){
+    if(!META_JOURNAL_VALID || !META_JOURNAL_PENDING){
+        return ESP_OK;
+    }
+    esp_err_t res = micro_sd_write_sectors_on(CARD, META_JOURNAL_BUF, META_JOURNAL_SECTOR, 0x1);
+    if(res != ESP_OK){
+        return res;
+    }
+    META_JOURNAL_PENDING = 0x0;
+    META_JOURNAL_LAST_FLUSH_MS = millis();
+    ISACFS_STATS_ADD(journal_flushes, 0x1);
+    return res;
+}
+
+/**
+ * @brief Make the journal mirror the sector CURR_WRITE_META points into
+ * @note The sector is read only if it may already hold valid data (sector 0, or a slot other than the first one).
+ *       Otherwise everything in it is beyond the write head and it starts zeroed.
+*/
+esp_err_t __isacfs_journal_load(){
+    if(META_JOURNAL_VALID && META_JOURNAL_SECTOR == CURR_WRITE_META_SECTOR){
+        return ESP_OK;
+    }
+    esp_err_t res = __isacfs_journal_flush();
+    if(res != ESP_OK){
+        return res;
+    }
+    isacfs_lookup_guard guard; // the lookups read the metadata sectors through the journal
+    META_JOURNAL_VALID = false;
+    bool fresh = CURR_WRITE_META_OFFSET == __isacfs_meta_first_offset(CURR_WRITE_META_SECTOR);
+    if(CURR_WRITE_META_SECTOR == 0x0 || !fresh){
+        res = micro_sd_read_sectors_on(CARD, META_JOURNAL_BUF, CURR_WRITE_META_SECTOR, 0x1);
+        if(res != ESP_OK){
+            return res;
+        }
+        if(CURR_WRITE_META_SECTOR != 0x0 && !__isacfs_meta_trailer_count(META_JOURNAL_BUF)){
+            memset(META_JOURNAL_BUF, 0x0, SECTOR_SIZE); // stale (an older format generation)
+        }
+    }
+    else {
+        memset(META_JOURNAL_BUF, 0x0, SECTOR_SIZE);
+    }
+    if(fresh){
+        FENCE_CACHE[CURR_WRITE_META_SECTOR % FENCE_CACHE_SIZE].valid = false; // the sector is being rewritten
+        if(TAIL_BUF_SECTOR == CURR_WRITE_META_SECTOR){
+            TAIL_BUF_VALID = false;
+        }
+    }
+    META_JOURNAL_SECTOR = CURR_WRITE_META_SECTOR;
+    META_JOURNAL_VALID = true;
+    return res;
+}
+
+/**
+ * @brief Put the descriptor of "file_meta" at CURR_WRITE_META && update CURR_WRITE_META
+ * @note The journal is flushed when its sector fills, when the next slot is the FUTURE_WRITE marker,
+ *       or when JOURNAL_MAX_FILES descriptors/JOURNAL_MAX_MS milliseconds are pending
+*/
+esp_err_t __isacfs_journal_append(isacfs_file_meta* file_meta){
+    esp_err_t res = __isacfs_journal_load();
+    if(res != ESP_OK){
+        return res;
+    }
+    if(!META_JOURNAL_PENDING){
+        META_JOURNAL_LAST_FLUSH_MS = millis(); // the age of the journal counts from its first pending descriptor
+    }
+    isacfs_lookup_guard guard; // a lookup sees the descriptor && the head that covers it together
+    file_meta->sequence = NEXT_SEQUENCE;
+    __isacfs_encode_desc(file_meta, META_JOURNAL_BUF + CURR_WRITE_META_OFFSET);
+    u32 next_sector = CURR_WRITE_META_SECTOR;
+    u32 next_offset = CURR_WRITE_META_OFFSET;
+    __isacfs_advance_meta_loc(&next_sector, &next_offset);
+    if(DATA_LAYOUT == isacfs_layout_loop && next_sector != CURR_WRITE_META_SECTOR && TAIL_META_SECTOR == next_sector){
+        /* the descriptor ring came around to the oldest descriptors - their sector is rewritten from the next descriptor on */
+        TAIL_META_SECTOR = next_sector + 0x1 >= __isacfs_meta_ring_end() ? 0x0 : next_sector + 0x1;
+        TAIL_META_OFFSET = __isacfs_meta_first_offset(TAIL_META_SECTOR);
+    }
+    __isacfs_meta_trailer_put(META_JOURNAL_BUF, ((CURR_WRITE_META_OFFSET - __isacfs_meta_first_offset(CURR_WRITE_META_SECTOR)) >> DESC_SHIFT) + 0x1);
+    META_JOURNAL_PENDING++;
+
+    CURR_WRITE_META_SECTOR = next_sector;
+    CURR_WRITE_META_OFFSET = next_offset;
+    NEXT_SEQUENCE++;
+    if(CURR_WRITE_META_SECTOR < META_JOURNAL_SECTOR){
+        META_LAP++; // the descriptor ring wrapped
+    }
+
+    if(CURR_WRITE_META_SECTOR != META_JOURNAL_SECTOR
+       || (CURR_WRITE_META_SECTOR == FUTURE_WRITE_META_SECTOR && CURR_WRITE_META_OFFSET == FUTURE_WRITE_META_OFFSET)
+       || (JOURNAL_MAX_FILES && META_JOURNAL_PENDING >= JOURNAL_MAX_FILES)
+       || (JOURNAL_MAX_MS && millis() - META_JOURNAL_LAST_FLUSH_MS >= JOURNAL_MAX_MS)){
+        res = __isacfs_journal_flush();
+    }
+    return res;
+}
+
+/**
+ * @brief Set when the metadata journal gets flushed
+ * @param max_pending_files flush after this many descriptors (0 - only when the metadata sector fills)
+ * @param max_pending_ms flush when the oldest pending descriptor is this old (0 - never)
+*/
+void isacfs_journal_config(u32 max_pending_files, u32 max_pending_ms){
+    JOURNAL_MAX_FILES = max_pending_files;
+    JOURNAL_MAX_MS = max_pending_ms;
+}
+
+
+/**
+ * @brief Move the FUTURE_WRITE marker FILE_LEAP descriptors ahead and store it in the sector 0
+ * @note If the journal mirrors the sector 0, the marker is patched there and the journal is flushed instead
+*/
+esp_err_t __isacfs_shift_future_marker(){
+    esp_err_t res = ESP_OK;
+    for(u32 i = 0x0; i < FILE_LEAP; i++){
+        __isacfs_advance_meta_loc(&FUTURE_WRITE_META_SECTOR, &FUTURE_WRITE_META_OFFSET);
+    }
+    ISACFS_STATS_ADD(marker_shifts, 0x1);
+
+    // - and UPDATE MEMORY
+
+    isacfs_pool_buf sector_buf(false);
+    u8* sector0 = sector_buf.data();
+    bool journaled = META_JOURNAL_VALID && META_JOURNAL_SECTOR == 0x0;
+    if(journaled){
+        sector0 = META_JOURNAL_BUF;
+    }
+    else {
+        if(!sector0){
+            return ESP_ERR_NO_MEM;
+        }
+        res = micro_sd_read_sectors_on(CARD, sector0, 0x0, 0x1);
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+
+    ENGINE->put_addr_5B(sector0 + 0x5, FUTURE_WRITE_META_SECTOR, FUTURE_WRITE_META_OFFSET);
+    __isacfs_put_avg_file_size(sector0);
+
+    if(journaled){
+        META_JOURNAL_PENDING++; // the marker itself is pending now
+        return __isacfs_journal_flush();
+    }
+    return micro_sd_write_sectors_on(CARD, sector0, 0x0, 0x1);
+}
+
+/**
+ * @brief Get a single data sector, from DATA_TAIL_BUF if it is resident
+*/
+esp_err_t __isacfs_read_data_sector(u32 sector_no, u8* sector){
+    if(DATA_TAIL_VALID && DATA_TAIL_SECTOR == sector_no){
+        memcpy(sector, DATA_TAIL_BUF, SECTOR_SIZE);
+        return ESP_OK;
+    }
+    return micro_sd_read_sectors_on(CARD, sector, sector_no, 0x1);
+}
+
+/**
+ * @brief Read "count" data sectors from "sector_no" on in a single multi-block transfer
+ *        (isacfs_layout_loop: 2 of them if the sectors go on at DATA_START past the end of the card)
+*/
+esp_err_t __isacfs_read_data_sectors(u8* out, u32 sector_no, u32 count){
+    sector_no = __isacfs_wrap_data_sector(sector_no);
+    u32 first_count = count;
+    if(DATA_LAYOUT == isacfs_layout_loop && sector_no + count > SECTOR_COUNT){
+        first_count = SECTOR_COUNT - sector_no;
+    }
+    esp_err_t res = __isacfs_card_read(out, sector_no, first_count);
+    if(res != ESP_OK || first_count == count){
+        return res;
+    }
+    return __isacfs_card_read(out + ((size_t)first_count << OFFSET_ADDR_WIDTH), DATA_START_SECTOR, count - first_count);
+}
+
+/**
+ * @brief Sector of the descriptor slot "files" slots after CURR_WRITE_META
+*/
+u32 __isacfs_meta_sector_ahead(u32 files){
+    u32 sector_no = CURR_WRITE_META_SECTOR;
+    u32 slot = ((CURR_WRITE_META_OFFSET - __isacfs_meta_first_offset(sector_no)) >> DESC_SHIFT) + files;
+    while(slot >= __isacfs_meta_slots_count(sector_no)){
+        slot -= __isacfs_meta_slots_count(sector_no);
+        sector_no++;
+    }
+    return sector_no;
+}
+
+/**
+ * @brief Byte address of the data of the oldest live frame (isacfs_layout_loop)
+ * @note The metadata sector of the tail stays resident in TAIL_BUF - the tail moves one descriptor at a time
+*/
+esp_err_t __isacfs_loop_tail_pos(u64* pos){
+    const u8* sector = TAIL_BUF;
+    if(META_JOURNAL_VALID && META_JOURNAL_SECTOR == TAIL_META_SECTOR){
+        sector = META_JOURNAL_BUF;
+    }
+    else if(!TAIL_BUF_VALID || TAIL_BUF_SECTOR != TAIL_META_SECTOR){
+        TAIL_BUF_VALID = false;
+        esp_err_t res = micro_sd_read_sectors_on(CARD, TAIL_BUF, TAIL_META_SECTOR, 0x1);
+        if(res != ESP_OK){
+            return res;
+        }
+        TAIL_BUF_SECTOR = TAIL_META_SECTOR;
+        TAIL_BUF_VALID = true;
+    }
+    isacfs_file_meta file_meta;
+    ENGINE->decode_desc(sector + TAIL_META_OFFSET, &file_meta);
+    *pos = ((u64)file_meta.sector << OFFSET_ADDR_WIDTH) + file_meta.offset;
+    return ESP_OK;
+}
+
+/**
+ * @brief Put the tail into the trailer of the metadata sector holding the last descriptor && write that sector
+*/
+esp_err_t __isacfs_loop_store_tail(){
+    u32 last_sector = CURR_WRITE_META_SECTOR;
+    u32 last_offset = CURR_WRITE_META_OFFSET;
+    __isacfs_retreat_meta_loc(&last_sector, &last_offset);
+    if(META_JOURNAL_VALID && META_JOURNAL_SECTOR == last_sector){
+        __isacfs_meta_trailer_put_tail(META_JOURNAL_BUF);
+        META_JOURNAL_PENDING++;
+        return __isacfs_journal_flush();
+    }
+    isacfs_pool_buf sector_buf(false);
+    u8* sector = sector_buf.data();
+    if(!sector){
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t res = micro_sd_read_sectors_on(CARD, sector, last_sector, 0x1);
+    if(res != ESP_OK){
+        return res;
+    }
+    __isacfs_meta_trailer_put_tail(sector);
+    return micro_sd_write_sectors_on(CARD, sector, last_sector, 0x1);
+}
+
+/**
+ * @brief Drop the oldest frames until "buf_sz" bytes at "pos" overwrite none of the live ones (isacfs_layout_loop)
+ * @note The sector at the write head is written without being read, so the room reaches the end of the sector of the last byte
+ * @note The room is kept a byte longer than that - the ring never fills up, so the oldest frame starting at the head is
+ *       an empty one and not one the head went all the way around to
+ * @note Once the tail has to move, it moves LOOP_EVICT_AHEAD bytes further and is stored before the data goes over
+ *       the dropped frames - a reboot never finds a frame in the log whose data was overwritten
+*/
+esp_err_t __isacfs_loop_make_room(u64 pos, u32 buf_sz){
+    esp_err_t res = ESP_OK;
+    if(!buf_sz){
+        return res;
+    }
+    u64 ring = __isacfs_loop_ring_bytes();
+    u64 need = ((((pos + buf_sz - 0x1) >> OFFSET_ADDR_WIDTH) + 0x1) << OFFSET_ADDR_WIDTH) - pos;
+    u64 ahead = ring >> 0x3 < LOOP_EVICT_AHEAD ? ring >> 0x3 : LOOP_EVICT_AHEAD;
+    bool moved = false;
+    while(!(TAIL_META_SECTOR == CURR_WRITE_META_SECTOR && TAIL_META_OFFSET == CURR_WRITE_META_OFFSET)){
+        u64 tail_pos;
+        res = __isacfs_loop_tail_pos(&tail_pos);
+        if(res != ESP_OK){
+            return res;
+        }
+        u64 room = tail_pos > pos ? tail_pos - pos : tail_pos + ring - pos; // the tail at the head: only empty frames are live
+        if(room > (moved ? need + ahead : need)){
+            break;
+        }
+        __isacfs_advance_meta_loc(&TAIL_META_SECTOR, &TAIL_META_OFFSET);
+        moved = true;
+    }
+    if(moved){
+        res = __isacfs_loop_store_tail();
+    }
+    return res;
+}
+
+/**
+ * @brief Find where a file of "buf_sz" bytes goes if the data head is at "data_head"
+ * @param pending_files descriptors to be logged before the one of this file
+ * @param[out] pos byte address of the start of the file
+ * @returns ESP_ERR_INVALID_SIZE if the file or its descriptor doesn't fit, or the file is empty (isacfs_layout_converging)
+*/
+esp_err_t __isacfs_place_data(u64 data_head, u32 buf_sz, u32 pending_files, u64* pos){
+    if(DATA_LAYOUT == isacfs_layout_loop){
+        if((u64)buf_sz + SECTOR_SIZE > __isacfs_loop_ring_bytes()){
+            return ESP_ERR_INVALID_SIZE; // a frame never takes the whole ring
+        }
+        *pos = data_head; // the oldest frames make room (see "__isacfs_loop_make_room")
+        return ESP_OK;
+    }
+    u32 meta_sector = __isacfs_meta_sector_ahead(pending_files);
+    if(DATA_LAYOUT == isacfs_layout_converging){
+        if(!buf_sz){
+            return ESP_ERR_INVALID_SIZE; // it would start at the data head - the origin is past the last sector a descriptor holds
+        }
+        u64 meta_end = ((u64)meta_sector + 0x1) << OFFSET_ADDR_WIDTH;
+        if(data_head < meta_end + buf_sz){
+            return ESP_ERR_INVALID_SIZE; // the frames met the descriptors
+        }
+        *pos = data_head - buf_sz;
+        return ESP_OK;
+    }
+    if(meta_sector >= DATA_START_SECTOR){
+        return ESP_ERR_INVALID_SIZE; // the descriptor region is full
+    }
+    if(data_head + buf_sz > ((u64)SECTOR_COUNT << OFFSET_ADDR_WIDTH)){
+        return ESP_ERR_INVALID_SIZE; // the file doesn't fit before the end of the card
+    }
+    *pos = data_head;
+    return ESP_OK;
+}
+
+/* the bytes of a frame being written - the pieces of "isacfs_write_filev" (a single one for "isacfs_write_file") */
+typedef struct {
+    const isacfs_iovec_t* iov;
+    u32 count;
+    u32 piece; // the piece found last and its position in the frame (the lookups mostly go forward)
+    u32 piece_pos;
+} isacfs_frame_src_t;
+
+/**
+ * @brief Find the byte "pos" of the frame
+ * @param[out] data the byte in its piece
+ * @returns number of the bytes from it to the end of its piece
+*/
+u32 __isacfs_src_run(isacfs_frame_src_t* src, u32 pos, const u8** data){
+    if(pos < src->piece_pos){
+        src->piece = 0x0;
+        src->piece_pos = 0x0;
+    }
+    while(src->piece < src->count && pos - src->piece_pos >= src->iov[src->piece].len){ // empty pieces are skipped
+        src->piece_pos += src->iov[src->piece].len;
+        src->piece++;
+    }
+    if(src->piece == src->count){
+        *data = NULL;
+        return 0x0;
+    }
+    u32 offset = pos - src->piece_pos;
+    *data = (const u8*)src->iov[src->piece].base + offset;
+    return src->iov[src->piece].len - offset;
+}
+
+/**
+ * @brief Gather "length" bytes of the frame from "pos" on
+*/
+void __isacfs_src_copy(isacfs_frame_src_t* src, u32 pos, u8* out, u32 length){
+    while(length){
+        const u8* data;
+        u32 n = __isacfs_src_run(src, pos, &data);
+        n = n < length ? n : length;
+        memcpy(out, data, n);
+        out += n;
+        pos += n;
+        length -= n;
+    }
+}
+
+/**
+ * @brief Write "count" full sectors of the frame from "pos" on at "sector_no"
+ * @note A run of sectors lying in a piece the driver can DMA from goes straight from it in a single transfer; the
+ *       other sectors (the ones straddling two pieces too) are gathered into a bounce buffer, up to the next such run.
+ *       A run shorter than the bounce buffer is gathered as well - a command costs more than copying it.
+*/
+esp_err_t __isacfs_stream_sectors(isacfs_frame_src_t* src, u32 pos, u32 sector_no, u32 count){
+    esp_err_t res = ESP_OK;
+    while(count && res == ESP_OK){
+        const u8* data;
+        u32 run = __isacfs_src_run(src, pos, &data) >> OFFSET_ADDR_WIDTH;
+        u32 n = 0x0;
+        if(run >= (count < ISACFS_BOUNCE_SECTORS ? count : ISACFS_BOUNCE_SECTORS) && isacfs_dma_capable(data)){
+            n = run < count ? run : count;
+            res = micro_sd_write_sectors_on(CARD, data, sector_no, n);
+        }
+        else {
+            isacfs_pool_buf bounce(true);
+            if(!bounce.data()){
+                return ESP_ERR_NO_MEM;
+            }
+            do {
+                __isacfs_src_copy(src, pos + (n << OFFSET_ADDR_WIDTH), bounce.data() + ((size_t)n << OFFSET_ADDR_WIDTH), SECTOR_SIZE);
+                n++;
+                if(n == count || n == bounce.sectors){
+                    break;
+                }
+                run = __isacfs_src_run(src, pos + (n << OFFSET_ADDR_WIDTH), &data) >> OFFSET_ADDR_WIDTH;
+            } while(run < ISACFS_BOUNCE_SECTORS || !isacfs_dma_capable(data));
+            ISACFS_STATS_ADD(bounced_sectors, n);
+            res = micro_sd_write_sectors_on(CARD, bounce.data(), sector_no, n);
+        }
+        pos += n << OFFSET_ADDR_WIDTH;
+        sector_no += n;
+        count -= n;
+    }
+    return res;
+}
+
+/**
+ * @brief Forget DATA_TAIL_BUF if it mirrors one of the sectors [first_sector, end_sector), which are about to be rewritten
+*/
+void __isacfs_drop_data_tail(u32 first_sector, u32 end_sector){
+    isacfs_lookup_guard guard;
+    if(DATA_TAIL_VALID && DATA_TAIL_SECTOR - first_sector < end_sector - first_sector){
+        DATA_TAIL_VALID = false;
+    }
+}
+
+/**
+ * @brief Write a partial sector (bytes "pos" to "pos" + "buf_sz" of the frame) through DATA_TAIL_BUF, which keeps it resident afterwards
+ * @param keep whether the rest of the sector holds valid data (read-modify-write unless it is already resident)
+*/
+esp_err_t __isacfs_put_partial_sector(u32 sector_no, u32 offset, isacfs_frame_src_t* src, u32 pos, u32 buf_sz, bool keep){
+    esp_err_t res = ESP_OK;
+    isacfs_lookup_guard guard; // "isacfs_read_file" reads the sector through DATA_TAIL_BUF
+    if(!DATA_TAIL_VALID || DATA_TAIL_SECTOR != sector_no){
+        DATA_TAIL_VALID = false;
+        if(keep){
+            ISACFS_STATS_ADD(rmw_cycles, 0x1);
+            res = micro_sd_read_sectors_on(CARD, DATA_TAIL_BUF, sector_no, 0x1);
+            if(res != ESP_OK){
+                return res;
+            }
+        }
+        else {
+            memset(DATA_TAIL_BUF, 0x0, SECTOR_SIZE);
+        }
+        DATA_TAIL_SECTOR = sector_no;
+        DATA_TAIL_VALID = true;
+    }
+    __isacfs_src_copy(src, pos, DATA_TAIL_BUF + offset, buf_sz);
+    res = micro_sd_write_sectors_on(CARD, DATA_TAIL_BUF, sector_no, 0x1);
+    if(res != ESP_OK){
+        DATA_TAIL_VALID = false;
+    }
+    return res;
+}
+
+/**
+ * @brief Stream "buf_sz" bytes of the frame from "from" on into the data region at CURR_WRITE_DATA && update CURR_WRITE_DATA
+ * @note isacfs_layout_converging: the frame is placed right below CURR_WRITE_DATA, which moves down to its start
+ * @note head sector: read-modify-write only if the frame written before shares it and it isn't resident in DATA_TAIL_BUF
+ * @note body: all the full sectors go in a single multi-block transfer, straight from the frame if the driver can DMA
+ *       from it (see "__isacfs_stream_sectors")
+ * @note tail: nothing valid lies beyond the write head, so the sector at the write head is written without reading it
+ *       first and is kept resident in DATA_TAIL_BUF to serve the next frame
+ * @note isacfs_layout_loop: a frame reaching past the end of the card goes on at DATA_START
+*/
+esp_err_t __isacfs_stream_data(isacfs_frame_src_t* src, u32 from, u32 buf_sz){
+    esp_err_t res = ESP_OK;
+    if(!buf_sz){
+        return res;
+    }
+    bool down = DATA_LAYOUT == isacfs_layout_converging;
+    u64 pos;
+    res = __isacfs_place_data(((u64)CURR_WRITE_DATA_SECTOR << OFFSET_ADDR_WIDTH) + CURR_WRITE_DATA_OFFSET, buf_sz, 0x0, &pos);
+    if(res != ESP_OK){
+        return res;
+    }
+    u64 data_end = (u64)SECTOR_COUNT << OFFSET_ADDR_WIDTH;
+    if(DATA_LAYOUT == isacfs_layout_loop && pos + buf_sz > data_end){
+        u32 first_sz = data_end - pos;
+        res = __isacfs_stream_data(src, from, first_sz); // CURR_WRITE_DATA wraps to DATA_START
+        if(res != ESP_OK){
+            return res;
+        }
+        return __isacfs_stream_data(src, from + first_sz, buf_sz - first_sz);
+    }
+
+    u32 sector_no = pos >> OFFSET_ADDR_WIDTH;
+    u32 offset = pos - ((u64)sector_no << OFFSET_ADDR_WIDTH);
+    u32 head_sz = offset ? SECTOR_SIZE - offset : 0x0;
+    if(head_sz >= buf_sz){ // the whole file fits into a single sector, which stays resident
+        bool keep = down ? offset + buf_sz < SECTOR_SIZE : offset != 0x0;
+        res = __isacfs_put_partial_sector(sector_no, offset, src, from, buf_sz, keep);
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+    else {
+        u32 num_full_sectors = (buf_sz - head_sz) >> OFFSET_ADDR_WIDTH;
+        u32 tail_sz = buf_sz - head_sz - (num_full_sectors << OFFSET_ADDR_WIDTH);
+        u32 body_sector = sector_no + (head_sz ? 0x1 : 0x0);
+        u32 tail_sector = body_sector + num_full_sectors;
+
+        /* the sector shared with the frame written before goes first, the one at the write head last */
+        if(head_sz && !down){
+            res = __isacfs_put_partial_sector(sector_no, offset, src, from, head_sz, true);
+        }
+        else if(tail_sz && down){
+            res = __isacfs_put_partial_sector(tail_sector, 0x0, src, from + buf_sz - tail_sz, tail_sz, true);
+        }
+        if(res != ESP_OK){
+            return res;
+        }
+
+        if(num_full_sectors){
+            __isacfs_drop_data_tail(body_sector, tail_sector);
+            res = __isacfs_stream_sectors(src, from + head_sz, body_sector, num_full_sectors);
+            if(res != ESP_OK){
+                return res;
+            }
+        }
+
+        if(head_sz && down){
+            res = __isacfs_put_partial_sector(sector_no, offset, src, from, head_sz, false);
+        }
+        else if(tail_sz && !down){
+            res = __isacfs_put_partial_sector(tail_sector, 0x0, src, from + buf_sz - tail_sz, tail_sz, false);
+        }
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+
+    if(!down){
+        pos += buf_sz;
+    }
+    if(DATA_LAYOUT == isacfs_layout_loop && pos >= data_end){
+        pos = (u64)DATA_START_SECTOR << OFFSET_ADDR_WIDTH;
+    }
+    CURR_WRITE_DATA_SECTOR = pos >> OFFSET_ADDR_WIDTH;
+    CURR_WRITE_DATA_OFFSET = pos - ((u64)CURR_WRITE_DATA_SECTOR << OFFSET_ADDR_WIDTH);
+    return res;
+}
+
+/**
+ * @brief Put the descriptor of a file whose data is on the card into the log (at CURR_WRITE_META)
+*/
+esp_err_t __isacfs_log_file(isacfs_file_meta* file_meta){
+    esp_err_t res = ESP_OK;
+    if(CURR_WRITE_META_SECTOR == FUTURE_WRITE_META_SECTOR && CURR_WRITE_META_OFFSET == FUTURE_WRITE_META_OFFSET){
+        //shift the FUTURE_WRITE marker
+        res = __isacfs_shift_future_marker();
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+
+    /* journal file meta && update CURR_WRITE_META */
+    return __isacfs_journal_append(file_meta);
+}
+
+/**
+ * @brief Write the staged sectors of the segment in a single multi-block transfer && log the staged files
+ * @note Every staged file is on the card afterwards - the files are staged as a whole, and the segments before
+ *       the current one were committed when the staging moved on
+*/
+esp_err_t __isacfs_group_commit(){
+    esp_err_t res = ESP_OK;
+    if(GC_DIRTY_END > GC_DIRTY_FIRST){
+        __isacfs_drop_data_tail(GC_DIRTY_FIRST, GC_DIRTY_END);
+        res = __isacfs_card_write(GC_ARENA + ((GC_DIRTY_FIRST - GC_SEGMENT_SECTOR) << OFFSET_ADDR_WIDTH), GC_DIRTY_FIRST, GC_DIRTY_END - GC_DIRTY_FIRST);
+        if(res != ESP_OK){
+            return res;
+        }
+        GC_DIRTY_END = GC_DIRTY_FIRST;
+    }
+
+    u32 logged = 0x0;
+    for(; logged < GC_FILES_COUNT; logged++){
+        isacfs_staged_file_t* staged = GC_FILES + logged;
+        CURR_WRITE_DATA_SECTOR = staged->data_head >> OFFSET_ADDR_WIDTH;
+        CURR_WRITE_DATA_OFFSET = staged->data_head - ((u64)CURR_WRITE_DATA_SECTOR << OFFSET_ADDR_WIDTH);
+        res = __isacfs_log_file(&staged->file_meta);
+        if(res != ESP_OK){
+            logged++; // it is in the journal
+            break;
+        }
+    }
+    memmove(GC_FILES, GC_FILES + logged, (GC_FILES_COUNT - logged) * sizeof(isacfs_staged_file_t));
+    GC_FILES_COUNT -= logged;
+    return res;
+}
+
+/**
+ * @brief Make the segment that holds "sector_no" the one in the arena
+ * @note The sector at the data head may be shared with a file already on the card - it is the only one read
+ * @note The arena isn't cleared - the staging fills every sector it touches (see "__isacfs_group_stage")
+*/
+esp_err_t __isacfs_group_open_segment(u32 sector_no){
+    esp_err_t res = __isacfs_group_commit();
+    if(res != ESP_OK){
+        return res;
+    }
+    GC_SEGMENT_VALID = false;
+    GC_SEGMENT_SECTOR = sector_no - sector_no % GC_SEGMENT_SECTORS;
+    u32 head_sector = GC_DATA_HEAD >> OFFSET_ADDR_WIDTH;
+    bool head_shared = GC_DATA_HEAD - ((u64)head_sector << OFFSET_ADDR_WIDTH);
+    if(head_shared && head_sector >= GC_SEGMENT_SECTOR && head_sector - GC_SEGMENT_SECTOR < GC_SEGMENT_SECTORS){
+        ISACFS_STATS_ADD(rmw_cycles, 0x1);
+        res = __isacfs_read_data_sector(head_sector, GC_ARENA + ((head_sector - GC_SEGMENT_SECTOR) << OFFSET_ADDR_WIDTH));
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+    GC_DIRTY_FIRST = GC_SEGMENT_SECTOR;
+    GC_DIRTY_END = GC_DIRTY_FIRST;
+    GC_SEGMENT_VALID = true;
+    return res;
+}
+
+/**
+ * @brief Copy "buf_sz" bytes of the frame from "from" on into the arena at the byte address "pos", committing segments as the staging moves on
+ * @note The bytes go in the direction the data region grows, so a segment is never reopened
+*/
+esp_err_t __isacfs_group_stage(isacfs_frame_src_t* src, u32 from, u32 buf_sz, u64 pos){
+    esp_err_t res = ESP_OK;
+    bool down = DATA_LAYOUT == isacfs_layout_converging;
+    while(buf_sz){
+        u64 chunk_pos = down ? pos + buf_sz - 0x1 : pos; // the byte the next chunk starts from
+        u32 sector_no = chunk_pos >> OFFSET_ADDR_WIDTH;
+        if(!GC_SEGMENT_VALID || sector_no < GC_SEGMENT_SECTOR || sector_no - GC_SEGMENT_SECTOR >= GC_SEGMENT_SECTORS){
+            res = __isacfs_group_open_segment(sector_no);
+            if(res != ESP_OK){
+                return res;
+            }
+        }
+        u64 segment_pos = (u64)GC_SEGMENT_SECTOR << OFFSET_ADDR_WIDTH;
+        u64 segment_end = ((u64)GC_SEGMENT_SECTOR + GC_SEGMENT_SECTORS) << OFFSET_ADDR_WIDTH;
+        u64 chunk_start = down ? (pos > segment_pos ? pos : segment_pos) : pos;
+        u64 chunk_end = down ? pos + buf_sz : (pos + buf_sz < segment_end ? pos + buf_sz : segment_end);
+        u32 chunk_sz = chunk_end - chunk_start;
+        __isacfs_src_copy(src, from + (chunk_start - pos), GC_ARENA + (chunk_start - segment_pos), chunk_sz);
+
+        u32 first_sector = chunk_start >> OFFSET_ADDR_WIDTH;
+        u32 end_sector = ((chunk_end - 0x1) >> OFFSET_ADDR_WIDTH) + 0x1;
+        /* past the data head, a partially staged sector still holds bytes of an older segment - they go to the card as zeroes */
+        if(down){
+            u64 sector_pos = (u64)first_sector << OFFSET_ADDR_WIDTH;
+            memset(GC_ARENA + (sector_pos - segment_pos), 0x0, chunk_start - sector_pos);
+        }
+        else {
+            u64 sector_end = (u64)end_sector << OFFSET_ADDR_WIDTH;
+            memset(GC_ARENA + (chunk_end - segment_pos), 0x0, sector_end - chunk_end);
+        }
+        if(GC_DIRTY_END <= GC_DIRTY_FIRST){
+            GC_DIRTY_FIRST = first_sector;
+            GC_DIRTY_END = end_sector;
+        }
+        else {
+            GC_DIRTY_FIRST = first_sector < GC_DIRTY_FIRST ? first_sector : GC_DIRTY_FIRST;
+            GC_DIRTY_END = end_sector > GC_DIRTY_END ? end_sector : GC_DIRTY_END;
+        }
+
+        buf_sz -= chunk_sz;
+        if(!down){
+            from += chunk_sz;
+            pos += chunk_sz;
+        }
+    }
+    return res;
+}
+
+/**
+ * @brief Stage the file in the arena; its descriptor goes to the log once the segment holding it is on the card
+*/
+esp_err_t __isacfs_group_write(isacfs_file_meta* file_meta, isacfs_frame_src_t* src, u32 buf_sz){
+    esp_err_t res = ESP_OK;
+    if(GC_FILES_COUNT >= GC_FILES_CAP){
+        res = __isacfs_group_commit();
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+    u64 pos;
+    res = __isacfs_place_data(GC_DATA_HEAD, buf_sz, GC_FILES_COUNT, &pos);
+    if(res != ESP_OK){
+        return res;
+    }
+    u64 data_end = (u64)SECTOR_COUNT << OFFSET_ADDR_WIDTH;
+    u32 first_sz = buf_sz;
+    if(DATA_LAYOUT == isacfs_layout_loop){
+        res = __isacfs_loop_make_room(pos, buf_sz);
+        if(res != ESP_OK){
+            return res;
+        }
+        if(pos + buf_sz > data_end){
+            first_sz = data_end - pos; // the rest goes on at DATA_START
+        }
+    }
+    res = __isacfs_group_stage(src, 0x0, first_sz, pos);
+    if(res == ESP_OK && first_sz < buf_sz){
+        res = __isacfs_group_stage(src, first_sz, buf_sz - first_sz, (u64)DATA_START_SECTOR << OFFSET_ADDR_WIDTH);
+    }
+    if(res != ESP_OK){
+        return res;
+    }
+    GC_DATA_HEAD = DATA_LAYOUT == isacfs_layout_converging ? pos : pos + buf_sz;
+    if(DATA_LAYOUT == isacfs_layout_loop && GC_DATA_HEAD >= data_end){
+        GC_DATA_HEAD -= __isacfs_loop_ring_bytes();
+    }
+
+    file_meta->sector = pos >> OFFSET_ADDR_WIDTH;
+    file_meta->offset = pos - ((u64)file_meta->sector << OFFSET_ADDR_WIDTH);
+    isacfs_staged_file_t* staged = GC_FILES + GC_FILES_COUNT++;
+    staged->file_meta = *file_meta;
+    staged->data_head = GC_DATA_HEAD;
+    return res;
+}
+
+/**
+ * @brief Drop the staged files (they are lost like on a power failure)
+*/
+void __isacfs_group_reset(){
+    GC_SEGMENT_VALID = false;
+    GC_FILES_COUNT = 0x0;
+    GC_DATA_HEAD = ((u64)CURR_WRITE_DATA_SECTOR << OFFSET_ADDR_WIDTH) + CURR_WRITE_DATA_OFFSET;
+}
+
+/**
+ * @brief Collect files in a RAM arena and write them as AU-aligned segments in a single multi-block transfer each
+ * @param segment_size rounded down to a power of 2 between 64KiB and 4MiB (0 - write every file as it arrives)
+ * @note The staged files are committed first
+*/
+esp_err_t isacfs_group_commit_config(u32 segment_size){
+    esp_err_t res = ESP_OK;
+    if(GC_ARENA){
+        res = __isacfs_group_commit();
+        if(res != ESP_OK){
+            return res;
+        }
+        isacfs_dma_free(GC_ARENA);
+        free(GC_FILES);
+        GC_ARENA = NULL;
+        GC_FILES = NULL;
+    }
+    __isacfs_group_reset();
+    if(!segment_size){
+        return res;
+    }
+
+    u32 size = GROUP_COMMIT_MIN_SEGMENT;
+    while(size < GROUP_COMMIT_MAX_SEGMENT && (size << 0x1) <= segment_size){
+        size <<= 0x1;
+    }
+    GC_SEGMENT_SECTORS = size >> OFFSET_ADDR_WIDTH;
+    GC_FILES_CAP = size / GROUP_COMMIT_BYTES_PER_FILE;
+    GC_ARENA = (u8*)isacfs_dma_alloc(size);
+    if(!GC_ARENA){
+        GC_ARENA = (u8*)malloc(size); // PSRAM on the target - the segments go through the bounce buffers
+    }
+    GC_FILES = (isacfs_staged_file_t*)malloc(GC_FILES_CAP * sizeof(isacfs_staged_file_t));
+    if(!GC_ARENA || !GC_FILES){
+        isacfs_dma_free(GC_ARENA);
+        free(GC_FILES);
+        GC_ARENA = NULL;
+        GC_FILES = NULL;
+        Serial.println("ERROR WHILE ALLOCATING THE STAGING ARENA [in isacfs_group_commit_config()]");
+        return ESP_ERR_NO_MEM;
+    }
+    return res;
+}
+
+/**
+ * @brief Erase "sector_count" sectors ahead of a write head and drop what is cached of them
+*/
+esp_err_t __isacfs_preerase_sectors(u32 start_sector, u32 sector_count){
+    esp_err_t res = micro_sd_erase_sectors_on(CARD, start_sector, sector_count);
+    if(res != ESP_OK){
+        return res;
+    }
+    __isacfs_drop_data_tail(start_sector, start_sector + sector_count);
+    if(TAIL_BUF_VALID && TAIL_BUF_SECTOR - start_sector < sector_count){
+        TAIL_BUF_VALID = false;
+    }
+    isacfs_lookup_guard guard;
+    for(u32 i = 0x0; i < FENCE_CACHE_SIZE; i++){
+        if(FENCE_CACHE[i].valid && FENCE_CACHE[i].sector - start_sector < sector_count){
+            FENCE_CACHE[i].valid = false;
+        }
+    }
+    return res;
+}
+
+/**
+ * @brief Erase the next metadata sectors ahead of CURR_WRITE_META (isacfs_layout_fixed, isacfs_layout_loop)
+ * @note As many sectors ahead as the descriptors of PREERASE_DISTANCE bytes of average frames take - an eighth of the
+ *       descriptor ring at most with isacfs_layout_loop, whose oldest descriptors in them are dropped first (the tail
+ *       moves past them). The sector 0 (the superblock) is never erased.
+ * @note A sector beyond the write head is never read back, only its missing trailer is - erased is the same as never written
+ * @returns ESP_ERR_NOT_FOUND if the sectors ahead are erased already
+*/
+esp_err_t __isacfs_preerase_meta(){
+    esp_err_t res = ESP_OK;
+    if(DATA_LAYOUT == isacfs_layout_converging){
+        return ESP_ERR_NOT_FOUND; // the descriptors grow into the gap that is erased from the data side
+    }
+    bool loop = DATA_LAYOUT == isacfs_layout_loop;
+    u32 ring_end = DATA_START_SECTOR;
+    u32 head = CURR_WRITE_META_SECTOR + 0x1;
+    if(loop && head >= ring_end){
+        head = 0x0;
+    }
+    u32 ahead = PREERASE_DISTANCE / AVG_FILE_SIZE / __isacfs_meta_slots_count(0x1) + 0x1;
+    if(loop && ahead > ring_end >> 0x3){
+        ahead = ring_end >> 0x3;
+    }
+    u32 span = PREERASE_META_SECTOR >= head ? PREERASE_META_SECTOR - head : PREERASE_META_SECTOR + ring_end - head;
+    if(!PREERASE_META_VALID || (loop ? span > ring_end >> 0x1 : PREERASE_META_SECTOR < head)){
+        PREERASE_META_SECTOR = head; // the write head went past the erased sectors
+        PREERASE_META_VALID = true;
+        span = 0x0;
+    }
+    if(span >= ahead || PREERASE_META_SECTOR >= ring_end){
+        return ESP_ERR_NOT_FOUND;
+    }
+    u32 start = PREERASE_META_SECTOR;
+    u32 end = start + (ahead - span < PREERASE_CHUNK_SECTORS ? ahead - span : PREERASE_CHUNK_SECTORS);
+    end = end < ring_end ? end : ring_end;
+    if(!start){
+        start = 0x1; // the superblock stays
+    }
+
+    if(loop){
+        /* the tail in the sectors (or in the sector of the head, beyond it - the log fills the ring) moves past them */
+        u32 next = end >= ring_end ? 0x0 : end;
+        u32 tail_dist = (TAIL_META_SECTOR + ring_end - CURR_WRITE_META_SECTOR) % ring_end;
+        u32 end_dist = (next + ring_end - CURR_WRITE_META_SECTOR) % ring_end;
+        bool full = TAIL_META_SECTOR == CURR_WRITE_META_SECTOR && TAIL_META_OFFSET > CURR_WRITE_META_OFFSET;
+        if(full || (tail_dist && tail_dist < end_dist)){
+            TAIL_META_SECTOR = next;
+            TAIL_META_OFFSET = __isacfs_meta_first_offset(next);
+            res = __isacfs_loop_store_tail();
+            if(res != ESP_OK){
+                return res;
+            }
+        }
+    }
+    if(end > start){
+        res = __isacfs_preerase_sectors(start, end - start);
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+    PREERASE_META_SECTOR = loop && end >= ring_end ? 0x0 : end;
+    return res;
+}
+
+/**
+ * @brief Erase the data sectors ahead of the data head up to the next PREERASE_CHUNK_SECTORS boundary
+ * @note The sector of the head is left alone - the newest frame ends (isacfs_layout_converging: starts) in it
+ * @note isacfs_layout_loop: the frames in the sectors are dropped first (see "__isacfs_loop_make_room"), a quarter of
+ *       the data ring is erased ahead at most; isacfs_layout_converging: down to the sector past CURR_WRITE_META
+ * @returns ESP_ERR_NOT_FOUND if PREERASE_DISTANCE bytes ahead are erased already, or the data region ends there
+*/
+esp_err_t __isacfs_preerase_data(){
+    esp_err_t res = ESP_OK;
+    u32 ahead = (u32)((((u64)PREERASE_DISTANCE) + SECTOR_SIZE - 0x1) >> OFFSET_ADDR_WIDTH);
+    u32 chunk = PREERASE_CHUNK_SECTORS;
+    u64 data_head = GC_ARENA ? GC_DATA_HEAD : ((u64)CURR_WRITE_DATA_SECTOR << OFFSET_ADDR_WIDTH) + CURR_WRITE_DATA_OFFSET; // past the staged files
+    if(DATA_LAYOUT == isacfs_layout_converging){
+        u32 head = data_head >> OFFSET_ADDR_WIDTH;
+        u32 bottom = CURR_WRITE_META_SECTOR + 0x1;
+        if(!PREERASE_DATA_VALID || PREERASE_DATA_SECTOR > head){
+            PREERASE_DATA_SECTOR = head;
+            PREERASE_DATA_VALID = true;
+        }
+        if(head - PREERASE_DATA_SECTOR >= ahead || PREERASE_DATA_SECTOR <= bottom){
+            return ESP_ERR_NOT_FOUND;
+        }
+        u32 n = PREERASE_DATA_SECTOR % chunk ? PREERASE_DATA_SECTOR % chunk : chunk;
+        n = n < PREERASE_DATA_SECTOR - bottom ? n : PREERASE_DATA_SECTOR - bottom;
+        res = __isacfs_preerase_sectors(PREERASE_DATA_SECTOR - n, n);
+        if(res == ESP_OK){
+            PREERASE_DATA_SECTOR -= n;
+        }
+        return res;
+    }
+
+    bool loop = DATA_LAYOUT == isacfs_layout_loop;
+    u32 ring = SECTOR_COUNT - DATA_START_SECTOR;
+    if(loop){
+        ahead = ahead < ring >> 0x2 ? ahead : ring >> 0x2;
+        chunk = chunk < ring >> 0x2 ? chunk : ring >> 0x2;
+    }
+    u32 head = (data_head + SECTOR_SIZE - 0x1) >> OFFSET_ADDR_WIDTH;
+    if(loop && head >= SECTOR_COUNT){
+        head = DATA_START_SECTOR;
+    }
+    u32 span = PREERASE_DATA_SECTOR >= head ? PREERASE_DATA_SECTOR - head : PREERASE_DATA_SECTOR + ring - head;
+    if(!PREERASE_DATA_VALID || (loop ? span > ring >> 0x1 : PREERASE_DATA_SECTOR < head)){
+        PREERASE_DATA_SECTOR = head; // the write head went past the erased sectors
+        PREERASE_DATA_VALID = true;
+        span = 0x0;
+    }
+    if(span >= ahead || PREERASE_DATA_SECTOR >= SECTOR_COUNT){
+        return ESP_ERR_NOT_FOUND;
+    }
+    u32 n = chunk - PREERASE_DATA_SECTOR % chunk;
+    n = n < SECTOR_COUNT - PREERASE_DATA_SECTOR ? n : SECTOR_COUNT - PREERASE_DATA_SECTOR;
+    if(loop){
+        u64 end = ((u64)PREERASE_DATA_SECTOR + n) << OFFSET_ADDR_WIDTH;
+        res = __isacfs_loop_make_room(data_head, (u32)__isacfs_data_span(data_head, end));
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+    res = __isacfs_preerase_sectors(PREERASE_DATA_SECTOR, n);
+    if(res != ESP_OK){
+        return res;
+    }
+    PREERASE_DATA_SECTOR += n;
+    if(loop && PREERASE_DATA_SECTOR >= SECTOR_COUNT){
+        PREERASE_DATA_SECTOR = DATA_START_SECTOR;
+    }
+    return res;
+}
+
+esp_err_t isacfs_preerase_config(u32 distance, u32 chunk){
+    if(!FS->pool){
+        return ESP_ERR_INVALID_STATE; // the card geometry is unknown
+    }
+    PREERASE_DISTANCE = distance;
+    PREERASE_CHUNK_SECTORS = (chunk ? chunk : PREERASE_DEFAULT_CHUNK) >> OFFSET_ADDR_WIDTH;
+    if(!PREERASE_CHUNK_SECTORS){
+        PREERASE_CHUNK_SECTORS = 0x1;
+    }
+    PREERASE_DATA_VALID = false;
+    PREERASE_META_VALID = false;
+    return ESP_OK;
+}
+
+esp_err_t isacfs_preerase_step(){
+    if(!PREERASE_DISTANCE){
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t res = __isacfs_preerase_meta();
+    if(res == ESP_ERR_NOT_FOUND){
+        res = __isacfs_preerase_data();
+    }
+    if(res == ESP_ERR_NOT_SUPPORTED){
+        PREERASE_DISTANCE = 0x0; // no erase command - zeroes written ahead would be writes over the old data too
+    }
+    return res;
+}
+
+/**
+ * @note "file_meta" is supposed to have sector=UNKNOWN_SECTOR, offset=UNKNOWN_OFFSET
+*/
+esp_err_t __isacfs_write_file(isacfs_file_meta* file_meta, isacfs_frame_src_t* src, u32 buf_sz){
+    esp_err_t res = ESP_OK;
+    if(GC_ARENA){
+        res = __isacfs_group_write(file_meta, src, buf_sz);
+    }
+    else {
+        u64 pos;
+        res = __isacfs_place_data(((u64)CURR_WRITE_DATA_SECTOR << OFFSET_ADDR_WIDTH) + CURR_WRITE_DATA_OFFSET, buf_sz, 0x0, &pos);
+        if(res != ESP_OK){
+            return res;
+        }
+        if(DATA_LAYOUT == isacfs_layout_loop){
+            res = __isacfs_loop_make_room(pos, buf_sz);
+            if(res != ESP_OK){
+                return res;
+            }
+        }
+
+        /* write file data into the sectors && update CURR_WRITE_DATA */
+        res = __isacfs_stream_data(src, 0x0, buf_sz);
+        if(res != ESP_OK){
+            return res;
+        }
+
+        //obtain the sectors for the file
+        file_meta->sector = pos >> OFFSET_ADDR_WIDTH;
+        file_meta->offset = pos - ((u64)file_meta->sector << OFFSET_ADDR_WIDTH);
+        res = __isacfs_log_file(file_meta);
+    }
+    if(res == ESP_OK){
+        AVG_FILE_SIZE = AVG_FILE_SIZE - (AVG_FILE_SIZE >> AVG_FILE_SIZE_EWMA_SHIFT) + (buf_sz >> AVG_FILE_SIZE_EWMA_SHIFT);
+    }
+    return res;
+}
+
+esp_err_t isacfs_write_file(isacfs_file_meta* file_meta, const u8* buffer, u32 buf_sz){
+    isacfs_iovec_t piece = { buffer, buf_sz };
+    return isacfs_write_filev(file_meta, &piece, 0x1);
+}
+
+/**
+ * @note The pieces are never copied as a whole - only the partial sectors, the sectors straddling two pieces and the
+ *       ones the driver can't DMA from are gathered (see "__isacfs_stream_sectors")
+*/
+esp_err_t isacfs_write_filev(isacfs_file_meta* file_meta, const isacfs_iovec_t* iov, u32 iov_count){
+    ISACFS_STATS_BEGIN(t0, CARD);
+    esp_err_t res = ESP_OK;
+    u64 size = 0x0;
+    for(u32 i = 0x0; i < iov_count; i++){
+        size += iov[i].len;
+    }
+    if(size > 0xFFFFFFFFULL){
+        res = ESP_ERR_INVALID_SIZE;
+    }
+    else {
+        isacfs_frame_src_t src = { iov, iov_count, 0x0, 0x0 };
+        res = __isacfs_write_file(file_meta, &src, (u32)size);
+    }
+    ISACFS_STATS_END(isacfs_op_write_file, t0, CARD, res == ESP_OK);
+    return res;
+}
+
+/**
+ * @brief Write all the pending descriptors (and the staged files) to the card
+*/
+esp_err_t isacfs_sync(){
+    if(GC_ARENA){
+        esp_err_t res = __isacfs_group_commit();
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+    return __isacfs_journal_flush();
+}
+
+u32 isacfs_avg_file_size(){
+    return AVG_FILE_SIZE;
+}
+
+/**
+ * @brief How many more frames fit, projected with the running average frame size
+ * @note Whichever region runs out first decides - both of them at once with isacfs_layout_converging
+ * @note isacfs_layout_loop never runs out (all ones)
+*/
+u64 isacfs_files_left(){
+    if(DATA_LAYOUT == isacfs_layout_loop){
+        return ~0x0ULL;
+    }
+    u64 data_pos = ((u64)CURR_WRITE_DATA_SECTOR << OFFSET_ADDR_WIDTH) + CURR_WRITE_DATA_OFFSET;
+    u64 meta_pos = ((u64)CURR_WRITE_META_SECTOR << OFFSET_ADDR_WIDTH) + CURR_WRITE_META_OFFSET;
+    u64 avg = AVG_FILE_SIZE ? AVG_FILE_SIZE : 0x1;
+    if(DATA_LAYOUT == isacfs_layout_converging){
+        u64 meta_end = ((u64)CURR_WRITE_META_SECTOR + 0x1) << OFFSET_ADDR_WIDTH;
+        if(data_pos <= meta_end){
+            return 0x0;
+        }
+        /* every frame takes "avg" bytes of data and 1 descriptor slot (plus the trailer share) of metadata */
+        u64 slots = __isacfs_meta_slots_count(0x1);
+        return (data_pos - meta_end) * slots / (avg * slots + SECTOR_SIZE);
+    }
+    u64 data_end = (u64)SECTOR_COUNT << OFFSET_ADDR_WIDTH;
+    u64 data_files = data_pos < data_end ? (data_end - data_pos) / avg : 0x0;
+    u64 meta_end = (u64)DATA_START_SECTOR << OFFSET_ADDR_WIDTH;
+    u64 meta_files = 0x0;
+    if(meta_pos < meta_end){
+        meta_files = (meta_end - meta_pos) >> DESC_SHIFT;
+        meta_files -= meta_files * META_TRAILER_SIZE / SECTOR_SIZE; // the trailers
+    }
+    return data_files < meta_files ? data_files : meta_files;
+}
+
+/**
+ * @brief Map a timestamp onto a monotonic millisecond count (months are taken as 31 days long)
+ * @note The millisecond counts with 16B descriptors only - 8B ones don't store it
+*/
+u64 __isacfs_meta_to_ms(const isacfs_file_meta* file_meta){
+    u64 t = file_meta->year_diff;
+    t = t * 12U + file_meta->month;
+    t = t * 31U + file_meta->day;
+    t = t * 24U + file_meta->hour;
+    t = t * 60U + file_meta->minute;
+    t = t * 60U + file_meta->second;
+    return t * 1000U + (DESC_SHIFT == ISACFS_DESC_16B_SHIFT ? file_meta->millisecond : 0x0);
+}
+
+/**
+ * @brief Get a metadata sector, from the journal if it mirrors it (pending descriptors are visible)
+*/
+esp_err_t __isacfs_read_meta_sector(u32 sector_no, u8* sector){
+    if(META_JOURNAL_VALID && META_JOURNAL_SECTOR == sector_no){
+        memcpy(sector, META_JOURNAL_BUF, SECTOR_SIZE);
+        return ESP_OK;
+    }
+    return micro_sd_read_sectors_on(CARD, sector, sector_no, 0x1);
+}
+
+/**
+ * @brief Number of the descriptor slots in "sector" that are written (the head sector is filled up to CURR_WRITE_META)
+*/
+u32 __isacfs_meta_slots_written(u32 sector){
+    if(sector != CURR_WRITE_META_SECTOR){
+        return __isacfs_meta_slots_count(sector);
+    }
+    return (CURR_WRITE_META_OFFSET - __isacfs_meta_first_offset(sector)) >> DESC_SHIFT;
+}
+
+/**
+ * @brief Locate the searchable part of the descriptor log in whole metadata sectors
+ * @note isacfs_layout_loop: the live frames are [TAIL_META, CURR_WRITE_META); the other layouts stop when full, so
+ *       their log never wraps and is [0, CURR_WRITE_META)
+ * @param[out] first_sector oldest metadata sector
+ * @param[out] first_offset oldest descriptor in it
+ * @param[out] sectors_count number of metadata sectors holding descriptors, in write order
+*/
+esp_err_t __isacfs_search_window(u32* first_sector, u32* first_offset, u32* sectors_count){
+    isacfs_lookup_guard guard;
+    u32 head_sectors = CURR_WRITE_META_SECTOR + (__isacfs_meta_slots_written(CURR_WRITE_META_SECTOR) ? 0x1 : 0x0);
+    if(DATA_LAYOUT == isacfs_layout_loop){
+        u32 ring_end = __isacfs_meta_ring_end();
+        *first_sector = TAIL_META_SECTOR;
+        *first_offset = TAIL_META_OFFSET;
+        *sectors_count = 0x0;
+        if(!(TAIL_META_SECTOR == CURR_WRITE_META_SECTOR && TAIL_META_OFFSET == CURR_WRITE_META_OFFSET)){
+            *sectors_count = (head_sectors + ring_end - TAIL_META_SECTOR) % ring_end;
+            if(!*sectors_count){
+                *sectors_count = ring_end; // the live descriptors span the whole ring
+            }
+        }
+        return ESP_OK;
+    }
+    *first_sector = 0x0;
+    *first_offset = META_START_OFFSET;
+    *sectors_count = head_sectors;
+    return ESP_OK;
+}
+
+/**
+ * @brief Meta location of the oldest file in the log (the loop tail with isacfs_layout_loop)
+*/
+esp_err_t isacfs_oldest_meta(u32* meta_sector, u32* meta_offset){
+    u32 sectors_count;
+    esp_err_t res = __isacfs_search_window(meta_sector, meta_offset, &sectors_count);
+    if(res == ESP_OK && !sectors_count){
+        return ESP_ERR_NOT_FOUND;
+    }
+    return res;
+}
+
+/**
+ * @brief Meta location the next descriptor goes to (CURR_WRITE_META, one past the newest file)
+*/
+void isacfs_head_meta(u32* meta_sector, u32* meta_offset){
+    *meta_sector = CURR_WRITE_META_SECTOR;
+    *meta_offset = CURR_WRITE_META_OFFSET;
+}
+
+/**
+ * @brief Index of the descriptor slot at a meta location, counted from META_START_OFFSET of the sector 0
+*/
+u64 __isacfs_meta_slot_index(u32 sector, u32 offset){
+    if(!sector){
+        return (offset - META_START_OFFSET) >> DESC_SHIFT;
+    }
+    return __isacfs_meta_slots_count(0x0) + (u64)(sector - 0x1) * __isacfs_meta_slots_count(0x1) + (offset >> DESC_SHIFT);
+}
+
+/**
+ * @brief Meta location of the descriptor slot "slot" (inverse of "__isacfs_meta_slot_index")
+*/
+void __isacfs_meta_slot_loc(u64 slot, u32* sector, u32* offset){
+    u32 first_slots = __isacfs_meta_slots_count(0x0);
+    if(slot < first_slots){
+        *sector = 0x0;
+        *offset = META_START_OFFSET + ((u32)slot << DESC_SHIFT);
+        return;
+    }
+    slot -= first_slots;
+    u32 slots = __isacfs_meta_slots_count(0x1);
+    *sector = 0x1 + (u32)(slot / slots);
+    *offset = (u32)(slot % slots) << DESC_SHIFT;
+}
+
+/**
+ * @brief Meta location of the frame number "sequence" (isacfs_desc_16B)
+ * @note Every descriptor takes the next slot of the log, so the frame n is in the slot n (modulo the descriptor ring) -
+ *       it is there if it is not older than the live descriptors, which the sequence number in the slot confirms
+*/
+esp_err_t isacfs_seek_sequence(u32 sequence, u32* meta_sector, u32* meta_offset){
+    isacfs_lookup_guard guard;
+    if(DESC_SHIFT != ISACFS_DESC_16B_SHIFT){
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if(sequence >= NEXT_SEQUENCE){
+        return ESP_ERR_NOT_FOUND;
+    }
+    u64 ring_slots = __isacfs_meta_slot_index(__isacfs_meta_ring_end(), 0x0);
+    u64 live = ring_slots;
+    if(DATA_LAYOUT == isacfs_layout_loop){
+        live = (__isacfs_meta_slot_index(CURR_WRITE_META_SECTOR, CURR_WRITE_META_OFFSET) + ring_slots
+                - __isacfs_meta_slot_index(TAIL_META_SECTOR, TAIL_META_OFFSET)) % ring_slots;
+    }
+    if(NEXT_SEQUENCE - sequence > live){
+        return ESP_ERR_NOT_FOUND; // dropped, its slot went to a newer frame
+    }
+    u32 sector_no;
+    u32 offset;
+    __isacfs_meta_slot_loc(sequence % ring_slots, &sector_no, &offset);
+    u8* sector = READ_SECTOR_BUF;
+    esp_err_t res = __isacfs_read_meta_sector(sector_no, sector);
+    if(res != ESP_OK){
+        return res;
+    }
+    if(__isacfs_desc_sequence(sector + offset) != sequence){
+        return ESP_ERR_NOT_FOUND;
+    }
+    *meta_sector = sector_no;
+    *meta_offset = offset;
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the first timestamp of a metadata sector, through the fence cache
+*/
+esp_err_t __isacfs_fence(u32 sector_no, u64* first_ts){
+    isacfs_fence_t* fence = FENCE_CACHE + (sector_no % FENCE_CACHE_SIZE);
+    if(fence->valid && fence->sector == sector_no && sector_no != CURR_WRITE_META_SECTOR){
+        *first_ts = fence->first_ts;
+        return ESP_OK;
+    }
+    u8* sector = READ_SECTOR_BUF;
+    esp_err_t res = __isacfs_read_meta_sector(sector_no, sector);
+    if(res != ESP_OK){
+        return res;
+    }
+    isacfs_file_meta file_meta;
+    __isacfs_decode_desc(sector + __isacfs_meta_first_offset(sector_no), &file_meta);
+    *first_ts = __isacfs_meta_to_ms(&file_meta);
+    fence->sector = sector_no;
+    fence->first_ts = *first_ts;
+    fence->valid = true;
+    return ESP_OK;
+}
+
+/**
+ * @brief Find the first descriptor with a timestamp not older than the one of "key"
+ * @note Interpolation search over the first timestamps of the metadata sectors, falling back to bisection
+ *       whenever a probe doesn't halve the range. Then a single metadata sector is scanned.
+ * @param[out] meta_sector
+ * @param[out] meta_offset
+ * @returns ESP_ERR_NOT_FOUND if all the descriptors are older than "key"
+*/
+esp_err_t isacfs_find_meta(const isacfs_file_meta* key, u32* meta_sector, u32* meta_offset){
+    isacfs_lookup_guard guard;
+    u32 first_sector;
+    u32 oldest_offset;
+    u32 sectors_count;
+    esp_err_t res = __isacfs_search_window(&first_sector, &oldest_offset, &sectors_count);
+    if(res != ESP_OK){
+        return res;
+    }
+    if(!sectors_count){
+        return ESP_ERR_NOT_FOUND;
+    }
+    u64 key_ts = __isacfs_meta_to_ms(key);
+
+    // invariant: fence(lo) < key_ts <= fence(hi), where hi == sectors_count stands for +inf
+    u32 lo = 0x0;
+    u32 hi = sectors_count;
+    u64 lo_ts;
+    u64 hi_ts = 0x0;
+    bool hi_known = false;
+    res = __isacfs_fence(first_sector, &lo_ts);
+    if(res != ESP_OK){
+        return res;
+    }
+    if(key_ts <= lo_ts){
+        *meta_sector = first_sector;
+        *meta_offset = oldest_offset;
+        return ESP_OK;
+    }
+    bool bisect = false;
+    while(hi - lo > 0x1){
+        u32 probe = lo + ((hi - lo) >> 0x1);
+        if(!bisect && hi_known && hi_ts > lo_ts){
+            u64 step = (u64)(hi - lo) * (key_ts - lo_ts) / (hi_ts - lo_ts);
+            probe = lo + (u32)step;
+            if(probe <= lo){
+                probe = lo + 0x1;
+            }
+            else if(probe >= hi){
+                probe = hi - 0x1;
+            }
+        }
+        u32 range = hi - lo;
+        u64 probe_ts;
+        u32 probe_sector = first_sector + probe;
+        if(probe_sector >= __isacfs_meta_ring_end()){
+            probe_sector -= __isacfs_meta_ring_end();
+        }
+        res = __isacfs_fence(probe_sector, &probe_ts);
+        if(res != ESP_OK){
+            return res;
+        }
+        if(probe_ts < key_ts){
+            lo = probe;
+            lo_ts = probe_ts;
+        }
+        else {
+            hi = probe;
+            hi_ts = probe_ts;
+            hi_known = true;
+        }
+        bisect = (hi - lo) > (range >> 0x1); // the interpolation didn't pay off
+    }
+
+    // the first descriptor >= key is in the sector "lo" or is the first one of the sector "hi"
+    u32 sector_no = first_sector + lo;
+    if(sector_no >= __isacfs_meta_ring_end()){
+        sector_no -= __isacfs_meta_ring_end();
+    }
+    u8* sector = READ_SECTOR_BUF;
+    res = __isacfs_read_meta_sector(sector_no, sector);
+    if(res != ESP_OK){
+        return res;
+    }
+    u32 first_offset = __isacfs_meta_first_offset(sector_no);
+    u32 slots = __isacfs_meta_slots_written(sector_no);
+    u64 key_packed = isacfs_pack_timestamp(key);
+    if(DESC_SHIFT != ISACFS_DESC_16B_SHIFT){
+        key_packed &= ~(u64)((0x1U << ISACFS_MS_BITS) - 0x1); // whole seconds
+    }
+    ENGINE->decode_descs(sector + first_offset, slots, DESC_SHIFT, NULL, NULL, READ_TIMESTAMPS_BUF);
+    for(u32 i = 0x1; i < slots; i++){
+        if(READ_TIMESTAMPS_BUF[i] >= key_packed){
+            *meta_sector = sector_no;
+            *meta_offset = first_offset + (i << DESC_SHIFT);
+            if(!lo && *meta_offset < oldest_offset){
+                *meta_offset = oldest_offset; // the descriptors before the loop tail are dropped
+            }
+            return ESP_OK;
+        }
+    }
+    if(hi == sectors_count){
+        return ESP_ERR_NOT_FOUND;
+    }
+    *meta_sector = sector_no + 0x1 >= __isacfs_meta_ring_end() ? 0x0 : sector_no + 0x1;
+    *meta_offset = __isacfs_meta_first_offset(*meta_sector);
+    return ESP_OK;
+}
+
+/**
+ * @brief Fills "file_meta" with the sector & offset info
+ * @note obtains sector, offset, size in the isacfs_file_meta structure (the size comes from the next descriptor)
+ * @param[in] file_meta known file info (the timestamp is the search key if the meta location is unknown)
+ * @param[out] discovered_size discovered file content size (optional)
+ * @param meta_sector in or out depending if it is known or not (UNKNOWN_SECTOR&UNKNOWN_OFFSET/NULL - search by the timestamp)
+ * @param meta_offset in or out depending if it is known or not
+*/
+esp_err_t __isacfs_file_desc(isacfs_file_meta* file_meta, u32* discovered_size, u32* meta_sector, u32* meta_offset){
+    isacfs_lookup_guard guard;
+    esp_err_t res = ESP_OK;
+    u32 found_sector;
+    u32 found_offset;
+    if(meta_sector && meta_offset && !(*meta_sector == UNKNOWN_SECTOR && *meta_offset == UNKNOWN_OFFSET)){
+        found_sector = *meta_sector;
+        found_offset = *meta_offset;
+    }
+    else { // search the meta sector&offset using quick search on datetime stamps
+        res = isacfs_find_meta(file_meta, &found_sector, &found_offset);
+        if(res != ESP_OK){
+            return res;
+        }
+        if(meta_sector && meta_offset){
+            *meta_sector = found_sector;
+            *meta_offset = found_offset;
+        }
+    }
+
+    u8* sector = READ_SECTOR_BUF;
+    res = __isacfs_read_meta_sector(found_sector, sector);
+    if(res != ESP_OK){
+        return res;
+    }
+    __isacfs_decode_desc(sector + found_offset, file_meta);
+
+    /* the file ends where the next one starts (where the previous one starts when the frames grow down) */
+    u32 next_sector = found_sector;
+    u32 next_offset = found_offset;
+    isacfs_file_meta next_meta;
+    if(DATA_LAYOUT == isacfs_layout_converging){
+        __isacfs_retreat_meta_loc(&next_sector, &next_offset);
+    }
+    else {
+        __isacfs_advance_meta_loc(&next_sector, &next_offset);
+    }
+    if(DATA_LAYOUT == isacfs_layout_converging && found_sector == 0x0 && found_offset == META_START_OFFSET){
+        __isacfs_data_origin(&next_meta.sector, &next_meta.offset);
+    }
+    else if(next_sector == CURR_WRITE_META_SECTOR && next_offset == CURR_WRITE_META_OFFSET){
+        next_meta.sector = CURR_WRITE_DATA_SECTOR;
+        next_meta.offset = CURR_WRITE_DATA_OFFSET;
+    }
+    else {
+        if(next_sector != found_sector){
+            res = __isacfs_read_meta_sector(next_sector, sector);
+            if(res != ESP_OK){
+                return res;
+            }
+        }
+        ENGINE->decode_desc(sector + next_offset, &next_meta);
+    }
+    file_meta->size = __isacfs_data_span((((u64)file_meta->sector) << OFFSET_ADDR_WIDTH) + file_meta->offset, (((u64)next_meta.sector) << OFFSET_ADDR_WIDTH) + next_meta.offset);
+    if(discovered_size){
+        *discovered_size = file_meta->size;
+    }
+    return res;
+}
+
+esp_err_t isacfs_file_desc(isacfs_file_meta* file_meta, u32* discovered_size, u32* meta_sector, u32* meta_offset){
+    ISACFS_STATS_BEGIN(t0, CARD);
+    esp_err_t res = __isacfs_file_desc(file_meta, discovered_size, meta_sector, meta_offset);
+    ISACFS_STATS_END(isacfs_op_file_desc, t0, CARD, res == ESP_OK);
+    return res;
+}
+
+/**
+ * @brief updates the meta sector&offset to enable reading the next file
+*/
+void isacfs_next_meta(u32* sector, u32* offset){
+    __isacfs_advance_meta_loc(sector, offset);
+}
+
+/**
+ * @brief updates the meta sector&offset to enable reading the previous file
+*/
+void isacfs_prev_meta(u32* sector, u32* offset){
+    __isacfs_retreat_meta_loc(sector, offset);
+}
+
+/**
+ * Read the file based on the sector, offset and size data obtained using the "isacfs_file_desc" function
+ * @note Sector-aligned data goes straight into "out_buffer" in a single multi-block transfer,
+ *       only the partial head and tail sectors go through a bounce buffer
+ * @note isacfs_layout_loop: the sectors past the end of the card are the ones from DATA_START on
+ * @param offset position within the file
+ * @param length number of bytes to read
+*/
+esp_err_t __isacfs_read_file(const isacfs_file_meta& file_meta, void* out_buffer, u32 offset, u32 length){
+    isacfs_lookup_guard guard;
+    esp_err_t res = ESP_OK;
+    if((u64)offset + length > file_meta.size){
+        return ESP_ERR_INVALID_SIZE;
+    }
+    u8* out = (u8*)out_buffer;
+    u64 pos = ((u64)file_meta.sector << OFFSET_ADDR_WIDTH) + file_meta.offset + offset;
+    u32 sector_no = pos >> OFFSET_ADDR_WIDTH;
+    u32 sector_offset = pos - ((u64)sector_no << OFFSET_ADDR_WIDTH);
+    u8* sector = READ_SECTOR_BUF;
+
+    // partial head sector
+    if(sector_offset && length){
+        u32 head_sz = SECTOR_SIZE - sector_offset < length ? SECTOR_SIZE - sector_offset : length;
+        res = __isacfs_read_data_sector(__isacfs_wrap_data_sector(sector_no), sector);
+        if(res != ESP_OK){
+            return res;
+        }
+        memcpy(out, sector + sector_offset, head_sz);
+        out += head_sz;
+        length -= head_sz;
+        sector_no++;
+    }
+
+    // sector-aligned middle, zero-copy if the driver can DMA into "out_buffer"
+    u32 num_full_sectors = length >> OFFSET_ADDR_WIDTH;
+    if(num_full_sectors){
+        res = __isacfs_read_data_sectors(out, sector_no, num_full_sectors);
+        if(res != ESP_OK){
+            return res;
+        }
+        out += num_full_sectors << OFFSET_ADDR_WIDTH;
+        length -= num_full_sectors << OFFSET_ADDR_WIDTH;
+        sector_no += num_full_sectors;
+    }
+
+    // partial tail sector
+    if(length){
+        res = __isacfs_read_data_sector(__isacfs_wrap_data_sector(sector_no), sector);
+        if(res != ESP_OK){
+            return res;
+        }
+        memcpy(out, sector, length);
+    }
+    return res;
+}
+
+esp_err_t isacfs_read_file(isacfs_file_meta file_meta, void* out_buffer, u32 offset, u32 length){
+    ISACFS_STATS_BEGIN(t0, CARD);
+    esp_err_t res = __isacfs_read_file(file_meta, out_buffer, offset, length);
+    ISACFS_STATS_END(isacfs_op_read_file, t0, CARD, res == ESP_OK);
+    return res;
+}
+
+/**
+ * @brief Byte addresses on the card of the data of a file (obtained using the "isacfs_file_desc" function)
+ * @note isacfs_layout_loop: a file reaching past the end of the card goes on at DATA_START - 2 runs
+ * @returns number of the runs
+*/
+u32 isacfs_file_extents(const isacfs_file_meta* file_meta, u64* pos, u32* len){
+    pos[0x0] = ((u64)file_meta->sector << OFFSET_ADDR_WIDTH) + file_meta->offset;
+    len[0x0] = file_meta->size;
+    u64 card_end = (u64)SECTOR_COUNT << OFFSET_ADDR_WIDTH;
+    if(DATA_LAYOUT != isacfs_layout_loop || pos[0x0] + file_meta->size <= card_end){
+        return 0x1;
+    }
+    len[0x0] = card_end - pos[0x0];
+    pos[0x1] = (u64)DATA_START_SECTOR << OFFSET_ADDR_WIDTH;
+    len[0x1] = file_meta->size - len[0x0];
+    return 0x2;
+}
+
+/* time-range read (frames gathered into runs, each run read in a single multi-block transfer) */
+typedef struct {
+    u8* buffer;
+    u32 buffer_sectors;
+    isacfs_range_cb_t cb;
+    void* user;
+    isacfs_file_meta* frames;
+    u32 count;
+    u32 first_sector; // sectors of the run [first_sector, end_sector)
+    u32 end_sector;
+    bool stop; // the callback had enough
+    u64 origin; // isacfs_layout_loop: start of the first frame - the frames before the end of the card lie below it
+    u64 ring; // size of the data ring (0 - no wrapping)
+} isacfs_range_t;
+
+/**
+ * @brief Byte address of the frame data, counted on past the end of the card once the range wrapped
+*/
+static u64 __isacfs_range_pos(const isacfs_range_t* range, const isacfs_file_meta* file_meta){
+    u64 pos = ((u64)file_meta->sector << OFFSET_ADDR_WIDTH) + file_meta->offset;
+    return pos < range->origin ? pos + range->ring : pos;
+}
+
+/**
+ * @brief Read the sectors of the run at once && hand its frames out as views into the buffer
+*/
+static esp_err_t __isacfs_range_flush(isacfs_range_t* range){
+    esp_err_t res = ESP_OK;
+    if(!range->count){
+        return res;
+    }
+    if(range->end_sector > range->first_sector){
+        res = __isacfs_read_data_sectors(range->buffer, range->first_sector, range->end_sector - range->first_sector);
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+    u64 run_pos = (u64)range->first_sector << OFFSET_ADDR_WIDTH;
+    for(u32 i = 0x0; i < range->count && !range->stop; i++){
+        const isacfs_file_meta* file_meta = range->frames + i;
+        u64 pos = __isacfs_range_pos(range, file_meta);
+        range->stop = !range->cb(file_meta, file_meta->size ? range->buffer + (pos - run_pos) : NULL, file_meta->size, range->user);
+    }
+    range->count = 0x0;
+    return res;
+}
+
+/**
+ * @brief Add a frame (its size known) to the run, reading the run first if the frame doesn't fit into the buffer along with it
+ * @note A frame bigger than the whole buffer is handed out on its own with no data
+*/
+static esp_err_t __isacfs_range_add(isacfs_range_t* range, const isacfs_file_meta* file_meta){
+    esp_err_t res = ESP_OK;
+    u64 pos = __isacfs_range_pos(range, file_meta);
+    u32 first_sector = pos >> OFFSET_ADDR_WIDTH;
+    u32 end_sector = file_meta->size ? ((pos + file_meta->size - 0x1) >> OFFSET_ADDR_WIDTH) + 0x1 : first_sector;
+    if(end_sector - first_sector > range->buffer_sectors){
+        res = __isacfs_range_flush(range);
+        if(res == ESP_OK && !range->stop){
+            range->stop = !range->cb(file_meta, NULL, file_meta->size, range->user);
+        }
+        return res;
+    }
+    if(range->count && end_sector > first_sector && range->end_sector > range->first_sector){
+        u32 run_first = first_sector < range->first_sector ? first_sector : range->first_sector;
+        u32 run_end = end_sector > range->end_sector ? end_sector : range->end_sector;
+        if(run_end - run_first > range->buffer_sectors || range->count >= RANGE_MAX_FRAMES){
+            res = __isacfs_range_flush(range);
+            if(res != ESP_OK){
+                return res;
+            }
+        }
+    }
+    if(range->stop){
+        return res;
+    }
+    if(end_sector > first_sector){
+        if(!range->count || range->end_sector <= range->first_sector){
+            range->first_sector = first_sector;
+            range->end_sector = end_sector;
+        }
+        else {
+            range->first_sector = first_sector < range->first_sector ? first_sector : range->first_sector;
+            range->end_sector = end_sector > range->end_sector ? end_sector : range->end_sector;
+        }
+    }
+    else if(!range->count){
+        range->end_sector = range->first_sector; // nothing to read yet
+    }
+    range->frames[range->count++] = *file_meta;
+    return res;
+}
+
+/**
+ * @brief Hand out every frame with a timestamp in [t_begin, t_end] in the recording order
+ * @note The frames of a time range are a contiguous run of descriptors and a contiguous run of data sectors:
+ *       the descriptors are walked one metadata sector at a time (decoded as a whole), the data goes into "buffer"
+ *       in multi-block reads as big as the buffer and the frames are handed out as views into it
+*/
+esp_err_t isacfs_read_range(const isacfs_file_meta* t_begin, const isacfs_file_meta* t_end, u8* buffer, u32 buffer_size, isacfs_range_cb_t cb, void* user){
+    u32 meta_sector;
+    u32 meta_offset;
+    esp_err_t res = isacfs_find_meta(t_begin, &meta_sector, &meta_offset);
+    if(res != ESP_OK){
+        return res;
+    }
+    u64 end_ts = isacfs_pack_timestamp(t_end);
+    bool down = DATA_LAYOUT == isacfs_layout_converging;
+
+    /* frames grow down: a frame ends where the one before it starts */
+    u64 prev_start = 0x0;
+    if(down){
+        isacfs_file_meta first;
+        u32 first_sector = meta_sector;
+        u32 first_offset = meta_offset;
+        res = __isacfs_file_desc(&first, NULL, &first_sector, &first_offset);
+        if(res != ESP_OK){
+            return res;
+        }
+        prev_start = ((u64)first.sector << OFFSET_ADDR_WIDTH) + first.offset + first.size;
+    }
+
+    isacfs_range_t range;
+    range.buffer = buffer;
+    range.buffer_sectors = buffer_size >> OFFSET_ADDR_WIDTH;
+    range.cb = cb;
+    range.user = user;
+    range.count = 0x0;
+    range.first_sector = 0x0;
+    range.end_sector = 0x0;
+    range.stop = false;
+    range.origin = 0x0;
+    range.ring = DATA_LAYOUT == isacfs_layout_loop ? __isacfs_loop_ring_bytes() : 0x0;
+    u32 slots = SECTOR_SIZE >> 0x3;
+    range.frames = (isacfs_file_meta*)malloc(RANGE_MAX_FRAMES * sizeof(isacfs_file_meta));
+    u32* desc_sector = (u32*)malloc(slots * sizeof(u32));
+    u32* desc_offset = (u32*)malloc(slots * sizeof(u32));
+    u64* desc_timestamp = (u64*)malloc(slots * sizeof(u64));
+    u32* desc_sequence = (u32*)malloc(slots * sizeof(u32));
+    u8* sector = (u8*)isacfs_dma_alloc(SECTOR_SIZE); // not READ_SECTOR_BUF - the callback may search or read the instance
+    if(!range.frames || !desc_sector || !desc_offset || !desc_timestamp || !desc_sequence || !sector){
+        free(range.frames);
+        free(desc_sector);
+        free(desc_offset);
+        free(desc_timestamp);
+        free(desc_sequence);
+        isacfs_dma_free(sector);
+        return ESP_ERR_NO_MEM;
+    }
+
+    bool loaded = false;
+    u32 loaded_sector = 0x0;
+    bool found = false;
+    bool pending = false; // a frame waiting for the start of the next one (its end)
+    isacfs_file_meta file_meta;
+    while(!range.stop){
+        bool at_head = meta_sector == CURR_WRITE_META_SECTOR && meta_offset == CURR_WRITE_META_OFFSET;
+        isacfs_file_meta next_meta;
+        u64 next_start = ((u64)CURR_WRITE_DATA_SECTOR << OFFSET_ADDR_WIDTH) + CURR_WRITE_DATA_OFFSET;
+        bool in_range = false;
+        if(!at_head){
+            if(!loaded || loaded_sector != meta_sector || meta_sector == CURR_WRITE_META_SECTOR){ // the head sector grows meanwhile
+                res = __isacfs_read_meta_sector(meta_sector, sector);
+                if(res != ESP_OK){
+                    break;
+                }
+                ENGINE->decode_descs(sector + __isacfs_meta_first_offset(meta_sector), __isacfs_meta_slots_count(meta_sector), DESC_SHIFT,
+                                     desc_sector, desc_offset, desc_timestamp);
+                for(u32 i = 0x0; i < __isacfs_meta_slots_count(meta_sector); i++){
+                    desc_sequence[i] = DESC_SHIFT == ISACFS_DESC_16B_SHIFT
+                                       ? __isacfs_desc_sequence(sector + __isacfs_meta_first_offset(meta_sector) + (i << DESC_SHIFT)) : 0x0;
+                }
+                loaded = true;
+                loaded_sector = meta_sector;
+            }
+            u32 i = (meta_offset - __isacfs_meta_first_offset(meta_sector)) >> DESC_SHIFT;
+            next_meta.sector = desc_sector[i];
+            next_meta.offset = desc_offset[i];
+            isacfs_unpack_timestamp(desc_timestamp[i], &next_meta);
+            next_meta.sequence = desc_sequence[i];
+            next_start = ((u64)next_meta.sector << OFFSET_ADDR_WIDTH) + next_meta.offset;
+            in_range = desc_timestamp[i] <= end_ts;
+        }
+        if(pending){
+            file_meta.size = __isacfs_data_span(((u64)file_meta.sector << OFFSET_ADDR_WIDTH) + file_meta.offset, next_start);
+            res = __isacfs_range_add(&range, &file_meta);
+            if(res != ESP_OK){
+                break;
+            }
+            pending = false;
+        }
+        if(!in_range){
+            break;
+        }
+        if(!found){
+            range.origin = next_start;
+        }
+        found = true;
+        if(down){
+            next_meta.size = prev_start - next_start;
+            prev_start = next_start;
+            res = __isacfs_range_add(&range, &next_meta);
+            if(res != ESP_OK){
+                break;
+            }
+        }
+        else {
+            file_meta = next_meta;
+            pending = true;
+        }
+        __isacfs_advance_meta_loc(&meta_sector, &meta_offset);
+    }
+    if(res == ESP_OK && !range.stop){
+        res = __isacfs_range_flush(&range);
+    }
+    free(range.frames);
+    free(desc_sector);
+    free(desc_offset);
+    free(desc_timestamp);
+    free(desc_sequence);
+    isacfs_dma_free(sector);
+    if(res == ESP_OK && !found){
+        return ESP_ERR_NOT_FOUND;
+    }
+    return res;
+}
+
+/* playback iterator */
+struct isacfs_iter {
+    isacfs_t* fs; // the instance bound when it was opened
+    bool forward;
+    bool done;
+    u32 meta_sector; // descriptor of the file handed out next
+    u32 meta_offset;
+    u32 oldest_meta_sector; // where the backward iteration ends
+    u32 oldest_meta_offset;
+    bool prev_start_valid; // start of the file handed out before (the end of the current one when going backward)
+    u32 prev_start_sector;
+    u32 prev_start_offset;
+
+    /* 2 metadata sectors, decoded as a whole */
+    u8* meta_buf[2];
+    u32* desc_sector[2]; // struct of arrays
+    u32* desc_offset[2];
+    u64* desc_timestamp[2];
+    u32 meta_buf_sector[2];
+    bool meta_buf_valid[2];
+    bool meta_buf_pending[2];
+    u8 meta_buf_last; // the most recently used one
+    bool meta_primed; // the metadata sector ahead has been requested at least once
+
+    /* 2 frame buffers - the one handed out && the one being prefetched */
+    u8* data_buf[2];
+    u32 data_cap_sectors;
+    u8 data_front;
+    bool data_back_valid;
+    u32 data_back_meta_sector;
+    u32 data_back_meta_offset;
+
+    /* prefetch worker */
+    isacfs_task_t* task;
+    isacfs_event_t* req_ready;
+    isacfs_event_t* req_done;
+    bool busy;
+    bool stop;
+    u32 req_meta_sector;
+    u8 req_meta_slot; // 0xFF - no metadata sector to read
+    u32 req_data_sector;
+    u32 req_data_count; // 0 - no frame to read
+    esp_err_t req_meta_res;
+    esp_err_t req_data_res;
+};
+
+static void __isacfs_iter_worker(void* param){
+    isacfs_iter_t* it = (isacfs_iter_t*)param;
+    while(true){
+        isacfs_event_take(it->req_ready, ISACFS_WAIT_FOREVER);
+        if(it->stop){
+            break;
+        }
+        if(it->req_meta_slot != 0xFF){
+            it->req_meta_res = micro_sd_read_sectors_on(it->fs->card, it->meta_buf[it->req_meta_slot], it->req_meta_sector, 0x1);
+        }
+        if(it->req_data_count){
+            it->req_data_res = micro_sd_read_sectors_on(it->fs->card, it->data_buf[it->data_front ^ 0x1], it->req_data_sector, it->req_data_count);
+        }
+        isacfs_event_give(it->req_done);
+    }
+}
+
+/**
+ * @brief Decode all the descriptors of the metadata sector in "slot" at once
+*/
+static void __isacfs_iter_decode(isacfs_iter_t* it, u8 slot){
+    u32 sector_no = it->meta_buf_sector[slot];
+    ENGINE->decode_descs(it->meta_buf[slot] + __isacfs_meta_first_offset(sector_no), __isacfs_meta_slots_count(sector_no), DESC_SHIFT,
+                         it->desc_sector[slot], it->desc_offset[slot], it->desc_timestamp[slot]);
+    it->meta_buf_valid[slot] = true;
+}
+
+/**
+ * @brief Get a decoded descriptor of the metadata sector in "slot"
+*/
+static void __isacfs_iter_get(isacfs_iter_t* it, u8 slot, u32 offset, isacfs_file_meta* file_meta){
+    u32 i = (offset - __isacfs_meta_first_offset(it->meta_buf_sector[slot])) >> DESC_SHIFT;
+    file_meta->sector = it->desc_sector[slot][i];
+    file_meta->offset = it->desc_offset[slot][i];
+    isacfs_unpack_timestamp(it->desc_timestamp[slot][i], file_meta);
+    file_meta->sequence = DESC_SHIFT == ISACFS_DESC_16B_SHIFT ? __isacfs_desc_sequence(it->meta_buf[slot] + offset) : 0x0;
+}
+
+/**
+ * @brief Wait for the prefetch in flight and take over its results
+*/
+static void __isacfs_iter_settle(isacfs_iter_t* it){
+    if(!it->busy){
+        return;
+    }
+    isacfs_event_take(it->req_done, ISACFS_WAIT_FOREVER);
+    it->busy = false;
+    if(it->req_meta_slot != 0xFF){
+        u8 slot = it->req_meta_slot;
+        it->meta_buf_pending[slot] = false;
+        if(it->req_meta_res == ESP_OK){
+            __isacfs_iter_decode(it, slot);
+        }
+    }
+    if(it->req_data_count && it->req_data_res != ESP_OK){
+        it->data_back_valid = false;
+    }
+}
+
+/**
+ * @brief Load a metadata sector into "slot" and decode all of its descriptors
+*/
+static esp_err_t __isacfs_iter_load_meta(isacfs_iter_t* it, u8 slot, u32 sector_no){
+    it->meta_buf_valid[slot] = false;
+    esp_err_t res = __isacfs_read_meta_sector(sector_no, it->meta_buf[slot]);
+    if(res != ESP_OK){
+        return res;
+    }
+    it->meta_buf_sector[slot] = sector_no;
+    __isacfs_iter_decode(it, slot);
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the decoded descriptor at the meta location
+ * @note The sector the journal mirrors is always taken afresh (it grows while recording goes on)
+*/
+static esp_err_t __isacfs_iter_desc(isacfs_iter_t* it, u32 sector_no, u32 offset, isacfs_file_meta* file_meta){
+    bool journaled = META_JOURNAL_VALID && META_JOURNAL_SECTOR == sector_no;
+    for(u8 slot = 0x0; slot < 0x2; slot++){
+        if(it->meta_buf_sector[slot] != sector_no || !(it->meta_buf_valid[slot] || it->meta_buf_pending[slot])){
+            continue;
+        }
+        if(it->meta_buf_pending[slot]){
+            __isacfs_iter_settle(it);
+            if(!it->meta_buf_valid[slot]){
+                break;
+            }
+        }
+        if(journaled){
+            break;
+        }
+        it->meta_buf_last = slot;
+        __isacfs_iter_get(it, slot, offset, file_meta);
+        return ESP_OK;
+    }
+    __isacfs_iter_settle(it);
+    u8 slot = it->meta_buf_last ^ 0x1;
+    if(it->meta_buf_valid[slot ^ 0x1] && it->meta_buf_sector[slot ^ 0x1] == sector_no){
+        slot ^= 0x1; // reload the journaled sector in place
+    }
+    esp_err_t res = __isacfs_iter_load_meta(it, slot, sector_no);
+    if(res != ESP_OK){
+        return res;
+    }
+    it->meta_buf_last = slot;
+    __isacfs_iter_get(it, slot, offset, file_meta);
+    return ESP_OK;
+}
+
+/**
+ * @brief Does the meta location hold a file (between the oldest descriptor and CURR_WRITE_META)
+*/
+static bool __isacfs_iter_in_log(u32 sector_no, u32 offset){
+    return !(sector_no == CURR_WRITE_META_SECTOR && offset == CURR_WRITE_META_OFFSET);
+}
+
+/**
+ * @brief Get the data location of the file at the meta location && where it ends
+ * @note A file ends where the next one starts, or where the previous one starts when the frames grow down
+*/
+static esp_err_t __isacfs_iter_span(isacfs_iter_t* it, u32 sector_no, u32 offset, isacfs_file_meta* file_meta, u64* end_pos){
+    esp_err_t res = __isacfs_iter_desc(it, sector_no, offset, file_meta);
+    if(res != ESP_OK){
+        return res;
+    }
+    bool down = DATA_LAYOUT == isacfs_layout_converging;
+    u32 next_sector = sector_no;
+    u32 next_offset = offset;
+    if(down){
+        __isacfs_retreat_meta_loc(&next_sector, &next_offset);
+    }
+    else {
+        __isacfs_advance_meta_loc(&next_sector, &next_offset);
+    }
+    isacfs_file_meta next_meta;
+    if(it->forward == down && it->prev_start_valid && sector_no == it->meta_sector && offset == it->meta_offset){
+        next_meta.sector = it->prev_start_sector; // handed out just before
+        next_meta.offset = it->prev_start_offset;
+    }
+    else if(down && sector_no == 0x0 && offset == META_START_OFFSET){
+        __isacfs_data_origin(&next_meta.sector, &next_meta.offset);
+    }
+    else if(!down && !__isacfs_iter_in_log(next_sector, next_offset)){
+        next_meta.sector = CURR_WRITE_DATA_SECTOR;
+        next_meta.offset = CURR_WRITE_DATA_OFFSET;
+    }
+    else {
+        res = __isacfs_iter_desc(it, next_sector, next_offset, &next_meta);
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+    u64 start_pos = ((u64)file_meta->sector << OFFSET_ADDR_WIDTH) + file_meta->offset;
+    file_meta->size = __isacfs_data_span(start_pos, ((u64)next_meta.sector << OFFSET_ADDR_WIDTH) + next_meta.offset);
+    *end_pos = start_pos + file_meta->size; // past the end of the card if the frame wraps
+    return ESP_OK;
+}
+
+/**
+ * @brief Move the meta location one file in the direction of the iteration
+ * @returns false at the end of the recorded sequence
+*/
+static bool __isacfs_iter_step(isacfs_iter_t* it, u32* sector_no, u32* offset){
+    if(it->forward){
+        __isacfs_advance_meta_loc(sector_no, offset);
+        return __isacfs_iter_in_log(*sector_no, *offset);
+    }
+    if(*sector_no == it->oldest_meta_sector && *offset == it->oldest_meta_offset){
+        return false;
+    }
+    __isacfs_retreat_meta_loc(sector_no, offset);
+    return true;
+}
+
+esp_err_t isacfs_iter_open(isacfs_iter_t** iter, u32 meta_sector, u32 meta_offset, bool forward, u32 max_frame_size){
+    isacfs_iter_t* it = (isacfs_iter_t*)calloc(0x1, sizeof(isacfs_iter_t));
+    if(!it){
+        return ESP_ERR_NO_MEM;
+    }
+    it->fs = FS;
+    it->forward = forward;
+    it->data_cap_sectors = (max_frame_size >> OFFSET_ADDR_WIDTH) + 0x2; // a frame may straddle one more sector
+    u32 slots = SECTOR_SIZE >> 0x3;
+    bool alloc_ok = true;
+    for(u8 i = 0x0; i < 0x2; i++){
+        it->meta_buf[i] = (u8*)isacfs_dma_alloc(SECTOR_SIZE);
+        it->desc_sector[i] = (u32*)malloc(slots * sizeof(u32));
+        it->desc_offset[i] = (u32*)malloc(slots * sizeof(u32));
+        it->desc_timestamp[i] = (u64*)malloc(slots * sizeof(u64));
+        it->data_buf[i] = (u8*)isacfs_dma_alloc(it->data_cap_sectors << OFFSET_ADDR_WIDTH);
+        alloc_ok = alloc_ok && it->meta_buf[i] && it->desc_sector[i] && it->desc_offset[i] && it->desc_timestamp[i] && it->data_buf[i];
+    }
+    it->req_ready = isacfs_event_create();
+    it->req_done = isacfs_event_create();
+    if(!alloc_ok || !it->req_ready || !it->req_done){
+        isacfs_iter_close(it);
+        return ESP_ERR_NO_MEM;
+    }
+
+    u32 sectors_count;
+    esp_err_t res = __isacfs_search_window(&it->oldest_meta_sector, &it->oldest_meta_offset, &sectors_count);
+    if(res != ESP_OK){
+        isacfs_iter_close(it);
+        return res;
+    }
+    it->done = !sectors_count;
+
+    if(meta_sector == UNKNOWN_SECTOR && meta_offset == UNKNOWN_OFFSET){
+        if(forward){
+            meta_sector = it->oldest_meta_sector;
+            meta_offset = it->oldest_meta_offset;
+        }
+        else {
+            meta_sector = CURR_WRITE_META_SECTOR;
+            meta_offset = CURR_WRITE_META_OFFSET;
+            __isacfs_retreat_meta_loc(&meta_sector, &meta_offset);
+        }
+    }
+    it->meta_sector = meta_sector;
+    it->meta_offset = meta_offset;
+    it->done = it->done || !__isacfs_iter_in_log(meta_sector, meta_offset);
+
+    it->task = isacfs_task_start(__isacfs_iter_worker, it, "isacfs_iter", ITER_TASK_STACK_SIZE, ITER_TASK_PRIORITY);
+    if(!it->task){
+        isacfs_iter_close(it);
+        return ESP_ERR_NO_MEM;
+    }
+    *iter = it;
+    return ESP_OK;
+}
+
+esp_err_t isacfs_iter_next(isacfs_iter_t* it, isacfs_file_meta* file_meta, const u8** data){
+    isacfs_scope scope(it->fs);
+    __isacfs_iter_settle(it);
+    if(it->done){
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* current file */
+    u64 end_pos;
+    esp_err_t res = __isacfs_iter_span(it, it->meta_sector, it->meta_offset, file_meta, &end_pos);
+    if(res != ESP_OK){
+        return res;
+    }
+    u64 start_pos = ((u64)file_meta->sector << OFFSET_ADDR_WIDTH) + file_meta->offset;
+    u32 first_data_sector = start_pos >> OFFSET_ADDR_WIDTH;
+    u32 data_count = end_pos > start_pos ? ((end_pos - 0x1) >> OFFSET_ADDR_WIDTH) - first_data_sector + 0x1 : 0x0;
+
+    *data = NULL;
+    if(data_count > it->data_cap_sectors){
+        res = ESP_ERR_INVALID_SIZE;
+    }
+    else if(it->data_back_valid && it->data_back_meta_sector == it->meta_sector && it->data_back_meta_offset == it->meta_offset){
+        it->data_front ^= 0x1; // prefetched
+    }
+    else if(data_count){
+        res = __isacfs_read_data_sectors(it->data_buf[it->data_front], first_data_sector, data_count);
+    }
+    it->data_back_valid = false;
+    if(res == ESP_OK){
+        *data = it->data_buf[it->data_front] + (start_pos - ((u64)first_data_sector << OFFSET_ADDR_WIDTH));
+    }
+
+    it->prev_start_valid = true;
+    it->prev_start_sector = file_meta->sector;
+    it->prev_start_offset = file_meta->offset;
+    u32 cur_meta_sector = it->meta_sector;
+    if(!__isacfs_iter_step(it, &it->meta_sector, &it->meta_offset)){
+        it->done = true;
+        return res;
+    }
+
+    /* prefetch the next file && the metadata sector after the current one */
+    it->req_data_count = 0x0;
+    it->req_meta_slot = 0xFF;
+    isacfs_file_meta next_meta;
+    u64 next_end_pos;
+    if(__isacfs_iter_span(it, it->meta_sector, it->meta_offset, &next_meta, &next_end_pos) == ESP_OK){
+        u64 next_start_pos = ((u64)next_meta.sector << OFFSET_ADDR_WIDTH) + next_meta.offset;
+        u32 next_first_sector = next_start_pos >> OFFSET_ADDR_WIDTH;
+        u32 next_count = next_end_pos > next_start_pos ? ((next_end_pos - 0x1) >> OFFSET_ADDR_WIDTH) - next_first_sector + 0x1 : 0x0;
+        if(next_count && next_count <= it->data_cap_sectors && next_first_sector + next_count <= SECTOR_COUNT){ // a frame wrapping around the data ring is read when handed out
+            it->req_data_sector = next_first_sector;
+            it->req_data_count = next_count;
+            it->req_data_res = ESP_OK;
+            it->data_back_valid = true;
+            it->data_back_meta_sector = it->meta_sector;
+            it->data_back_meta_offset = it->meta_offset;
+        }
+    }
+    if(it->meta_sector != cur_meta_sector || !it->meta_primed){
+        it->meta_primed = true;
+        u32 ahead_sector = it->meta_sector;
+        if(it->forward){
+            ahead_sector = ahead_sector + 0x1 >= __isacfs_meta_ring_end() ? 0x0 : ahead_sector + 0x1;
+        }
+        else {
+            ahead_sector = ahead_sector ? ahead_sector - 0x1 : __isacfs_meta_ring_end() - 0x1;
+        }
+        bool journaled = META_JOURNAL_VALID && META_JOURNAL_SECTOR == ahead_sector;
+        bool beyond = it->forward ? it->meta_sector == CURR_WRITE_META_SECTOR : it->meta_sector == it->oldest_meta_sector;
+        if(!journaled && !beyond){
+            u8 slot = it->meta_buf_last ^ 0x1;
+            it->meta_buf_valid[slot] = false;
+            it->meta_buf_pending[slot] = true;
+            it->meta_buf_sector[slot] = ahead_sector;
+            it->req_meta_slot = slot;
+            it->req_meta_sector = ahead_sector;
+            it->req_meta_res = ESP_OK;
+        }
+    }
+    if(it->req_data_count || it->req_meta_slot != 0xFF){
+        it->busy = true;
+        isacfs_event_give(it->req_ready);
+    }
+    return res;
 }
 
-//{{{void/isacfs_file_meta get_next_file R/W}}}
+void isacfs_iter_close(isacfs_iter_t* it){
+    isacfs_scope scope(it->fs);
+    if(it->task){
+        __isacfs_iter_settle(it);
+        it->stop = true;
+        isacfs_event_give(it->req_ready);
+        isacfs_task_join(it->task);
+    }
+    if(it->req_ready){
+        isacfs_event_destroy(it->req_ready);
+    }
+    if(it->req_done){
+        isacfs_event_destroy(it->req_done);
+    }
+    for(u8 i = 0x0; i < 0x2; i++){
+        isacfs_dma_free(it->meta_buf[i]);
+        free(it->desc_sector[i]);
+        free(it->desc_offset[i]);
+        free(it->desc_timestamp[i]);
+        isacfs_dma_free(it->data_buf[i]);
+    }
+    free(it);
+}
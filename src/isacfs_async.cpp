@@ -0,0 +1,208 @@
+#include "isacfs_async.hpp"
+#include "isacfs_os.hpp"
+#include <atomic>
+#include <new>
+
+#define ASYNC_IDLE_SYNC_MS 1000U // the journal is synced when no frame came for this long
+
+typedef struct {
+    isacfs_file_meta file_meta;
+    const u8* buffer;
+    u32 buf_sz;
+    isacfs_write_cb_t cb;
+    void* user;
+} isacfs_frame_t;
+
+struct isacfs_writer {
+    isacfs_t* fs; // the instance the frames go to
+
+    /* single-producer/single-consumer ring, "head" is owned by the producer, "tail" by the writer task */
+    isacfs_frame_t* queue;
+    u32 queue_mask;
+    std::atomic<u32> queue_head;
+    std::atomic<u32> queue_tail;
+
+    isacfs_task_t* task;
+    isacfs_event_t* work_event;
+    isacfs_event_t* flush_done_event;
+    std::atomic<bool> flush_requested;
+    std::atomic<bool> stop_requested;
+    esp_err_t flush_res;
+
+    isacfs_async_stats_t stats;
+    std::atomic<u32> completed;
+    std::atomic<u32> failed;
+};
+
+/* the writer of "isacfs_async_start" */
+static isacfs_writer_t* WRITER = NULL;
+
+/**
+ * @brief Nothing to do for the writer task - no frame queued, no barrier, no stop
+*/
+static bool __isacfs_writer_idle(isacfs_writer_t* w){
+    return w->queue_tail.load(std::memory_order_relaxed) == w->queue_head.load(std::memory_order_acquire)
+           && !w->flush_requested.load(std::memory_order_acquire) && !w->stop_requested.load(std::memory_order_acquire);
+}
+
+static void __isacfs_writer_task(void* param){
+    isacfs_writer_t* w = (isacfs_writer_t*)param;
+    isacfs_bind(w->fs);
+    while(true){
+        bool woken = isacfs_event_take(w->work_event, ASYNC_IDLE_SYNC_MS);
+        bool flush = w->flush_requested.load(std::memory_order_acquire); // before draining - covers all the frames queued before the barrier
+        u32 tail = w->queue_tail.load(std::memory_order_relaxed);
+        while(tail != w->queue_head.load(std::memory_order_acquire)){
+            isacfs_frame_t* frame = w->queue + (tail & w->queue_mask);
+            esp_err_t res = isacfs_write_file(&frame->file_meta, frame->buffer, frame->buf_sz);
+            if(res != ESP_OK){
+                w->failed.fetch_add(0x1, std::memory_order_relaxed);
+            }
+            if(frame->cb){
+                frame->cb(&frame->file_meta, frame->buffer, res, frame->user);
+            }
+            tail++;
+            w->queue_tail.store(tail, std::memory_order_release);
+            w->completed.fetch_add(0x1, std::memory_order_relaxed);
+        }
+        if(flush){
+            w->flush_res = isacfs_sync();
+            w->flush_requested.store(false, std::memory_order_release);
+            isacfs_event_give(w->flush_done_event);
+        }
+        else if(!woken){
+            isacfs_sync(); // idle - don't keep descriptors pending
+        }
+        while(__isacfs_writer_idle(w) && isacfs_preerase_step() == ESP_OK){
+            // idle - erase ahead of the write head one chunk at a time, a frame waits for one erase command at most
+        }
+        if(w->stop_requested.load(std::memory_order_acquire)){
+            break;
+        }
+    }
+}
+
+esp_err_t isacfs_writer_start(isacfs_writer_t** writer, isacfs_t* fs, u32 queue_len, u32 stack_size, u32 priority){
+    isacfs_writer_t* w = new (std::nothrow) isacfs_writer_t();
+    if(!w){
+        return ESP_ERR_NO_MEM;
+    }
+    u32 capacity = 0x1;
+    while(capacity < queue_len){
+        capacity <<= 0x1;
+    }
+    w->fs = fs;
+    w->queue = (isacfs_frame_t*)malloc(capacity * sizeof(isacfs_frame_t));
+    w->work_event = isacfs_event_create();
+    w->flush_done_event = isacfs_event_create();
+    if(!w->queue || !w->work_event || !w->flush_done_event){
+        isacfs_writer_stop(w);
+        return ESP_ERR_NO_MEM;
+    }
+    w->queue_mask = capacity - 0x1;
+
+    w->task = isacfs_task_start(__isacfs_writer_task, w, "isacfs_writer", stack_size, priority);
+    if(!w->task){
+        isacfs_writer_stop(w);
+        return ESP_ERR_NO_MEM;
+    }
+    *writer = w;
+    return ESP_OK;
+}
+
+esp_err_t isacfs_writer_submit(isacfs_writer_t* w, const isacfs_file_meta* file_meta, const u8* buffer, u32 buf_sz, isacfs_write_cb_t cb, void* user){
+    u32 head = w->queue_head.load(std::memory_order_relaxed);
+    u32 depth = head - w->queue_tail.load(std::memory_order_acquire);
+    if(depth > w->queue_mask){
+        w->stats.rejected++;
+        return ESP_ERR_NO_MEM;
+    }
+    isacfs_frame_t* frame = w->queue + (head & w->queue_mask);
+    frame->file_meta = *file_meta;
+    frame->buffer = buffer;
+    frame->buf_sz = buf_sz;
+    frame->cb = cb;
+    frame->user = user;
+    w->queue_head.store(head + 0x1, std::memory_order_release);
+
+    w->stats.submitted++;
+    if(depth + 0x1 > w->stats.max_depth){
+        w->stats.max_depth = depth + 0x1;
+    }
+    isacfs_event_give(w->work_event);
+    return ESP_OK;
+}
+
+u32 isacfs_writer_pending(isacfs_writer_t* w){
+    return w->queue_head.load(std::memory_order_relaxed) - w->queue_tail.load(std::memory_order_acquire);
+}
+
+void isacfs_writer_get_stats(isacfs_writer_t* w, isacfs_async_stats_t* stats){
+    *stats = w->stats;
+    stats->completed = w->completed.load(std::memory_order_relaxed);
+    stats->failed = w->failed.load(std::memory_order_relaxed);
+}
+
+esp_err_t isacfs_writer_flush(isacfs_writer_t* w){
+    w->flush_requested.store(true, std::memory_order_release);
+    isacfs_event_give(w->work_event);
+    isacfs_event_take(w->flush_done_event, ISACFS_WAIT_FOREVER);
+    return w->flush_res;
+}
+
+void isacfs_writer_stop(isacfs_writer_t* w){
+    if(w->task){
+        isacfs_writer_flush(w);
+        w->stop_requested.store(true, std::memory_order_release);
+        isacfs_event_give(w->work_event);
+        isacfs_task_join(w->task);
+    }
+    if(w->work_event){
+        isacfs_event_destroy(w->work_event);
+    }
+    if(w->flush_done_event){
+        isacfs_event_destroy(w->flush_done_event);
+    }
+    free(w->queue);
+    delete w;
+}
+
+esp_err_t isacfs_async_start(u32 queue_len, u32 stack_size, u32 priority){
+    if(WRITER){
+        return ESP_ERR_INVALID_STATE;
+    }
+    return isacfs_writer_start(&WRITER, isacfs_current(), queue_len, stack_size, priority);
+}
+
+esp_err_t isacfs_write_file_async(const isacfs_file_meta* file_meta, const u8* buffer, u32 buf_sz, isacfs_write_cb_t cb, void* user){
+    if(!WRITER){
+        return ESP_ERR_INVALID_STATE;
+    }
+    return isacfs_writer_submit(WRITER, file_meta, buffer, buf_sz, cb, user);
+}
+
+u32 isacfs_async_pending(){
+    return WRITER ? isacfs_writer_pending(WRITER) : 0x0;
+}
+
+void isacfs_async_get_stats(isacfs_async_stats_t* stats){
+    if(!WRITER){
+        memset(stats, 0x0, sizeof(isacfs_async_stats_t));
+        return;
+    }
+    isacfs_writer_get_stats(WRITER, stats);
+}
+
+esp_err_t isacfs_flush(){
+    if(!WRITER){
+        return isacfs_sync();
+    }
+    return isacfs_writer_flush(WRITER);
+}
+
+void isacfs_async_stop(){
+    if(WRITER){
+        isacfs_writer_stop(WRITER);
+        WRITER = NULL;
+    }
+}
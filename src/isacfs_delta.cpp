@@ -0,0 +1,428 @@
+#include "isacfs_delta.hpp"
+#include "isacfs_os.hpp"
+#include <string.h>
+
+#define DELTA_MIN_RUN 0x8 // shorter runs of equal bytes stay in the literal
+#define DELTA_VARINT_MAX 0x5
+#define DELTA_DISTANCE_MAX 0xFFFFFFU // 24 bits of the header
+
+struct isacfs_delta {
+    u32 max_frame_size;
+    u32 key_interval;
+    bool force_key;
+
+    /* encoder - the last written frame, zero-filled past its size */
+    u8* ref;
+    u32 ref_size;
+    bool ref_valid;
+    u32 since_key;
+    u8* enc; // header + payload of the frame being written
+
+    /* decoder - the last decoded frame, zero-filled past its size */
+    u8* dec;
+    u32 dec_size;
+    bool dec_valid;
+    u32 dec_distance;
+    u32 dec_meta_sector; // UNKNOWN_SECTOR - not decoded by "isacfs_delta_read"
+    u32 dec_meta_offset;
+    u8* dec_in; // stored frame being decoded by "isacfs_delta_read"
+
+    isacfs_delta_stats_t stats;
+};
+
+static inline u32 __isacfs_delta_load32(const u8* p){
+    u32 w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/**
+ * @brief dst = a ^ b, a word at a time ("dst" may be "a")
+*/
+static void __isacfs_delta_xor(u8* dst, const u8* a, const u8* b, u32 n){
+    u32 i = 0x0;
+    for(; i + 0x4 <= n; i += 0x4){
+        u32 w = __isacfs_delta_load32(a + i) ^ __isacfs_delta_load32(b + i);
+        memcpy(dst + i, &w, sizeof(w));
+    }
+    for(; i < n; i++){
+        dst[i] = a[i] ^ b[i];
+    }
+}
+
+static inline u32 __isacfs_delta_put_varint(u8* out, u32 v){
+    u32 n = 0x0;
+    while(v >= 0x80){
+        out[n++] = (u8)(v | 0x80);
+        v >>= 7U;
+    }
+    out[n++] = (u8)v;
+    return n;
+}
+
+static inline bool __isacfs_delta_get_varint(const u8** p, const u8* end, u32* v){
+    u32 r = 0x0;
+    for(u32 shift = 0x0; *p < end && shift < 7U * DELTA_VARINT_MAX; shift += 7U){
+        u8 b = *(*p)++;
+        r |= (u32)(b & 0x7F) << shift;
+        if(!(b & 0x80)){
+            *v = r;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Encode "cur" against "ref" as (zero run, literal length, literal XOR bytes) tokens
+ * @returns size of the payload, 0 if it would not be smaller than "limit"
+*/
+static u32 __isacfs_delta_encode(const u8* cur, const u8* ref, u32 size, u8* out, u32 limit){
+    u32 i = 0x0;
+    u32 o = 0x0;
+    while(i < size){
+        u32 run_start = i;
+        while(i + 0x4 <= size && __isacfs_delta_load32(cur + i) == __isacfs_delta_load32(ref + i)){
+            i += 0x4;
+        }
+        while(i < size && cur[i] == ref[i]){
+            i++;
+        }
+        u32 lit_start = i;
+        while(i < size){
+            if(i + DELTA_MIN_RUN <= size
+               && __isacfs_delta_load32(cur + i) == __isacfs_delta_load32(ref + i)
+               && __isacfs_delta_load32(cur + i + 0x4) == __isacfs_delta_load32(ref + i + 0x4)){
+                break;
+            }
+            i += i + 0x4 <= size ? 0x4 : 0x1;
+        }
+        u32 lit = i - lit_start;
+        if(o + 0x2 * DELTA_VARINT_MAX + lit >= limit){
+            return 0x0;
+        }
+        o += __isacfs_delta_put_varint(out + o, lit_start - run_start);
+        o += __isacfs_delta_put_varint(out + o, lit);
+        __isacfs_delta_xor(out + o, cur + lit_start, ref + lit_start, lit);
+        o += lit;
+    }
+    return o;
+}
+
+static void __isacfs_delta_put_header(u8* hdr, isacfs_delta_frame_t type, u32 distance, u32 size){
+    hdr[0x0] = (u8)type;
+    hdr[0x1] = (u8)(distance >> 16U);
+    hdr[0x2] = (u8)(distance >> 8U);
+    hdr[0x3] = (u8)distance;
+    hdr[0x4] = (u8)(size >> 24U);
+    hdr[0x5] = (u8)(size >> 16U);
+    hdr[0x6] = (u8)(size >> 8U);
+    hdr[0x7] = (u8)size;
+}
+
+esp_err_t isacfs_delta_frame_info(const u8* data, u32 size, isacfs_delta_frame_t* type, u32* key_distance){
+    if(size < ISACFS_DELTA_HEADER_SIZE || (data[0x0] != isacfs_delta_key_frame && data[0x0] != isacfs_delta_delta_frame)){
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    u32 distance = ((u32)data[0x1] << 16U) | ((u32)data[0x2] << 8U) | (u32)data[0x3];
+    if((data[0x0] == isacfs_delta_key_frame) != !distance){
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if(type){
+        *type = (isacfs_delta_frame_t)data[0x0];
+    }
+    if(key_distance){
+        *key_distance = distance;
+    }
+    return ESP_OK;
+}
+
+esp_err_t isacfs_delta_open(isacfs_delta_t** delta, u32 max_frame_size, u32 key_interval){
+    isacfs_delta_t* d = (isacfs_delta_t*)calloc(0x1, sizeof(isacfs_delta_t));
+    if(!d){
+        return ESP_ERR_NO_MEM;
+    }
+    d->max_frame_size = max_frame_size;
+    isacfs_delta_set_key_interval(d, key_interval);
+    d->dec_meta_sector = UNKNOWN_SECTOR;
+    d->dec_meta_offset = UNKNOWN_OFFSET;
+    *delta = d;
+    return ESP_OK;
+}
+
+void isacfs_delta_close(isacfs_delta_t* delta){
+    free(delta->ref);
+    isacfs_dma_free(delta->enc);
+    free(delta->dec);
+    isacfs_dma_free(delta->dec_in);
+    free(delta);
+}
+
+void isacfs_delta_set_key_interval(isacfs_delta_t* delta, u32 key_interval){
+    delta->key_interval = !key_interval ? 0x1 : key_interval > DELTA_DISTANCE_MAX ? DELTA_DISTANCE_MAX : key_interval;
+}
+
+void isacfs_delta_force_key(isacfs_delta_t* delta){
+    delta->force_key = true;
+}
+
+esp_err_t isacfs_delta_write_file(isacfs_delta_t* delta, isacfs_file_meta* file_meta, const u8* buffer, u32 buf_sz){
+    if(buf_sz > delta->max_frame_size){
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if(!delta->enc){ // the encoder side is allocated by the first frame (a decoding-only instance never needs it)
+        delta->ref = (u8*)calloc(delta->max_frame_size, 0x1);
+        delta->enc = (u8*)isacfs_dma_alloc(ISACFS_DELTA_HEADER_SIZE + delta->max_frame_size); // the stored frames go to the card from it
+        if(!delta->ref || !delta->enc){
+            free(delta->ref);
+            isacfs_dma_free(delta->enc);
+            delta->ref = delta->enc = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    bool key = !delta->ref_valid || delta->force_key || delta->since_key + 0x1 >= delta->key_interval;
+    u32 payload_size = 0x0;
+    if(!key){
+        payload_size = __isacfs_delta_encode(buffer, delta->ref, buf_sz, delta->enc + ISACFS_DELTA_HEADER_SIZE, buf_sz);
+        key = !payload_size;
+    }
+    u32 distance = key ? 0x0 : delta->since_key + 0x1;
+    __isacfs_delta_put_header(delta->enc, key ? isacfs_delta_key_frame : isacfs_delta_delta_frame, distance, buf_sz);
+
+    /* a key frame goes to the card from "buffer" behind its header, a delta from the encoder buffer */
+    isacfs_iovec_t pieces[0x2] = { { delta->enc, ISACFS_DELTA_HEADER_SIZE + (key ? 0x0 : payload_size) }, { buffer, key ? buf_sz : 0x0 } };
+    if(key){
+        payload_size = buf_sz;
+    }
+    esp_err_t res = isacfs_write_filev(file_meta, pieces, 0x2);
+    if(res != ESP_OK){
+        return res;
+    }
+    memcpy(delta->ref, buffer, buf_sz);
+    if(buf_sz < delta->ref_size){
+        memset(delta->ref + buf_sz, 0x0, delta->ref_size - buf_sz);
+    }
+    delta->ref_size = buf_sz;
+    delta->ref_valid = true;
+    delta->force_key = false;
+    delta->since_key = distance;
+    if(key){
+        delta->stats.key_frames++;
+    }
+    else {
+        delta->stats.delta_frames++;
+    }
+    delta->stats.raw_bytes += buf_sz;
+    delta->stats.stored_bytes += ISACFS_DELTA_HEADER_SIZE + payload_size;
+    return ESP_OK;
+}
+
+static esp_err_t __isacfs_delta_alloc_decoder(isacfs_delta_t* delta){
+    if(!delta->dec){
+        delta->dec = (u8*)calloc(delta->max_frame_size, 0x1);
+        if(!delta->dec){
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Decode a stored frame into "delta->dec" (over the frame decoded before it, for a delta)
+*/
+static esp_err_t __isacfs_delta_decode_frame(isacfs_delta_t* delta, const u8* data, u32 size){
+    isacfs_delta_frame_t type;
+    u32 distance;
+    esp_err_t res = isacfs_delta_frame_info(data, size, &type, &distance);
+    if(res != ESP_OK){
+        return res;
+    }
+    u32 raw_size = ((u32)data[0x4] << 24U) | ((u32)data[0x5] << 16U) | ((u32)data[0x6] << 8U) | (u32)data[0x7];
+    if(raw_size > delta->max_frame_size){
+        return ESP_ERR_INVALID_SIZE;
+    }
+    res = __isacfs_delta_alloc_decoder(delta);
+    if(res != ESP_OK){
+        return res;
+    }
+    const u8* p = data + ISACFS_DELTA_HEADER_SIZE;
+    const u8* end = data + size;
+    if(type == isacfs_delta_key_frame){
+        if((u32)(end - p) != raw_size){
+            delta->dec_valid = false;
+            return ESP_FAIL;
+        }
+        memcpy(delta->dec, p, raw_size);
+    }
+    else {
+        if(!delta->dec_valid || distance != delta->dec_distance + 0x1){
+            return ESP_ERR_INVALID_STATE;
+        }
+        u32 i = 0x0;
+        while(p < end){
+            u32 zero, lit;
+            if(!__isacfs_delta_get_varint(&p, end, &zero) || !__isacfs_delta_get_varint(&p, end, &lit)
+               || zero > raw_size - i || lit > raw_size - i - zero || lit > (u32)(end - p)){
+                delta->dec_valid = false;
+                return ESP_FAIL;
+            }
+            i += zero;
+            __isacfs_delta_xor(delta->dec + i, delta->dec + i, p, lit);
+            i += lit;
+            p += lit;
+        }
+    }
+    if(raw_size < delta->dec_size){
+        memset(delta->dec + raw_size, 0x0, delta->dec_size - raw_size);
+    }
+    delta->dec_size = raw_size;
+    delta->dec_valid = true;
+    delta->dec_distance = distance;
+    return ESP_OK;
+}
+
+esp_err_t isacfs_delta_decode(isacfs_delta_t* delta, const u8* data, u32 size, const u8** out, u32* out_size){
+    delta->dec_meta_sector = UNKNOWN_SECTOR; // the caller knows where the frame came from, "isacfs_delta_read" does not
+    delta->dec_meta_offset = UNKNOWN_OFFSET;
+    esp_err_t res = __isacfs_delta_decode_frame(delta, data, size);
+    if(res != ESP_OK){
+        return res;
+    }
+    *out = delta->dec;
+    *out_size = delta->dec_size;
+    return ESP_OK;
+}
+
+static esp_err_t __isacfs_delta_read_distance(u32 meta_sector, u32 meta_offset, u32* distance){
+    isacfs_file_meta file_meta;
+    u32 size = 0x0;
+    esp_err_t res = isacfs_file_desc(&file_meta, &size, &meta_sector, &meta_offset);
+    if(res != ESP_OK){
+        return res;
+    }
+    u8 hdr[ISACFS_DELTA_HEADER_SIZE];
+    if(size < ISACFS_DELTA_HEADER_SIZE){
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    res = isacfs_read_file(file_meta, hdr, 0x0, ISACFS_DELTA_HEADER_SIZE);
+    if(res != ESP_OK){
+        return res;
+    }
+    return isacfs_delta_frame_info(hdr, ISACFS_DELTA_HEADER_SIZE, NULL, distance);
+}
+
+/**
+ * @brief One step back in the log, never past the oldest frame
+*/
+static esp_err_t __isacfs_delta_step_back(u32* meta_sector, u32* meta_offset){
+    u32 oldest_sector, oldest_offset;
+    esp_err_t res = isacfs_oldest_meta(&oldest_sector, &oldest_offset);
+    if(res != ESP_OK){
+        return res;
+    }
+    if(*meta_sector == oldest_sector && *meta_offset == oldest_offset){
+        return ESP_ERR_NOT_FOUND;
+    }
+    isacfs_prev_meta(meta_sector, meta_offset);
+    return ESP_OK;
+}
+
+esp_err_t isacfs_delta_key_meta(u32* meta_sector, u32* meta_offset){
+    u32 distance;
+    esp_err_t res = __isacfs_delta_read_distance(*meta_sector, *meta_offset, &distance);
+    for(; res == ESP_OK && distance; distance--){
+        res = __isacfs_delta_step_back(meta_sector, meta_offset);
+    }
+    return res;
+}
+
+/**
+ * @brief Read the stored frame at the meta location and decode it
+*/
+static esp_err_t __isacfs_delta_decode_at(isacfs_delta_t* delta, u32 meta_sector, u32 meta_offset){
+    if(!delta->dec_in){
+        delta->dec_in = (u8*)isacfs_dma_alloc(ISACFS_DELTA_HEADER_SIZE + delta->max_frame_size);
+        if(!delta->dec_in){
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    isacfs_file_meta file_meta;
+    u32 size = 0x0;
+    u32 sector = meta_sector;
+    u32 offset = meta_offset;
+    esp_err_t res = isacfs_file_desc(&file_meta, &size, &sector, &offset);
+    if(res != ESP_OK){
+        return res;
+    }
+    if(size > ISACFS_DELTA_HEADER_SIZE + delta->max_frame_size){
+        return ESP_ERR_INVALID_SIZE;
+    }
+    res = isacfs_read_file(file_meta, delta->dec_in, 0x0, size);
+    if(res != ESP_OK){
+        return res;
+    }
+    delta->dec_meta_sector = UNKNOWN_SECTOR;
+    delta->dec_meta_offset = UNKNOWN_OFFSET;
+    res = __isacfs_delta_decode_frame(delta, delta->dec_in, size);
+    if(res == ESP_OK){
+        delta->dec_meta_sector = meta_sector;
+        delta->dec_meta_offset = meta_offset;
+    }
+    return res;
+}
+
+esp_err_t isacfs_delta_read(isacfs_delta_t* delta, isacfs_file_meta* file_meta, u32* meta_sector, u32* meta_offset, const u8** out, u32* out_size){
+    u32 sector = meta_sector ? *meta_sector : UNKNOWN_SECTOR;
+    u32 offset = meta_offset ? *meta_offset : UNKNOWN_OFFSET;
+    u32 size = 0x0;
+    esp_err_t res = isacfs_file_desc(file_meta, &size, &sector, &offset);
+    if(res != ESP_OK){
+        return res;
+    }
+    if(meta_sector){
+        *meta_sector = sector;
+    }
+    if(meta_offset){
+        *meta_offset = offset;
+    }
+
+    if(!(delta->dec_valid && sector == delta->dec_meta_sector && offset == delta->dec_meta_offset)){
+        /* back to the key frame, or to the last decoded frame if it comes first */
+        u32 distance;
+        res = __isacfs_delta_read_distance(sector, offset, &distance);
+        if(res != ESP_OK){
+            return res;
+        }
+        u32 from_sector = sector;
+        u32 from_offset = offset;
+        bool cached = false;
+        for(u32 steps = distance; steps && res == ESP_OK; steps--){
+            res = __isacfs_delta_step_back(&from_sector, &from_offset);
+            cached = delta->dec_valid && from_sector == delta->dec_meta_sector && from_offset == delta->dec_meta_offset;
+            if(cached){
+                break;
+            }
+        }
+        if(res != ESP_OK){
+            return res;
+        }
+        if(!cached){
+            res = __isacfs_delta_decode_at(delta, from_sector, from_offset);
+        }
+        while(res == ESP_OK && (from_sector != sector || from_offset != offset)){
+            isacfs_next_meta(&from_sector, &from_offset);
+            res = __isacfs_delta_decode_at(delta, from_sector, from_offset);
+        }
+        if(res != ESP_OK){
+            return res;
+        }
+    }
+    *out = delta->dec;
+    *out_size = delta->dec_size;
+    return ESP_OK;
+}
+
+void isacfs_delta_get_stats(isacfs_delta_t* delta, isacfs_delta_stats_t* stats){
+    *stats = delta->stats;
+}
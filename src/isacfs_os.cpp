@@ -0,0 +1,212 @@
+#include "isacfs_os.hpp"
+
+#ifdef ISACFS_HOST
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+struct isacfs_event {
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool given;
+};
+
+struct isacfs_mutex {
+    std::recursive_mutex mutex;
+};
+
+struct isacfs_task {
+    std::thread thread;
+};
+
+isacfs_event_t* isacfs_event_create(){
+    isacfs_event_t* event = new isacfs_event_t;
+    event->given = false;
+    return event;
+}
+
+void isacfs_event_destroy(isacfs_event_t* event){
+    delete event;
+}
+
+void isacfs_event_give(isacfs_event_t* event){
+    std::lock_guard<std::mutex> lock(event->mutex);
+    event->given = true;
+    event->cond.notify_one();
+}
+
+bool isacfs_event_take(isacfs_event_t* event, uint32_t timeout_ms){
+    std::unique_lock<std::mutex> lock(event->mutex);
+    if(timeout_ms == ISACFS_WAIT_FOREVER){
+        event->cond.wait(lock, [event]{ return event->given; });
+    }
+    else if(!event->cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), [event]{ return event->given; })){
+        return false;
+    }
+    event->given = false;
+    return true;
+}
+
+isacfs_mutex_t* isacfs_mutex_create(){
+    return new isacfs_mutex_t;
+}
+
+void isacfs_mutex_destroy(isacfs_mutex_t* mutex){
+    delete mutex;
+}
+
+void isacfs_mutex_lock(isacfs_mutex_t* mutex){
+    mutex->mutex.lock();
+}
+
+void isacfs_mutex_unlock(isacfs_mutex_t* mutex){
+    mutex->mutex.unlock();
+}
+
+isacfs_task_t* isacfs_task_start(void (*fn)(void*), void* arg, const char*, uint32_t, uint32_t){
+    isacfs_task_t* task = new isacfs_task_t;
+    task->thread = std::thread(fn, arg);
+    return task;
+}
+
+void isacfs_task_join(isacfs_task_t* task){
+    task->thread.join();
+    delete task;
+}
+
+void* isacfs_dma_alloc(size_t size){
+    return aligned_alloc(ISACFS_DMA_ALIGN, (size + ISACFS_DMA_ALIGN - 0x1) & ~(size_t)(ISACFS_DMA_ALIGN - 0x1));
+}
+
+void isacfs_dma_free(void* buf){
+    free(buf);
+}
+
+bool isacfs_dma_capable(const void* buf){
+    return ((uintptr_t)buf & 0x3) == 0x0;
+}
+
+#else
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#if __has_include("esp_memory_utils.h")
+#include "esp_memory_utils.h" // esp_ptr_dma_capable (ESP-IDF 5)
+#else
+#include "soc/soc_memory_layout.h"
+#endif
+
+struct isacfs_event {
+    SemaphoreHandle_t sem;
+};
+
+struct isacfs_mutex {
+    SemaphoreHandle_t sem;
+};
+
+struct isacfs_task {
+    TaskHandle_t handle;
+    void (*fn)(void*);
+    void* arg;
+    SemaphoreHandle_t done;
+};
+
+isacfs_event_t* isacfs_event_create(){
+    isacfs_event_t* event = (isacfs_event_t*)malloc(sizeof(isacfs_event_t));
+    if(!event){
+        return NULL;
+    }
+    event->sem = xSemaphoreCreateBinary();
+    if(!event->sem){
+        free(event);
+        return NULL;
+    }
+    return event;
+}
+
+void isacfs_event_destroy(isacfs_event_t* event){
+    vSemaphoreDelete(event->sem);
+    free(event);
+}
+
+void isacfs_event_give(isacfs_event_t* event){
+    xSemaphoreGive(event->sem);
+}
+
+bool isacfs_event_take(isacfs_event_t* event, uint32_t timeout_ms){
+    return xSemaphoreTake(event->sem, timeout_ms == ISACFS_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+}
+
+isacfs_mutex_t* isacfs_mutex_create(){
+    isacfs_mutex_t* mutex = (isacfs_mutex_t*)malloc(sizeof(isacfs_mutex_t));
+    if(!mutex){
+        return NULL;
+    }
+    mutex->sem = xSemaphoreCreateRecursiveMutex();
+    if(!mutex->sem){
+        free(mutex);
+        return NULL;
+    }
+    return mutex;
+}
+
+void isacfs_mutex_destroy(isacfs_mutex_t* mutex){
+    vSemaphoreDelete(mutex->sem);
+    free(mutex);
+}
+
+void isacfs_mutex_lock(isacfs_mutex_t* mutex){
+    xSemaphoreTakeRecursive(mutex->sem, portMAX_DELAY);
+}
+
+void isacfs_mutex_unlock(isacfs_mutex_t* mutex){
+    xSemaphoreGiveRecursive(mutex->sem);
+}
+
+static void __isacfs_task_entry(void* param){
+    isacfs_task_t* task = (isacfs_task_t*)param;
+    task->fn(task->arg);
+    xSemaphoreGive(task->done);
+    vTaskDelete(NULL);
+}
+
+isacfs_task_t* isacfs_task_start(void (*fn)(void*), void* arg, const char* name, uint32_t stack_size, uint32_t priority){
+    isacfs_task_t* task = (isacfs_task_t*)malloc(sizeof(isacfs_task_t));
+    if(!task){
+        return NULL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->done = xSemaphoreCreateBinary();
+    if(!task->done){
+        free(task);
+        return NULL;
+    }
+    if(xTaskCreate(__isacfs_task_entry, name, stack_size, task, priority, &task->handle) != pdPASS){
+        vSemaphoreDelete(task->done);
+        free(task);
+        return NULL;
+    }
+    return task;
+}
+
+void isacfs_task_join(isacfs_task_t* task){
+    xSemaphoreTake(task->done, portMAX_DELAY);
+    vSemaphoreDelete(task->done);
+    free(task);
+}
+
+void* isacfs_dma_alloc(size_t size){
+    return heap_caps_aligned_alloc(ISACFS_DMA_ALIGN, size, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+}
+
+void isacfs_dma_free(void* buf){
+    heap_caps_free(buf);
+}
+
+bool isacfs_dma_capable(const void* buf){
+    return esp_ptr_dma_capable(buf) && ((uintptr_t)buf & 0x3) == 0x0;
+}
+#endif
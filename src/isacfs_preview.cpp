@@ -0,0 +1,234 @@
+#include "isacfs_preview.hpp"
+#include "isacfs_os.hpp"
+#include <string.h>
+
+#define PREVIEW_TYPE 0xE1
+#define PREVIEW_DECIMATED 0x1 // flags: made by "isacfs_preview_write_file" from the frame
+
+struct isacfs_preview {
+    isacfs_t* previews;
+    isacfs_preview_config_t config;
+    u32 frames; // frames written so far - the every_nth count
+    u8* thumb; // the decimated frame (NULL - no decimation)
+    u32 thumb_size;
+};
+
+/* "isacfs_preview_range" callback adapter */
+typedef struct {
+    isacfs_t* caller;
+    isacfs_t* previews;
+    isacfs_preview_cb_t cb;
+    void* user;
+} isacfs_preview_range_t;
+
+static u32 __isacfs_preview_get_u32(const u8* p){
+    return (((u32)p[0x0]) << 24U) | (((u32)p[0x1]) << 16U) | (((u32)p[0x2]) << 8U) | p[0x3];
+}
+
+static void __isacfs_preview_put_u32(u8* p, u32 v){
+    p[0x0] = (u8)(v >> 24U);
+    p[0x1] = (u8)(v >> 16U);
+    p[0x2] = (u8)(v >> 8U);
+    p[0x3] = (u8)v;
+}
+
+/**
+ * @brief type(1B), flags(1B), millisecond(2B), then the size, sector, offset and sequence number of the frame (4B each)
+*/
+static void __isacfs_preview_put_header(u8* header, const isacfs_file_meta* frame_meta, u32 frame_sz, u8 flags){
+    header[0x0] = PREVIEW_TYPE;
+    header[0x1] = flags;
+    header[0x2] = (u8)(frame_meta->millisecond >> 8U);
+    header[0x3] = (u8)frame_meta->millisecond;
+    __isacfs_preview_put_u32(header + 0x4, frame_sz);
+    __isacfs_preview_put_u32(header + 0x8, frame_meta->sector);
+    __isacfs_preview_put_u32(header + 0xC, frame_meta->offset);
+    __isacfs_preview_put_u32(header + 0x10, frame_meta->sequence);
+}
+
+/**
+ * @brief The frame of a stored preview (its timestamp comes from the descriptor of the preview in "frame_meta")
+ * @returns false if "data" is not a preview
+*/
+static bool __isacfs_preview_get_header(const u8* data, u32 size, isacfs_file_meta* frame_meta){
+    if(!data || size < ISACFS_PREVIEW_HEADER_SIZE || data[0x0] != PREVIEW_TYPE){
+        return false;
+    }
+    frame_meta->millisecond = (((u32)data[0x2]) << 8U) | data[0x3];
+    frame_meta->size = __isacfs_preview_get_u32(data + 0x4);
+    frame_meta->sector = __isacfs_preview_get_u32(data + 0x8);
+    frame_meta->offset = __isacfs_preview_get_u32(data + 0xC);
+    frame_meta->sequence = __isacfs_preview_get_u32(data + 0x10);
+    return true;
+}
+
+esp_err_t isacfs_preview_open(isacfs_preview_t** preview, isacfs_t* previews, const isacfs_preview_config_t* config){
+    if(!previews || (config->every_nth && (!config->width || !config->height || !config->bytes_per_pixel || !config->factor))){
+        return ESP_ERR_INVALID_ARG;
+    }
+    isacfs_preview_t* pv = (isacfs_preview_t*)calloc(0x1, sizeof(isacfs_preview_t));
+    if(!pv){
+        return ESP_ERR_NO_MEM;
+    }
+    pv->previews = previews;
+    pv->config = *config;
+    if(config->every_nth){
+        pv->thumb_size = (config->width / config->factor) * (config->height / config->factor) * config->bytes_per_pixel;
+        pv->thumb = (u8*)isacfs_dma_alloc(pv->thumb_size ? pv->thumb_size : 0x1);
+        if(!pv->thumb){
+            free(pv);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    *preview = pv;
+    return ESP_OK;
+}
+
+void isacfs_preview_close(isacfs_preview_t* preview){
+    isacfs_dma_free(preview->thumb);
+    free(preview);
+}
+
+/**
+ * @brief Every factor-th pixel of every factor-th row of a raw frame into "preview->thumb"
+*/
+static void __isacfs_preview_decimate(isacfs_preview_t* preview, const u8* frame){
+    const isacfs_preview_config_t* c = &preview->config;
+    u32 row_bytes = c->width * c->bytes_per_pixel;
+    u8* out = preview->thumb;
+    for(u32 y = 0x0; y + c->factor <= c->height; y += c->factor){
+        const u8* row = frame + (size_t)y * row_bytes;
+        for(u32 x = 0x0; x + c->factor <= c->width; x += c->factor){
+            memcpy(out, row + x * c->bytes_per_pixel, c->bytes_per_pixel);
+            out += c->bytes_per_pixel;
+        }
+    }
+}
+
+esp_err_t isacfs_preview_write_file(isacfs_preview_t* preview, isacfs_file_meta* file_meta, const u8* buffer, u32 buf_sz, const u8* thumb, u32 thumb_sz){
+    esp_err_t res = isacfs_write_file(file_meta, buffer, buf_sz);
+    if(res != ESP_OK){
+        return res;
+    }
+    u8 flags = 0x0;
+    bool nth = preview->config.every_nth && preview->frames++ % preview->config.every_nth == 0x0;
+    if(!thumb){
+        if(!nth){
+            return ESP_OK;
+        }
+        const isacfs_preview_config_t* c = &preview->config;
+        if((u64)c->width * c->height * c->bytes_per_pixel > buf_sz){
+            return ESP_ERR_INVALID_SIZE; // not a raw frame of the configured geometry
+        }
+        __isacfs_preview_decimate(preview, buffer);
+        thumb = preview->thumb;
+        thumb_sz = preview->thumb_size;
+        flags = PREVIEW_DECIMATED;
+    }
+
+    /* the preview goes under the key of the frame, its header points at the data of the frame */
+    u8 header[ISACFS_PREVIEW_HEADER_SIZE];
+    __isacfs_preview_put_header(header, file_meta, buf_sz, flags);
+    isacfs_iovec_t iov[0x2] = { { header, ISACFS_PREVIEW_HEADER_SIZE }, { thumb, thumb_sz } };
+    isacfs_file_meta preview_meta = *file_meta;
+    preview_meta.sector = UNKNOWN_SECTOR;
+    preview_meta.offset = UNKNOWN_OFFSET;
+    isacfs_t* caller = isacfs_bind(preview->previews);
+    res = isacfs_write_filev(&preview_meta, iov, thumb_sz ? 0x2 : 0x1);
+    isacfs_bind(caller);
+    return res;
+}
+
+esp_err_t isacfs_preview_sync(isacfs_preview_t* preview){
+    isacfs_t* caller = isacfs_bind(preview->previews);
+    esp_err_t res = isacfs_sync();
+    isacfs_bind(caller);
+    return res;
+}
+
+/**
+ * @brief Hand a stored preview to the callback of "isacfs_preview_range", on the instance of the caller
+*/
+static bool __isacfs_preview_range_cb(const isacfs_file_meta* file_meta, const u8* data, u32 size, void* user){
+    isacfs_preview_range_t* range = (isacfs_preview_range_t*)user;
+    isacfs_file_meta frame_meta = *file_meta;
+    const u8* thumb = NULL;
+    if(data){
+        if(!__isacfs_preview_get_header(data, size, &frame_meta)){
+            return true; // not a preview
+        }
+        thumb = data + ISACFS_PREVIEW_HEADER_SIZE;
+    }
+    else {
+        frame_meta.sector = UNKNOWN_SECTOR;
+        frame_meta.offset = UNKNOWN_OFFSET;
+        frame_meta.size = 0x0;
+    }
+    u32 thumb_sz = size > ISACFS_PREVIEW_HEADER_SIZE ? size - ISACFS_PREVIEW_HEADER_SIZE : 0x0;
+    isacfs_bind(range->caller);
+    bool more = range->cb(&frame_meta, thumb, thumb_sz, range->user);
+    isacfs_bind(range->previews);
+    return more;
+}
+
+esp_err_t isacfs_preview_range(isacfs_preview_t* preview, const isacfs_file_meta* t_begin, const isacfs_file_meta* t_end, u8* buffer, u32 buffer_size,
+                               isacfs_preview_cb_t cb, void* user){
+    isacfs_preview_range_t range;
+    range.caller = isacfs_bind(preview->previews);
+    range.previews = preview->previews;
+    range.cb = cb;
+    range.user = user;
+    esp_err_t res = isacfs_read_range(t_begin, t_end, buffer, buffer_size, __isacfs_preview_range_cb, &range);
+    isacfs_bind(range.caller);
+    return res;
+}
+
+esp_err_t isacfs_preview_read(isacfs_preview_t* preview, const isacfs_file_meta* frame_meta, u8* out, u32 out_size, u32* thumb_sz){
+    bool known = !(frame_meta->sector == UNKNOWN_SECTOR && frame_meta->offset == UNKNOWN_OFFSET);
+    isacfs_t* caller = isacfs_bind(preview->previews);
+    isacfs_file_meta key_meta = *frame_meta;
+    if(isacfs_desc_size() != 0x10){
+        key_meta.millisecond = 0x0; // 8B descriptors don't store it
+    }
+    u64 key = isacfs_pack_timestamp(&key_meta);
+
+    /* the previews of the frames sharing the timestamp (8B descriptors - the second) follow each other */
+    u32 meta_sector = UNKNOWN_SECTOR;
+    u32 meta_offset = UNKNOWN_OFFSET;
+    u32 head_sector;
+    u32 head_offset;
+    isacfs_head_meta(&head_sector, &head_offset);
+    esp_err_t res;
+    while(true){
+        isacfs_file_meta preview_meta = key_meta;
+        u32 size;
+        res = isacfs_file_desc(&preview_meta, &size, &meta_sector, &meta_offset);
+        if(res != ESP_OK){
+            break;
+        }
+        if(isacfs_pack_timestamp(&preview_meta) != key || size < ISACFS_PREVIEW_HEADER_SIZE){
+            res = ESP_ERR_NOT_FOUND;
+            break;
+        }
+        preview_meta.size = size;
+        u8 header[ISACFS_PREVIEW_HEADER_SIZE];
+        isacfs_file_meta linked = preview_meta;
+        res = isacfs_read_file(preview_meta, header, 0x0, ISACFS_PREVIEW_HEADER_SIZE);
+        if(res != ESP_OK){
+            break;
+        }
+        if(__isacfs_preview_get_header(header, ISACFS_PREVIEW_HEADER_SIZE, &linked)
+           && (!known || (linked.sector == frame_meta->sector && linked.offset == frame_meta->offset))){
+            *thumb_sz = size - ISACFS_PREVIEW_HEADER_SIZE;
+            res = *thumb_sz > out_size ? ESP_ERR_INVALID_SIZE : isacfs_read_file(preview_meta, out, ISACFS_PREVIEW_HEADER_SIZE, *thumb_sz);
+            break;
+        }
+        isacfs_next_meta(&meta_sector, &meta_offset);
+        if(meta_sector == head_sector && meta_offset == head_offset){
+            res = ESP_ERR_NOT_FOUND;
+            break;
+        }
+    }
+    isacfs_bind(caller);
+    return res;
+}
@@ -0,0 +1,111 @@
+#include "isacfs_stats.hpp"
+
+#define STATS_DUMP_VERSION 0x2
+
+#ifdef ISACFS_STATS
+isacfs_stats_t __isacfs_stats;
+
+/**
+ * @brief Account one call of "op" that took "elapsed_us" microseconds
+*/
+void __isacfs_stats_op(isacfs_op_t op, u64 elapsed_us, bool ok){
+    u32 us = (u32)elapsed_us;
+    isacfs_op_stats_t* op_stats = __isacfs_stats.ops + op;
+    op_stats->count++;
+    if(!ok){
+        op_stats->errors++;
+    }
+    op_stats->total_us += us;
+    if(us > op_stats->max_us){
+        op_stats->max_us = us;
+    }
+    u32 bucket = us ? 31U - __builtin_clz(us) : 0x0;
+    op_stats->hist[bucket < ISACFS_STATS_BUCKETS ? bucket : ISACFS_STATS_BUCKETS - 0x1]++;
+}
+
+esp_err_t isacfs_stats_snapshot(isacfs_stats_t* stats){
+    memcpy(stats, &__isacfs_stats, sizeof(isacfs_stats_t));
+    return ESP_OK;
+}
+
+void isacfs_stats_reset(){
+    memset(&__isacfs_stats, 0x0, sizeof(isacfs_stats_t));
+}
+#else
+esp_err_t isacfs_stats_snapshot(isacfs_stats_t* stats){
+    memset(stats, 0x0, sizeof(isacfs_stats_t));
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void isacfs_stats_reset(){
+}
+#endif
+
+/**
+ * @brief Append "v" as an unsigned LEB128 varint
+ * @returns false if it doesn't fit
+*/
+static bool __isacfs_stats_put_varint(u8* out, size_t out_size, size_t* pos, u64 v){
+    do {
+        if(*pos >= out_size){
+            return false;
+        }
+        u8 byte = v & 0x7F;
+        v >>= 0x7;
+        out[(*pos)++] = byte | (v ? 0x80 : 0x0);
+    } while(v);
+    return true;
+}
+
+size_t isacfs_stats_dump(const isacfs_stats_t* stats, u8* out, size_t out_size){
+    if(out_size < 0x3){
+        return 0x0;
+    }
+    size_t pos = 0x0;
+    out[pos++] = 'I';
+    out[pos++] = 'S';
+    out[pos++] = STATS_DUMP_VERSION;
+    bool ok = __isacfs_stats_put_varint(out, out_size, &pos, stats->sectors_read)
+              && __isacfs_stats_put_varint(out, out_size, &pos, stats->sectors_written)
+              && __isacfs_stats_put_varint(out, out_size, &pos, stats->sectors_erased)
+              && __isacfs_stats_put_varint(out, out_size, &pos, stats->rmw_cycles)
+              && __isacfs_stats_put_varint(out, out_size, &pos, stats->marker_shifts)
+              && __isacfs_stats_put_varint(out, out_size, &pos, stats->journal_flushes)
+              && __isacfs_stats_put_varint(out, out_size, &pos, stats->bounced_sectors)
+              && __isacfs_stats_put_varint(out, out_size, &pos, stats->pool_misses);
+    for(u32 op = 0x0; ok && op < ISACFS_OP_COUNT; op++){
+        const isacfs_op_stats_t* op_stats = stats->ops + op;
+        ok = __isacfs_stats_put_varint(out, out_size, &pos, op_stats->count)
+             && __isacfs_stats_put_varint(out, out_size, &pos, op_stats->errors)
+             && __isacfs_stats_put_varint(out, out_size, &pos, op_stats->total_us)
+             && __isacfs_stats_put_varint(out, out_size, &pos, op_stats->max_us);
+        for(u32 i = 0x0; ok && i < ISACFS_STATS_BUCKETS; i++){
+            ok = __isacfs_stats_put_varint(out, out_size, &pos, op_stats->hist[i]);
+        }
+    }
+    return ok ? pos : 0x0;
+}
+
+void isacfs_stats_print(const isacfs_stats_t* stats){
+    static const char* const OP_NAMES[ISACFS_OP_COUNT] = {
+        "write_file", "read_file", "file_desc", "format", "init", "card_read", "card_write", "card_erase"
+    };
+    Serial.printf("ISACFS STATS\r\nsectors rd/wr/erased: %llu/%llu/%llu\r\nrmw: %u, marker shifts: %u, journal flushes: %u\r\nbounced sectors: %llu, pool misses: %u\r\n",
+                  (unsigned long long)stats->sectors_read, (unsigned long long)stats->sectors_written, (unsigned long long)stats->sectors_erased,
+                  stats->rmw_cycles, stats->marker_shifts, stats->journal_flushes,
+                  (unsigned long long)stats->bounced_sectors, stats->pool_misses);
+    for(u32 op = 0x0; op < ISACFS_OP_COUNT; op++){
+        const isacfs_op_stats_t* op_stats = stats->ops + op;
+        if(!op_stats->count){
+            continue;
+        }
+        Serial.printf("%s: n=%u err=%u avg=%lluus max=%uus |", OP_NAMES[op], op_stats->count, op_stats->errors,
+                      (unsigned long long)(op_stats->total_us / op_stats->count), op_stats->max_us);
+        for(u32 i = 0x0; i < ISACFS_STATS_BUCKETS; i++){
+            if(op_stats->hist[i]){
+                Serial.printf(i + 0x1 < ISACFS_STATS_BUCKETS ? " <%lu:%u" : " >=%lu:%u", i + 0x1 < ISACFS_STATS_BUCKETS ? 0x2UL << i : 0x1UL << i, op_stats->hist[i]);
+            }
+        }
+        Serial.println();
+    }
+}
@@ -0,0 +1,487 @@
+#include "isacfs_streams.hpp"
+#include "isacfs_os.hpp"
+#include <atomic>
+#include <new>
+
+#define STREAMS_MAGIC 0x49535354U // "ISST"
+#define STREAMS_VERSION 0x1
+#define STREAMS_TABLE_SECTOR 0x1
+#define STREAMS_HEADER_SIZE (0x10 + 0x4 * ISACFS_MAX_STREAMS)
+#define STREAMS_ENTRY_SIZE 0x4
+#define STREAMS_MAX_EXTENTS 0xFFFFU // a stream maps its extents to the physical extent + 1 in 16 bits
+#define STREAMS_SCAN_SECTORS 0x8 // extent table sectors read at once
+#define STREAMS_CLEAR_SECTORS 0x40 // zeroes written at once on a card without the erase command
+#define NO_EXTENT 0xFFFFFFFFU
+
+typedef struct {
+    isacfs_streams_t* streams;
+    u32 id;
+    u32 extents_count; // logical extents - the size of the device of the stream
+    std::atomic<uint16_t>* map; // logical extent -> physical extent + 1 (0 - not claimed yet), written by the writer of the stream only
+    std::atomic<u32> claimed;
+    micro_sd_backend_t backend; // the device of the stream
+    isacfs_t* fs;
+} isacfs_stream_dev_t;
+
+struct isacfs_streams {
+    const micro_sd_backend_t* card;
+    u32 sector_size;
+    u32 streams_count;
+    u32 extent_shift; // sectors per extent, log2
+    u32 extents_count;
+    u32 first_extent_sector;
+    isacfs_mutex_t* lock; // claiming extents - guards the members below
+    u32* used; // physical extents in use, a bit each
+    u32 free_count;
+    u32 cursor; // the next claim looks from here on, so that the claims of the streams interleave in the card order
+    u8* table_buf; // a sector of the extent table
+    isacfs_stream_dev_t stream[ISACFS_MAX_STREAMS];
+};
+
+static u32 __isacfs_streams_get_u32(const u8* p){
+    return (((u32)p[0x0]) << 24U) | (((u32)p[0x1]) << 16U) | (((u32)p[0x2]) << 8U) | p[0x3];
+}
+
+static void __isacfs_streams_put_u32(u8* p, u32 v){
+    p[0x0] = (u8)(v >> 24U);
+    p[0x1] = (u8)(v >> 16U);
+    p[0x2] = (u8)(v >> 8U);
+    p[0x3] = (u8)v;
+}
+
+static u32 __isacfs_streams_table_sectors(u32 extents_count, u32 sector_size){
+    return (u32)(((u64)extents_count * STREAMS_ENTRY_SIZE + sector_size - 0x1) / sector_size);
+}
+
+/**
+ * @brief Zeroes on the card sectors (erased if the card can)
+*/
+static esp_err_t __isacfs_streams_clear(const micro_sd_backend_t* card, u32 sector_size, size_t start_sector, size_t sector_count){
+    esp_err_t res = micro_sd_erase_sectors_on(card, start_sector, sector_count);
+    if(res != ESP_ERR_NOT_SUPPORTED){
+        return res;
+    }
+    size_t chunk = sector_count < STREAMS_CLEAR_SECTORS ? sector_count : STREAMS_CLEAR_SECTORS;
+    u8* zero = (u8*)isacfs_dma_alloc(chunk * sector_size);
+    if(!zero){
+        return ESP_ERR_NO_MEM;
+    }
+    memset(zero, 0x0, chunk * sector_size);
+    res = ESP_OK;
+    while(sector_count && res == ESP_OK){
+        size_t n = sector_count < chunk ? sector_count : chunk;
+        res = micro_sd_write_sectors_on(card, zero, start_sector, n);
+        start_sector += n;
+        sector_count -= n;
+    }
+    isacfs_dma_free(zero);
+    return res;
+}
+
+/**
+ * @brief Point the extent table entry of the physical extent "physical" at the logical extent "logical" of "stream"
+ * @param stream NO_EXTENT - free the entry
+ * @note Under "streams->lock"
+*/
+static esp_err_t __isacfs_streams_put_entry(isacfs_streams_t* streams, u32 physical, u32 stream, u32 logical){
+    u32 at = physical * STREAMS_ENTRY_SIZE;
+    size_t sector = STREAMS_TABLE_SECTOR + at / streams->sector_size;
+    esp_err_t res = micro_sd_read_sectors_on(streams->card, streams->table_buf, sector, 0x1);
+    if(res != ESP_OK){
+        return res;
+    }
+    __isacfs_streams_put_u32(streams->table_buf + at % streams->sector_size, stream == NO_EXTENT ? 0x0 : ((stream + 0x1) << 24U) | logical);
+    return micro_sd_write_sectors_on(streams->card, streams->table_buf, sector, 0x1);
+}
+
+/**
+ * @brief Physical extent of the logical extent "logical" of the stream
+ * @param claim take a free extent for it (cleared, then recorded in the extent table) if it has none yet
+ * @param[out] physical NO_EXTENT - none (reads as zeroes)
+ * @returns ESP_ERR_NO_MEM if the card is full
+*/
+static esp_err_t __isacfs_streams_extent(isacfs_stream_dev_t* st, u32 logical, bool claim, u32* physical){
+    uint16_t entry = st->map[logical].load(std::memory_order_acquire);
+    if(entry || !claim){
+        *physical = entry ? entry - 0x1U : NO_EXTENT;
+        return ESP_OK;
+    }
+    isacfs_streams_t* s = st->streams;
+
+    isacfs_mutex_lock(s->lock);
+    u32 p = NO_EXTENT;
+    for(u32 i = 0x0; i < s->extents_count && s->free_count; i++){
+        u32 candidate = s->cursor + i < s->extents_count ? s->cursor + i : s->cursor + i - s->extents_count;
+        if(!(s->used[candidate >> 0x5] & (0x1U << (candidate & 0x1F)))){
+            p = candidate;
+            break;
+        }
+    }
+    if(p == NO_EXTENT){
+        isacfs_mutex_unlock(s->lock);
+        Serial.println("ERROR NO FREE EXTENT LEFT ON THE CARD [in __isacfs_streams_extent()]");
+        return ESP_ERR_NO_MEM;
+    }
+    s->used[p >> 0x5] |= 0x1U << (p & 0x1F);
+    s->free_count--;
+    s->cursor = p + 0x1 < s->extents_count ? p + 0x1 : 0x0;
+    isacfs_mutex_unlock(s->lock);
+
+    /* stale sectors of another stream (or of an earlier format) must not pass for descriptors of this one */
+    esp_err_t res = __isacfs_streams_clear(s->card, s->sector_size, s->first_extent_sector + ((size_t)p << s->extent_shift), (size_t)0x1 << s->extent_shift);
+    isacfs_mutex_lock(s->lock);
+    if(res == ESP_OK){
+        res = __isacfs_streams_put_entry(s, p, st->id, logical);
+    }
+    if(res != ESP_OK){
+        s->used[p >> 0x5] &= ~(0x1U << (p & 0x1F));
+        s->free_count++;
+    }
+    isacfs_mutex_unlock(s->lock);
+    if(res != ESP_OK){
+        return res;
+    }
+    st->map[logical].store((uint16_t)(p + 0x1), std::memory_order_release);
+    st->claimed.fetch_add(0x1, std::memory_order_relaxed);
+    *physical = p;
+    return ESP_OK;
+}
+
+/**
+ * @brief The longest run of the device sectors from "start" (up to "count") that is contiguous on the card
+ * @param[out] card_sector first sector of the run on the card (NO_EXTENT - the run isn't claimed)
+ * @param[out] run the length of the run
+*/
+static esp_err_t __isacfs_streams_run(isacfs_stream_dev_t* st, size_t start, size_t count, bool claim, size_t* card_sector, size_t* run){
+    isacfs_streams_t* s = st->streams;
+    size_t extent_sectors = (size_t)0x1 << s->extent_shift;
+    if(start + count > ((size_t)st->extents_count << s->extent_shift)){
+        return ESP_ERR_INVALID_ARG;
+    }
+    u32 logical = (u32)(start >> s->extent_shift);
+    u32 physical;
+    esp_err_t res = __isacfs_streams_extent(st, logical, claim, &physical);
+    if(res != ESP_OK){
+        return res;
+    }
+    size_t in_extent = extent_sectors - (start & (extent_sectors - 0x1));
+    *run = count < in_extent ? count : in_extent;
+    if(physical == NO_EXTENT){
+        *card_sector = NO_EXTENT;
+        return ESP_OK;
+    }
+    *card_sector = s->first_extent_sector + ((size_t)physical << s->extent_shift) + (start & (extent_sectors - 0x1));
+    while(*run < count){
+        u32 next;
+        if(__isacfs_streams_extent(st, ++logical, claim, &next) != ESP_OK || next != ++physical){
+            break; // an error comes up again with the next run
+        }
+        *run += count - *run < extent_sectors ? count - *run : extent_sectors;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t __isacfs_stream_read_sectors(void* ctx, void* dst, size_t start_sector, size_t sector_count){
+    isacfs_stream_dev_t* st = (isacfs_stream_dev_t*)ctx;
+    u8* to = (u8*)dst;
+    while(sector_count){
+        size_t card_sector, run;
+        esp_err_t res = __isacfs_streams_run(st, start_sector, sector_count, false, &card_sector, &run);
+        if(res == ESP_OK){
+            if(card_sector == NO_EXTENT){
+                memset(to, 0x0, run * st->streams->sector_size);
+            }
+            else {
+                res = micro_sd_read_sectors_on(st->streams->card, to, card_sector, run);
+            }
+        }
+        if(res != ESP_OK){
+            return res;
+        }
+        to += run * st->streams->sector_size;
+        start_sector += run;
+        sector_count -= run;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t __isacfs_stream_write_sectors(void* ctx, const void* src, size_t start_sector, size_t sector_count){
+    isacfs_stream_dev_t* st = (isacfs_stream_dev_t*)ctx;
+    const u8* from = (const u8*)src;
+    while(sector_count){
+        size_t card_sector, run;
+        esp_err_t res = __isacfs_streams_run(st, start_sector, sector_count, true, &card_sector, &run);
+        if(res == ESP_OK){
+            res = micro_sd_write_sectors_on(st->streams->card, from, card_sector, run);
+        }
+        if(res != ESP_OK){
+            return res;
+        }
+        from += run * st->streams->sector_size;
+        start_sector += run;
+        sector_count -= run;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @note The extents not claimed yet read as zeroes already - clearing them doesn't claim them
+*/
+static esp_err_t __isacfs_stream_erase_sectors(void* ctx, size_t start_sector, size_t sector_count){
+    isacfs_stream_dev_t* st = (isacfs_stream_dev_t*)ctx;
+    while(sector_count){
+        size_t card_sector, run;
+        esp_err_t res = __isacfs_streams_run(st, start_sector, sector_count, false, &card_sector, &run);
+        if(res == ESP_OK && card_sector != NO_EXTENT){
+            res = __isacfs_streams_clear(st->streams->card, st->streams->sector_size, card_sector, run);
+        }
+        if(res != ESP_OK){
+            return res;
+        }
+        start_sector += run;
+        sector_count -= run;
+    }
+    return ESP_OK;
+}
+
+static int __isacfs_stream_get_sectors_count(void* ctx){
+    isacfs_stream_dev_t* st = (isacfs_stream_dev_t*)ctx;
+    return (int)((size_t)st->extents_count << st->streams->extent_shift);
+}
+
+static int __isacfs_stream_get_sector_size(void* ctx){
+    return (int)((isacfs_stream_dev_t*)ctx)->streams->sector_size;
+}
+
+static uint64_t __isacfs_stream_clock_us(void* ctx){
+    return micro_sd_clock_us_on(((isacfs_stream_dev_t*)ctx)->streams->card);
+}
+
+static void __isacfs_stream_print_info(void* ctx){
+    isacfs_stream_dev_t* st = (isacfs_stream_dev_t*)ctx;
+    isacfs_streams_t* s = st->streams;
+    Serial.printf("isacfs stream %u of %u: %u of %u extents (%u sectors each) claimed\n", st->id, s->streams_count,
+                  st->claimed.load(std::memory_order_relaxed), st->extents_count, 0x1U << s->extent_shift);
+    s->card->print_info(s->card->ctx);
+}
+
+esp_err_t isacfs_streams_format(const micro_sd_backend_t* card, u32 streams_count, u32 extent_size, const u32* max_extents){
+    u32 sector_size = (u32)micro_sd_get_sector_size_on(card);
+    size_t sectors_count = (size_t)micro_sd_get_sectors_count_on(card);
+    if(!extent_size){
+        extent_size = ISACFS_STREAMS_DEFAULT_EXTENT_SIZE;
+    }
+    if(!streams_count || streams_count > ISACFS_MAX_STREAMS || extent_size % sector_size || (extent_size & (extent_size - 0x1))){
+        return ESP_ERR_INVALID_ARG;
+    }
+    if(sector_size < STREAMS_HEADER_SIZE){
+        return ESP_ERR_INVALID_SIZE;
+    }
+    u32 extent_shift = 0x0;
+    while((sector_size << extent_shift) < extent_size){
+        extent_shift++;
+    }
+
+    /* the extent table is sized for the whole card, the extents start at the first extent boundary behind it */
+    u32 table_sectors = __isacfs_streams_table_sectors((u32)(sectors_count >> extent_shift), sector_size);
+    size_t extent_sectors = (size_t)0x1 << extent_shift;
+    size_t first_extent_sector = (STREAMS_TABLE_SECTOR + table_sectors + extent_sectors - 0x1) & ~(extent_sectors - 0x1);
+    size_t extents_count = sectors_count > first_extent_sector ? (sectors_count - first_extent_sector) >> extent_shift : 0x0;
+    if(extents_count < streams_count || extents_count > STREAMS_MAX_EXTENTS){
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t res = __isacfs_streams_clear(card, sector_size, STREAMS_TABLE_SECTOR, table_sectors);
+    if(res != ESP_OK){
+        return res;
+    }
+    u8* sector0 = (u8*)isacfs_dma_alloc(sector_size);
+    if(!sector0){
+        return ESP_ERR_NO_MEM;
+    }
+    memset(sector0, 0x0, sector_size);
+    __isacfs_streams_put_u32(sector0 + 0x0, STREAMS_MAGIC);
+    sector0[0x4] = STREAMS_VERSION;
+    sector0[0x5] = (u8)streams_count;
+    sector0[0x6] = (u8)extent_shift;
+    __isacfs_streams_put_u32(sector0 + 0x8, (u32)extents_count);
+    __isacfs_streams_put_u32(sector0 + 0xC, (u32)first_extent_sector);
+    for(u32 i = 0x0; i < streams_count; i++){
+        u32 cap = max_extents && max_extents[i] && max_extents[i] < extents_count ? max_extents[i] : (u32)extents_count;
+        __isacfs_streams_put_u32(sector0 + 0x10 + 0x4 * i, cap);
+    }
+    res = micro_sd_write_sectors_on(card, sector0, 0x0, 0x1);
+    isacfs_dma_free(sector0);
+    return res;
+}
+
+/**
+ * @brief Rebuild the extent maps of the streams and the free extents from the extent table
+*/
+static esp_err_t __isacfs_streams_load_table(isacfs_streams_t* s){
+    u32 table_sectors = __isacfs_streams_table_sectors(s->extents_count, s->sector_size);
+    u32 chunk = table_sectors < STREAMS_SCAN_SECTORS ? table_sectors : STREAMS_SCAN_SECTORS;
+    u8* buf = (u8*)isacfs_dma_alloc((size_t)chunk * s->sector_size);
+    if(!buf){
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t res = ESP_OK;
+    u32 physical = 0x0;
+    for(u32 sector = 0x0; sector < table_sectors && res == ESP_OK; sector += chunk){
+        u32 n = table_sectors - sector < chunk ? table_sectors - sector : chunk;
+        res = micro_sd_read_sectors_on(s->card, buf, STREAMS_TABLE_SECTOR + sector, n);
+        for(u32 at = 0x0; res == ESP_OK && at + STREAMS_ENTRY_SIZE <= n * s->sector_size && physical < s->extents_count; at += STREAMS_ENTRY_SIZE, physical++){
+            u32 entry = __isacfs_streams_get_u32(buf + at);
+            u32 stream = (entry >> 24U) - 0x1;
+            u32 logical = entry & 0xFFFFFFU;
+            if(!entry || stream >= s->streams_count || logical >= s->stream[stream].extents_count || s->stream[stream].map[logical].load(std::memory_order_relaxed)){
+                continue; // free (or torn - it's free as well, the next claim rewrites the entry)
+            }
+            s->stream[stream].map[logical].store((uint16_t)(physical + 0x1), std::memory_order_relaxed);
+            s->stream[stream].claimed.fetch_add(0x1, std::memory_order_relaxed);
+            s->used[physical >> 0x5] |= 0x1U << (physical & 0x1F);
+            s->free_count--;
+        }
+    }
+    isacfs_dma_free(buf);
+    return res;
+}
+
+esp_err_t isacfs_streams_open(isacfs_streams_t** streams, const micro_sd_backend_t* card){
+    isacfs_streams_t* s = new (std::nothrow) isacfs_streams_t();
+    if(!s){
+        return ESP_ERR_NO_MEM;
+    }
+    s->card = card;
+    s->sector_size = (u32)micro_sd_get_sector_size_on(card);
+    s->lock = isacfs_mutex_create();
+    s->table_buf = (u8*)isacfs_dma_alloc(s->sector_size);
+    if(!s->lock || !s->table_buf){
+        isacfs_streams_close(s);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t res = micro_sd_read_sectors_on(card, s->table_buf, 0x0, 0x1);
+    if(res != ESP_OK){
+        isacfs_streams_close(s);
+        return res;
+    }
+    const u8* sector0 = s->table_buf;
+    s->streams_count = sector0[0x5];
+    s->extent_shift = sector0[0x6];
+    s->extents_count = __isacfs_streams_get_u32(sector0 + 0x8);
+    s->first_extent_sector = __isacfs_streams_get_u32(sector0 + 0xC);
+    if(s->sector_size < STREAMS_HEADER_SIZE || __isacfs_streams_get_u32(sector0 + 0x0) != STREAMS_MAGIC || sector0[0x4] != STREAMS_VERSION
+       || !s->streams_count || s->streams_count > ISACFS_MAX_STREAMS || s->extent_shift > 0x18 || !s->extents_count || s->extents_count > STREAMS_MAX_EXTENTS
+       || s->first_extent_sector + ((size_t)s->extents_count << s->extent_shift) > (size_t)micro_sd_get_sectors_count_on(card)){
+        Serial.println("NO STREAM TABLE IN SECTOR 0 [in isacfs_streams_open()]");
+        s->streams_count = 0x0;
+        isacfs_streams_close(s);
+        return ESP_ERR_NOT_FOUND;
+    }
+    s->free_count = s->extents_count;
+    s->used = (u32*)calloc((s->extents_count + 0x1F) >> 0x5, sizeof(u32));
+    if(!s->used){
+        isacfs_streams_close(s);
+        return ESP_ERR_NO_MEM;
+    }
+    for(u32 i = 0x0; i < s->streams_count; i++){
+        isacfs_stream_dev_t* st = s->stream + i;
+        u32 cap = __isacfs_streams_get_u32(sector0 + 0x10 + 0x4 * i);
+        st->streams = s;
+        st->id = i;
+        st->extents_count = cap && cap < s->extents_count ? cap : s->extents_count;
+        st->map = new (std::nothrow) std::atomic<uint16_t>[st->extents_count]();
+        st->backend.read_sectors = __isacfs_stream_read_sectors;
+        st->backend.write_sectors = __isacfs_stream_write_sectors;
+        st->backend.erase_sectors = __isacfs_stream_erase_sectors;
+        st->backend.get_sectors_count = __isacfs_stream_get_sectors_count;
+        st->backend.get_sector_size = __isacfs_stream_get_sector_size;
+        st->backend.print_info = __isacfs_stream_print_info;
+        st->backend.clock_us = __isacfs_stream_clock_us;
+        st->backend.ctx = st;
+        st->fs = st->map ? isacfs_open(&st->backend) : NULL;
+        if(!st->fs){
+            isacfs_streams_close(s);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    res = __isacfs_streams_load_table(s);
+    if(res != ESP_OK){
+        isacfs_streams_close(s);
+        return res;
+    }
+    *streams = s;
+    return ESP_OK;
+}
+
+void isacfs_streams_close(isacfs_streams_t* streams){
+    for(u32 i = 0x0; i < streams->streams_count; i++){
+        if(streams->stream[i].fs){
+            isacfs_close(streams->stream[i].fs);
+        }
+        delete[] streams->stream[i].map;
+    }
+    free(streams->used);
+    isacfs_dma_free(streams->table_buf);
+    if(streams->lock){
+        isacfs_mutex_destroy(streams->lock);
+    }
+    delete streams;
+}
+
+u32 isacfs_streams_count(const isacfs_streams_t* streams){
+    return streams->streams_count;
+}
+
+isacfs_t* isacfs_stream(isacfs_streams_t* streams, u32 stream){
+    return stream < streams->streams_count ? streams->stream[stream].fs : NULL;
+}
+
+u32 isacfs_streams_extents(const isacfs_streams_t* streams, u32 stream){
+    if(stream == ISACFS_MAX_STREAMS){
+        isacfs_mutex_lock(streams->lock);
+        u32 free_count = streams->free_count;
+        isacfs_mutex_unlock(streams->lock);
+        return free_count;
+    }
+    return stream < streams->streams_count ? streams->stream[stream].claimed.load(std::memory_order_relaxed) : 0x0;
+}
+
+esp_err_t isacfs_streams_reset(isacfs_streams_t* streams, u32 stream){
+    if(stream >= streams->streams_count){
+        return ESP_ERR_INVALID_ARG;
+    }
+    isacfs_stream_dev_t* st = streams->stream + stream;
+    esp_err_t res = ESP_OK;
+    isacfs_mutex_lock(streams->lock);
+    /* the entries of the stream go a table sector at a time */
+    u32 table_sectors = __isacfs_streams_table_sectors(streams->extents_count, streams->sector_size);
+    for(u32 sector = 0x0; sector < table_sectors && res == ESP_OK; sector++){
+        res = micro_sd_read_sectors_on(streams->card, streams->table_buf, STREAMS_TABLE_SECTOR + sector, 0x1);
+        bool dirty = false;
+        for(u32 at = 0x0; res == ESP_OK && at < streams->sector_size; at += STREAMS_ENTRY_SIZE){
+            if(streams->table_buf[at] == stream + 0x1){
+                memset(streams->table_buf + at, 0x0, STREAMS_ENTRY_SIZE);
+                dirty = true;
+            }
+        }
+        if(res == ESP_OK && dirty){
+            res = micro_sd_write_sectors_on(streams->card, streams->table_buf, STREAMS_TABLE_SECTOR + sector, 0x1);
+        }
+    }
+    if(res == ESP_OK){
+        for(u32 logical = 0x0; logical < st->extents_count; logical++){
+            uint16_t entry = st->map[logical].load(std::memory_order_relaxed);
+            if(entry){
+                u32 physical = entry - 0x1U;
+                st->map[logical].store(0x0, std::memory_order_relaxed);
+                streams->used[physical >> 0x5] &= ~(0x1U << (physical & 0x1F));
+                streams->free_count++;
+            }
+        }
+        st->claimed.store(0x0, std::memory_order_relaxed);
+    }
+    isacfs_mutex_unlock(streams->lock);
+    return res;
+}
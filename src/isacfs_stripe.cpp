@@ -0,0 +1,277 @@
+#include "isacfs_stripe.hpp"
+
+#define NO_CARD 0xFFFFFFFFU
+
+struct isacfs_stripe {
+    u32 cards_count;
+    u32 frames_per_card;
+    isacfs_t** fs; // an instance per card
+    isacfs_writer_t** writers; // NULL until "isacfs_stripe_start"
+    u32 card; // whose turn it is
+    u32 card_sent; // frames queued for "card" in this turn
+};
+
+/* next frame of a card */
+typedef struct {
+    bool valid;
+    esp_err_t res;
+    isacfs_file_meta file_meta;
+    const u8* data;
+    u64 timestamp; // packed
+} isacfs_stripe_head_t;
+
+struct isacfs_stripe_iter {
+    isacfs_stripe_t* stripe;
+    isacfs_iter_t** iters;
+    isacfs_stripe_head_t* heads;
+    u32 last; // card handed out last - its iterator moves on at the next call (the data stays valid until then)
+    u32 turn_card; // the rotation, to order the frames with equal timestamps
+    u32 turn_left;
+};
+
+esp_err_t isacfs_stripe_open(isacfs_stripe_t** stripe, const micro_sd_backend_t* const* cards, u32 cards_count, u32 frames_per_card){
+    if(!cards_count){
+        return ESP_ERR_INVALID_ARG;
+    }
+    isacfs_stripe_t* s = (isacfs_stripe_t*)calloc(0x1, sizeof(isacfs_stripe_t));
+    if(!s){
+        return ESP_ERR_NO_MEM;
+    }
+    s->cards_count = cards_count;
+    s->frames_per_card = frames_per_card ? frames_per_card : 0x1;
+    s->fs = (isacfs_t**)calloc(cards_count, sizeof(isacfs_t*));
+    if(!s->fs){
+        isacfs_stripe_close(s);
+        return ESP_ERR_NO_MEM;
+    }
+    for(u32 i = 0x0; i < cards_count; i++){
+        s->fs[i] = isacfs_open(cards[i]);
+        if(!s->fs[i]){
+            isacfs_stripe_close(s);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    *stripe = s;
+    return ESP_OK;
+}
+
+isacfs_err_t isacfs_stripe_init(isacfs_stripe_t* stripe){
+    isacfs_err_t res = isacfs_ok;
+    isacfs_t* caller = isacfs_current();
+    for(u32 i = 0x0; i < stripe->cards_count; i++){
+        isacfs_bind(stripe->fs[i]);
+        isacfs_err_t card_res = isacfs_init();
+        if(res == isacfs_ok){
+            res = card_res;
+        }
+    }
+    isacfs_bind(caller);
+    stripe->card = 0x0;
+    stripe->card_sent = 0x0;
+    return res;
+}
+
+esp_err_t isacfs_stripe_format(isacfs_stripe_t* stripe, isacfs_format_mode_t mode, isacfs_layout_t layout, u32 avg_file_size, isacfs_desc_format_t desc_format){
+    esp_err_t res = ESP_OK;
+    isacfs_t* caller = isacfs_current();
+    for(u32 i = 0x0; i < stripe->cards_count && res == ESP_OK; i++){
+        isacfs_bind(stripe->fs[i]);
+        res = isacfs_format(mode, layout, avg_file_size, desc_format);
+    }
+    isacfs_bind(caller);
+    return res;
+}
+
+/**
+ * @brief Stop the writer tasks that were started && forget them
+*/
+static void __isacfs_stripe_stop_writers(isacfs_stripe_t* stripe){
+    for(u32 i = 0x0; i < stripe->cards_count; i++){
+        if(stripe->writers[i]){
+            isacfs_writer_stop(stripe->writers[i]);
+        }
+    }
+    free(stripe->writers);
+    stripe->writers = NULL;
+}
+
+esp_err_t isacfs_stripe_start(isacfs_stripe_t* stripe, u32 queue_len, u32 stack_size, u32 priority){
+    if(stripe->writers){
+        return ESP_ERR_INVALID_STATE;
+    }
+    stripe->writers = (isacfs_writer_t**)calloc(stripe->cards_count, sizeof(isacfs_writer_t*));
+    if(!stripe->writers){
+        return ESP_ERR_NO_MEM;
+    }
+    for(u32 i = 0x0; i < stripe->cards_count; i++){
+        esp_err_t res = isacfs_writer_start(stripe->writers + i, stripe->fs[i], queue_len, stack_size, priority);
+        if(res != ESP_OK){
+            __isacfs_stripe_stop_writers(stripe); // all of them or none - "isacfs_stripe_start" can be retried
+            return res;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t isacfs_stripe_write_file(isacfs_stripe_t* stripe, const isacfs_file_meta* file_meta, const u8* buffer, u32 buf_sz, isacfs_write_cb_t cb, void* user){
+    if(!stripe->writers){
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t res = isacfs_writer_submit(stripe->writers[stripe->card], file_meta, buffer, buf_sz, cb, user);
+    if(res != ESP_OK){
+        return res;
+    }
+    if(++stripe->card_sent >= stripe->frames_per_card){
+        stripe->card_sent = 0x0;
+        stripe->card = stripe->card + 0x1 < stripe->cards_count ? stripe->card + 0x1 : 0x0;
+    }
+    return res;
+}
+
+esp_err_t isacfs_stripe_flush(isacfs_stripe_t* stripe){
+    if(!stripe->writers){
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t res = ESP_OK;
+    for(u32 i = 0x0; i < stripe->cards_count; i++){
+        esp_err_t card_res = isacfs_writer_flush(stripe->writers[i]);
+        if(res == ESP_OK){
+            res = card_res;
+        }
+    }
+    return res;
+}
+
+isacfs_t* isacfs_stripe_card(isacfs_stripe_t* stripe, u32 card){
+    return card < stripe->cards_count ? stripe->fs[card] : NULL;
+}
+
+void isacfs_stripe_close(isacfs_stripe_t* stripe){
+    if(stripe->writers){
+        __isacfs_stripe_stop_writers(stripe);
+    }
+    if(stripe->fs){
+        for(u32 i = 0x0; i < stripe->cards_count; i++){
+            if(stripe->fs[i]){
+                isacfs_close(stripe->fs[i]);
+            }
+        }
+        free(stripe->fs);
+    }
+    free(stripe);
+}
+
+/**
+ * @brief Take the next frame of "card" into its head
+*/
+static void __isacfs_stripe_iter_pull(isacfs_stripe_iter_t* it, u32 card){
+    isacfs_stripe_head_t* head = it->heads + card;
+    head->valid = false;
+    if(!it->iters[card]){
+        return;
+    }
+    head->res = isacfs_iter_next(it->iters[card], &head->file_meta, &head->data);
+    if(head->res == ESP_ERR_NOT_FOUND){
+        return; // the card is through
+    }
+    head->valid = true;
+    head->timestamp = head->res == ESP_OK || head->res == ESP_ERR_INVALID_SIZE ? isacfs_pack_timestamp(&head->file_meta) : 0x0; // errors come out first
+}
+
+esp_err_t isacfs_stripe_iter_open(isacfs_stripe_iter_t** iter, isacfs_stripe_t* stripe, const isacfs_file_meta* key, u32 max_frame_size){
+    isacfs_stripe_iter_t* it = (isacfs_stripe_iter_t*)calloc(0x1, sizeof(isacfs_stripe_iter_t));
+    if(!it){
+        return ESP_ERR_NO_MEM;
+    }
+    it->stripe = stripe;
+    it->last = NO_CARD;
+    it->turn_card = stripe->cards_count - 0x1; // card 0 goes first
+    it->iters = (isacfs_iter_t**)calloc(stripe->cards_count, sizeof(isacfs_iter_t*));
+    it->heads = (isacfs_stripe_head_t*)calloc(stripe->cards_count, sizeof(isacfs_stripe_head_t));
+    if(!it->iters || !it->heads){
+        isacfs_stripe_iter_close(it);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t res = ESP_OK;
+    isacfs_t* caller = isacfs_current();
+    for(u32 i = 0x0; i < stripe->cards_count; i++){
+        isacfs_bind(stripe->fs[i]);
+        u32 meta_sector = UNKNOWN_SECTOR;
+        u32 meta_offset = UNKNOWN_OFFSET;
+        if(key){
+            res = isacfs_find_meta(key, &meta_sector, &meta_offset);
+            if(res == ESP_ERR_NOT_FOUND){
+                res = ESP_OK; // nothing that new on this card
+                continue;
+            }
+            if(res != ESP_OK){
+                break;
+            }
+        }
+        res = isacfs_iter_open(it->iters + i, meta_sector, meta_offset, true, max_frame_size);
+        if(res != ESP_OK){
+            break;
+        }
+    }
+    isacfs_bind(caller);
+    if(res != ESP_OK){
+        isacfs_stripe_iter_close(it);
+        return res;
+    }
+    for(u32 i = 0x0; i < stripe->cards_count; i++){
+        __isacfs_stripe_iter_pull(it, i);
+    }
+    *iter = it;
+    return ESP_OK;
+}
+
+esp_err_t isacfs_stripe_iter_next(isacfs_stripe_iter_t* it, isacfs_file_meta* file_meta, const u8** data, u32* card){
+    u32 cards_count = it->stripe->cards_count;
+    if(it->last != NO_CARD){
+        __isacfs_stripe_iter_pull(it, it->last);
+        it->last = NO_CARD;
+    }
+
+    /* the oldest head, ties go to the card whose turn it is (or the first one after it) */
+    u32 turn = it->turn_left ? it->turn_card : (it->turn_card + 0x1) % cards_count;
+    u32 best = NO_CARD;
+    for(u32 i = 0x0; i < cards_count; i++){
+        u32 c = (turn + i) % cards_count;
+        if(it->heads[c].valid && (best == NO_CARD || it->heads[c].timestamp < it->heads[best].timestamp)){
+            best = c;
+        }
+    }
+    if(best == NO_CARD){
+        return ESP_ERR_NOT_FOUND;
+    }
+    if(best == it->turn_card && it->turn_left){
+        it->turn_left--;
+    }
+    else {
+        it->turn_card = best;
+        it->turn_left = it->stripe->frames_per_card - 0x1;
+    }
+
+    isacfs_stripe_head_t* head = it->heads + best;
+    *file_meta = head->file_meta;
+    *data = head->data;
+    if(card){
+        *card = best;
+    }
+    it->last = best;
+    return head->res;
+}
+
+void isacfs_stripe_iter_close(isacfs_stripe_iter_t* it){
+    if(it->iters){
+        for(u32 i = 0x0; i < it->stripe->cards_count; i++){
+            if(it->iters[i]){
+                isacfs_iter_close(it->iters[i]);
+            }
+        }
+        free(it->iters);
+    }
+    free(it->heads);
+    free(it);
+}
@@ -1,11 +1,63 @@
-#include <Arduino.h>
-#include "driver/sdmmc_host.h"
-#include "driver/sdmmc_defs.h"
-#include "sdmmc_cmd.h"
-#include "esp_vfs_fat.h"
+#include "microSD.hpp"
+#include "isacfs_stats.hpp"
+
+static const micro_sd_backend_t *backend_p = NULL;
+
+#ifndef ISACFS_HOST
+#include "esp_idf_version.h"
 
 static sdmmc_card_t *sdmmc_p;
 
+static esp_err_t __sdmmc_read_sectors(void* ctx, void* dst, size_t start_sector, size_t sector_count){
+    return sdmmc_read_sectors((sdmmc_card_t*)ctx, dst, start_sector, sector_count);
+}
+
+static esp_err_t __sdmmc_write_sectors(void* ctx, const void* src, size_t start_sector, size_t sector_count){
+    return sdmmc_write_sectors((sdmmc_card_t*)ctx, src, start_sector, sector_count);
+}
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+static esp_err_t __sdmmc_erase_sectors(void* ctx, size_t start_sector, size_t sector_count){
+    return sdmmc_erase_sectors((sdmmc_card_t*)ctx, start_sector, sector_count, SDMMC_ERASE_ARG);
+}
+#endif
+
+static int __sdmmc_get_sectors_count(void* ctx){
+    return ((sdmmc_card_t*)ctx)->csd.capacity;
+}
+
+static int __sdmmc_get_sector_size(void* ctx){
+    return ((sdmmc_card_t*)ctx)->csd.sector_size;
+}
+
+static void __sdmmc_print_csd(void* ctx){
+    sdmmc_card_t* card = (sdmmc_card_t*)ctx;
+    Serial.println("SD MMC CSD\r\n--------------------");
+    Serial.println("Capacity: " + String(card->csd.capacity));
+    Serial.println("Command class: " + String(card->csd.card_command_class));
+    Serial.println("CSD ver: " + String(card->csd.csd_ver));
+    Serial.println("MMC ver: " + String(card->csd.mmc_ver));
+    Serial.println("Read blk len: " + String(card->csd.read_block_len));
+    Serial.println("Sector size: " + String(card->csd.sector_size));
+    Serial.println("Tr speed: " + String(card->csd.tr_speed));
+    Serial.println();
+}
+
+static micro_sd_backend_t sdmmc_backend = {
+    __sdmmc_read_sectors,
+    __sdmmc_write_sectors,
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    __sdmmc_erase_sectors,
+#else
+    NULL,
+#endif
+    __sdmmc_get_sectors_count,
+    __sdmmc_get_sector_size,
+    __sdmmc_print_csd,
+    NULL,
+    NULL
+};
+
 esp_err_t init_sdcard()
 {
   esp_err_t ret = ESP_FAIL;
@@ -17,49 +69,152 @@ esp_err_t init_sdcard()
   };
 
   ret = esp_vfs_fat_sdmmc_mount("/sdcard", &host, &slot_config, &mount_config, &sdmmc_p);
+  if(ret == ESP_OK){
+      sdmmc_backend.ctx = sdmmc_p;
+      backend_p = &sdmmc_backend;
+  }
 
   return ret;
 }
 
+#define SDMMC_SLOTS_COUNT 0x2
+
+static sdmmc_card_t slot_cards[SDMMC_SLOTS_COUNT];
+static micro_sd_backend_t slot_backends[SDMMC_SLOTS_COUNT];
+
+esp_err_t init_sdcard_slot(int slot, const micro_sd_backend_t **backend)
+{
+  if(slot < 0 || slot >= SDMMC_SLOTS_COUNT){
+      return ESP_ERR_INVALID_ARG;
+  }
+  sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+  host.slot = slot;
+  sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+
+  esp_err_t ret = sdmmc_host_init();
+  if(ret != ESP_OK && ret != ESP_ERR_INVALID_STATE){ // ESP_ERR_INVALID_STATE - already brought up for the other slot
+      return ret;
+  }
+  ret = sdmmc_host_init_slot(slot, &slot_config);
+  if(ret != ESP_OK){
+      return ret;
+  }
+  ret = sdmmc_card_init(&host, slot_cards + slot);
+  if(ret != ESP_OK){
+      return ret;
+  }
+  slot_backends[slot] = sdmmc_backend;
+  slot_backends[slot].ctx = slot_cards + slot;
+  *backend = slot_backends + slot;
+  return ret;
+}
+#else
+esp_err_t init_sdcard()
+{
+    return backend_p ? ESP_OK : ESP_ERR_INVALID_STATE; // the host backend is set with "micro_sd_set_backend"
+}
+
+esp_err_t init_sdcard_slot(int, const micro_sd_backend_t **)
+{
+    return ESP_ERR_NOT_SUPPORTED; // the host cards are opened with "micro_sd_sim_open"
+}
+#endif
+
+void micro_sd_set_backend(const micro_sd_backend_t* backend){
+    backend_p = backend;
+}
+
+esp_err_t micro_sd_read_sectors_on(const micro_sd_backend_t* backend, void* dst, size_t start_sector, size_t sector_count){
+    backend = backend ? backend : backend_p;
+    ISACFS_STATS_BEGIN(t0, backend);
+    esp_err_t res = backend->read_sectors(backend->ctx, dst, start_sector, sector_count);
+    ISACFS_STATS_END(isacfs_op_card_read, t0, backend, res == ESP_OK);
+    ISACFS_STATS_ADD(sectors_read, sector_count);
+    return res;
+}
+
+esp_err_t micro_sd_write_sectors_on(const micro_sd_backend_t* backend, const void* src, size_t start_sector, size_t sector_count){
+    backend = backend ? backend : backend_p;
+    ISACFS_STATS_BEGIN(t0, backend);
+    esp_err_t res = backend->write_sectors(backend->ctx, src, start_sector, sector_count);
+    ISACFS_STATS_END(isacfs_op_card_write, t0, backend, res == ESP_OK);
+    ISACFS_STATS_ADD(sectors_written, sector_count);
+    return res;
+}
+
+esp_err_t micro_sd_erase_sectors_on(const micro_sd_backend_t* backend, size_t start_sector, size_t sector_count){
+    backend = backend ? backend : backend_p;
+    if(!backend->erase_sectors){
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    ISACFS_STATS_BEGIN(t0, backend);
+    esp_err_t res = backend->erase_sectors(backend->ctx, start_sector, sector_count);
+    ISACFS_STATS_END(isacfs_op_card_erase, t0, backend, res == ESP_OK);
+    ISACFS_STATS_ADD(sectors_erased, sector_count);
+    return res;
+}
+
+int micro_sd_get_sectors_count_on(const micro_sd_backend_t* backend){
+    backend = backend ? backend : backend_p;
+    return backend->get_sectors_count(backend->ctx);
+}
+
+int micro_sd_get_sector_size_on(const micro_sd_backend_t* backend){
+    backend = backend ? backend : backend_p;
+    return backend->get_sector_size(backend->ctx);
+}
+
+uint8_t micro_sd_get_sector_addr_width_on(const micro_sd_backend_t* backend){
+    uint8_t addr_width = 0x1;
+    int cap = micro_sd_get_sectors_count_on(backend);
+    while((0x1 << addr_width) < cap){
+        addr_width++;
+    }
+    return addr_width;
+}
+
+int micro_sd_get_offset_addr_width_on(const micro_sd_backend_t* backend){
+    int offset_width = 0x0;
+    int sector_size = micro_sd_get_sector_size_on(backend);
+    while((0x1 << offset_width) < sector_size){
+        offset_width++;
+    }
+    return offset_width; // == csd.read_block_len on the SDMMC cards
+}
+
+uint64_t micro_sd_clock_us_on(const micro_sd_backend_t* backend){
+    backend = backend ? backend : backend_p;
+    return backend->clock_us ? backend->clock_us(backend->ctx) : (uint64_t)micros();
+}
+
 esp_err_t micro_sd_read_sectors(void* dst, size_t start_sector, size_t sector_count){
-    return sdmmc_read_sectors(sdmmc_p, dst, start_sector, sector_count);
+    return micro_sd_read_sectors_on(NULL, dst, start_sector, sector_count);
 }
 
 esp_err_t micro_sd_write_sectors(const void* src, size_t start_sector, size_t sector_count){
-    return sdmmc_write_sectors(sdmmc_p, src, start_sector, sector_count);
+    return micro_sd_write_sectors_on(NULL, src, start_sector, sector_count);
+}
+
+esp_err_t micro_sd_erase_sectors(size_t start_sector, size_t sector_count){
+    return micro_sd_erase_sectors_on(NULL, start_sector, sector_count);
 }
 
 void micro_sd_print_csd(){
-    Serial.println("SD MMC CSD\r\n--------------------");
-    Serial.println("Capacity: " + String(sdmmc_p->csd.capacity));
-    Serial.println("Command class: " + String(sdmmc_p->csd.card_command_class));
-    Serial.println("CSD ver: " + String(sdmmc_p->csd.csd_ver));
-    Serial.println("MMC ver: " + String(sdmmc_p->csd.mmc_ver));
-    Serial.println("Read blk len: " + String(sdmmc_p->csd.read_block_len));
-    Serial.println("Sector size: " + String(sdmmc_p->csd.sector_size));
-    Serial.println("Tr speed: " + String(sdmmc_p->csd.tr_speed));
-    Serial.println();
+    backend_p->print_info(backend_p->ctx);
 }
 
 int micro_sd_get_sectors_count(){
-    return sdmmc_p->csd.capacity;
+    return micro_sd_get_sectors_count_on(NULL);
 }
 
 int micro_sd_get_sector_size(){
-    return sdmmc_p->csd.sector_size;
+    return micro_sd_get_sector_size_on(NULL);
 }
 
 uint8_t micro_sd_get_sector_addr_width(){
-    uint8_t addr_width = 0x1;
-    static int cap;
-    cap = sdmmc_p->csd.capacity;
-    while((0x1 << addr_width) < cap){
-        addr_width++;
-    }
-    return addr_width;
+    return micro_sd_get_sector_addr_width_on(NULL);
 }
 
 int micro_sd_get_offset_addr_width(){
-
-    return sdmmc_p->csd.read_block_len;
-}
\ No newline at end of file
+    return micro_sd_get_offset_addr_width_on(NULL);
+}
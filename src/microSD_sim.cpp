@@ -0,0 +1,267 @@
+#ifdef ISACFS_HOST
+#include "microSD_sim.hpp"
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#define SIM_SECTOR_SIZE 0x200
+#define SIM_DRIVER_COMMANDS(buf, sector_count) (((uintptr_t)(buf) & 0x3) ? (sector_count) : 0x1) // single-block transfers unless DMA-capable
+
+const micro_sd_sim_latency_t MICRO_SD_SIM_DEFAULT_LATENCY = {
+    150,  // cmd_overhead_us
+    25,   // read_sector_us
+    30,   // write_sector_us
+    1500, // random_write_penalty_us
+    8,    // small_write_sectors
+    2000, // erase_mib_us
+    30    // overwrite_sector_us
+};
+
+struct micro_sd_sim {
+    mutable pthread_mutex_t lock; // commands from several tasks are serialized, like on the SDMMC host; so are the stats and the clock
+    int fd;
+    uint8_t* map; // NULL - pread/pwrite
+    size_t sector_count;
+    micro_sd_sim_latency_t latency;
+    micro_sd_sim_stats_t stats;
+    uint64_t clock_us;
+    size_t next_write_sector; // where a sequential write would continue
+    uint8_t* written; // bit per sector - holds data, not erased since
+    micro_sd_backend_t backend;
+};
+
+/**
+ * @brief Mark the sectors written (erased) && count the ones that held data
+*/
+static size_t __sim_mark_sectors(micro_sd_sim_t* sim, size_t start_sector, size_t sector_count, bool written){
+    size_t held = 0x0;
+    for(size_t i = start_sector; i < start_sector + sector_count; i++){
+        uint8_t bit = 0x1 << (i & 0x7);
+        if(sim->written[i >> 0x3] & bit){
+            held++;
+        }
+        if(written){
+            sim->written[i >> 0x3] |= bit;
+        }
+        else {
+            sim->written[i >> 0x3] &= ~bit;
+        }
+    }
+    return held;
+}
+
+static esp_err_t __sim_read_sectors(void* ctx, void* dst, size_t start_sector, size_t sector_count){
+    micro_sd_sim_t* sim = (micro_sd_sim_t*)ctx;
+    if(start_sector + sector_count > sim->sector_count){
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t len = sector_count * SIM_SECTOR_SIZE;
+    off_t pos = (off_t)start_sector * SIM_SECTOR_SIZE;
+    pthread_mutex_lock(&sim->lock);
+    if(sim->map){
+        memcpy(dst, sim->map + pos, len);
+    }
+    else if(pread(sim->fd, dst, len, pos) != (ssize_t)len){
+        pthread_mutex_unlock(&sim->lock);
+        return ESP_FAIL;
+    }
+
+    size_t commands = SIM_DRIVER_COMMANDS(dst, sector_count);
+    sim->stats.commands += commands;
+    sim->stats.read_commands += commands;
+    sim->stats.sectors_read += sector_count;
+    uint64_t cost = (uint64_t)sim->latency.cmd_overhead_us * commands + (uint64_t)sim->latency.read_sector_us * sector_count;
+    sim->stats.busy_us += cost;
+    sim->clock_us += cost;
+    pthread_mutex_unlock(&sim->lock);
+    return ESP_OK;
+}
+
+static esp_err_t __sim_write_sectors(void* ctx, const void* src, size_t start_sector, size_t sector_count){
+    micro_sd_sim_t* sim = (micro_sd_sim_t*)ctx;
+    if(start_sector + sector_count > sim->sector_count){
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t len = sector_count * SIM_SECTOR_SIZE;
+    off_t pos = (off_t)start_sector * SIM_SECTOR_SIZE;
+    pthread_mutex_lock(&sim->lock);
+    if(sim->map){
+        memcpy(sim->map + pos, src, len);
+    }
+    else if(pwrite(sim->fd, src, len, pos) != (ssize_t)len){
+        pthread_mutex_unlock(&sim->lock);
+        return ESP_FAIL;
+    }
+
+    size_t commands = SIM_DRIVER_COMMANDS(src, sector_count);
+    sim->stats.commands += commands;
+    sim->stats.write_commands += commands;
+    sim->stats.sectors_written += sector_count;
+    size_t overwritten = __sim_mark_sectors(sim, start_sector, sector_count, true);
+    sim->stats.sectors_overwritten += overwritten;
+    uint64_t cost = (uint64_t)sim->latency.cmd_overhead_us * commands + (uint64_t)sim->latency.write_sector_us * sector_count
+                    + (uint64_t)sim->latency.overwrite_sector_us * overwritten;
+    if(sector_count <= sim->latency.small_write_sectors && start_sector != sim->next_write_sector){
+        sim->stats.random_writes++;
+        cost += sim->latency.random_write_penalty_us;
+    }
+    sim->next_write_sector = start_sector + sector_count;
+    sim->stats.busy_us += cost;
+    sim->clock_us += cost;
+    pthread_mutex_unlock(&sim->lock);
+    return ESP_OK;
+}
+
+static esp_err_t __sim_erase_sectors(void* ctx, size_t start_sector, size_t sector_count){
+    micro_sd_sim_t* sim = (micro_sd_sim_t*)ctx;
+    if(start_sector + sector_count > sim->sector_count){
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t len = sector_count * SIM_SECTOR_SIZE;
+    off_t pos = (off_t)start_sector * SIM_SECTOR_SIZE;
+    pthread_mutex_lock(&sim->lock);
+    if(fallocate(sim->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pos, len) != 0){
+        static const uint8_t zero[SIM_SECTOR_SIZE] = {0x0};
+        for(size_t i = 0x0; i < sector_count; i++){
+            if(pwrite(sim->fd, zero, SIM_SECTOR_SIZE, pos + (off_t)i * SIM_SECTOR_SIZE) != SIM_SECTOR_SIZE){
+                pthread_mutex_unlock(&sim->lock);
+                return ESP_FAIL;
+            }
+        }
+    }
+
+    __sim_mark_sectors(sim, start_sector, sector_count, false);
+    sim->stats.commands++;
+    sim->stats.erase_commands++;
+    sim->stats.sectors_erased += sector_count;
+    uint64_t cost = sim->latency.cmd_overhead_us + (uint64_t)sim->latency.erase_mib_us * sector_count / 2048U;
+    sim->stats.busy_us += cost;
+    sim->clock_us += cost;
+    pthread_mutex_unlock(&sim->lock);
+    return ESP_OK;
+}
+
+static int __sim_get_sectors_count(void* ctx){
+    return (int)((micro_sd_sim_t*)ctx)->sector_count;
+}
+
+static int __sim_get_sector_size(void*){
+    return SIM_SECTOR_SIZE;
+}
+
+static uint64_t __sim_clock_us(void* ctx){
+    return micro_sd_sim_clock_us((micro_sd_sim_t*)ctx);
+}
+
+static void __sim_print_info(void* ctx){
+    micro_sd_sim_t* sim = (micro_sd_sim_t*)ctx;
+    Serial.printf("SIM CARD\r\n--------------------\r\nCapacity: %zu\r\nSector size: %d\r\nMapped: %d\r\n\r\n",
+                  sim->sector_count, SIM_SECTOR_SIZE, sim->map != NULL);
+}
+
+micro_sd_sim_t* micro_sd_sim_open_no_erase(const char* image_path, size_t sector_count, bool use_mmap){
+    micro_sd_sim_t* sim = micro_sd_sim_open(image_path, sector_count, use_mmap);
+    if(sim){
+        sim->backend.erase_sectors = NULL;
+    }
+    return sim;
+}
+
+micro_sd_sim_t* micro_sd_sim_open(const char* image_path, size_t sector_count, bool use_mmap){
+    micro_sd_sim_t* sim = (micro_sd_sim_t*)calloc(1, sizeof(micro_sd_sim_t));
+    if(!sim){
+        return NULL;
+    }
+    sim->fd = open(image_path, O_RDWR | O_CREAT, 0644);
+    if(sim->fd < 0){
+        free(sim);
+        return NULL;
+    }
+    size_t len = sector_count * SIM_SECTOR_SIZE;
+    if(ftruncate(sim->fd, (off_t)len) != 0){
+        close(sim->fd);
+        free(sim);
+        return NULL;
+    }
+    if(use_mmap){
+        void* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, sim->fd, 0);
+        if(map == MAP_FAILED){
+            close(sim->fd);
+            free(sim);
+            return NULL;
+        }
+        sim->map = (uint8_t*)map;
+    }
+    sim->written = (uint8_t*)calloc((sector_count + 0x7) >> 0x3, 0x1); // a blank card
+    if(!sim->written){
+        if(sim->map){
+            munmap(sim->map, len);
+        }
+        close(sim->fd);
+        free(sim);
+        return NULL;
+    }
+    pthread_mutex_init(&sim->lock, NULL);
+    sim->sector_count = sector_count;
+    sim->latency = MICRO_SD_SIM_DEFAULT_LATENCY;
+    sim->next_write_sector = (size_t)-1;
+    sim->backend.read_sectors = __sim_read_sectors;
+    sim->backend.write_sectors = __sim_write_sectors;
+    sim->backend.erase_sectors = __sim_erase_sectors;
+    sim->backend.get_sectors_count = __sim_get_sectors_count;
+    sim->backend.get_sector_size = __sim_get_sector_size;
+    sim->backend.print_info = __sim_print_info;
+    sim->backend.clock_us = __sim_clock_us;
+    sim->backend.ctx = sim;
+    return sim;
+}
+
+void micro_sd_sim_close(micro_sd_sim_t* sim){
+    if(sim->map){
+        munmap(sim->map, sim->sector_count * SIM_SECTOR_SIZE);
+    }
+    close(sim->fd);
+    pthread_mutex_destroy(&sim->lock);
+    free(sim->written);
+    free(sim);
+}
+
+const micro_sd_backend_t* micro_sd_sim_backend(micro_sd_sim_t* sim){
+    return &sim->backend;
+}
+
+void micro_sd_sim_mark_written(micro_sd_sim_t* sim){
+    pthread_mutex_lock(&sim->lock);
+    memset(sim->written, 0xFF, (sim->sector_count + 0x7) >> 0x3);
+    pthread_mutex_unlock(&sim->lock);
+}
+
+void micro_sd_sim_set_latency(micro_sd_sim_t* sim, const micro_sd_sim_latency_t* latency){
+    pthread_mutex_lock(&sim->lock);
+    sim->latency = *latency;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+void micro_sd_sim_get_stats(const micro_sd_sim_t* sim, micro_sd_sim_stats_t* stats){
+    pthread_mutex_lock(&sim->lock);
+    *stats = sim->stats;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+void micro_sd_sim_reset_stats(micro_sd_sim_t* sim){
+    pthread_mutex_lock(&sim->lock);
+    memset(&sim->stats, 0x0, sizeof(sim->stats));
+    pthread_mutex_unlock(&sim->lock);
+}
+
+uint64_t micro_sd_sim_clock_us(const micro_sd_sim_t* sim){
+    pthread_mutex_lock(&sim->lock);
+    uint64_t clock_us = sim->clock_us;
+    pthread_mutex_unlock(&sim->lock);
+    return clock_us;
+}
+#endif
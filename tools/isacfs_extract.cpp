@@ -0,0 +1,456 @@
+/**
+ * @brief Pull the frames off an isacfs card image or card reader block device (host build)
+ * @note g++ -std=c++17 -O2 -DISACFS_HOST -Iinclude src/isacfs.cpp src/isacfs_os.cpp src/isacfs_stats.cpp src/microSD.cpp tools/isacfs_extract.cpp -lpthread -o isacfs_extract
+ * @note usage: isacfs_extract [-j threads] [-b begin] [-e end] [-o dir] [-x ext] [-l] [-s] image
+ * @note -b/-e "YYYY-MM-DD HH:MM:SS[.mmm]" (or with a 'T'), both inclusive; -l lists the frames, -s prints the totals - nothing is written with either
+ * @note The card is mapped read-only; the descriptor log is cut into chunks of frames and every worker thread decodes
+ *       the chunks it takes with an isacfs instance of its own, writing each frame straight from the mapping
+ *       (no read buffer) to a file named by its timestamp and its sequence number (isacfs_desc_16B) or its index in the range
+*/
+#include "isacfs.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define EXTRACT_SECTOR_SIZE 0x200
+#define EXTRACT_CHUNK_FRAMES 0x1000 // frames per work item
+
+typedef struct {
+    u32 threads;
+    bool has_begin;
+    bool has_end;
+    isacfs_file_meta begin;
+    isacfs_file_meta end;
+    const char* out_dir;
+    const char* extension;
+    bool list;
+    bool stat;
+    const char* image_path;
+} extract_config_t;
+
+/* the mapped card - every isacfs instance reads it through the backend */
+typedef struct {
+    const u8* map;
+    size_t sector_count;
+    micro_sd_backend_t backend;
+} extract_card_t;
+
+typedef struct {
+    u32 meta_sector; // first frame of the chunk
+    u32 meta_offset;
+    u64 first_index; // its index in the range
+    u32 frames;
+} extract_chunk_t;
+
+/* per chunk results - the listing goes out in the chunk order */
+typedef struct {
+    u64 frames;
+    u64 bytes;
+    u32 min_size;
+    u32 max_size;
+    std::string listing;
+    bool done;
+    bool failed;
+} extract_result_t;
+
+typedef struct {
+    const extract_config_t* config;
+    extract_card_t* card;
+    std::vector<extract_chunk_t>* chunks;
+    std::vector<extract_result_t>* results;
+    std::atomic<u32>* next_chunk;
+    std::atomic<bool>* failed;
+    std::mutex* lock;
+    std::condition_variable* chunk_done;
+} extract_worker_t;
+
+static esp_err_t __extract_read_sectors(void* ctx, void* dst, size_t start_sector, size_t sector_count){
+    extract_card_t* card = (extract_card_t*)ctx;
+    if(start_sector + sector_count > card->sector_count){
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, card->map + start_sector * EXTRACT_SECTOR_SIZE, sector_count * EXTRACT_SECTOR_SIZE);
+    return ESP_OK;
+}
+
+static esp_err_t __extract_write_sectors(void*, const void*, size_t, size_t){
+    return ESP_ERR_NOT_SUPPORTED; // the card is never written
+}
+
+static int __extract_get_sectors_count(void* ctx){
+    return (int)((extract_card_t*)ctx)->sector_count;
+}
+
+static int __extract_get_sector_size(void*){
+    return EXTRACT_SECTOR_SIZE;
+}
+
+static void __extract_print_info(void* ctx){
+    extract_card_t* card = (extract_card_t*)ctx;
+    printf("Card image: %zu sectors of %uB (read-only)\n", card->sector_count, EXTRACT_SECTOR_SIZE);
+}
+
+/**
+ * @brief Map the image (a file or a block device) read-only
+*/
+static esp_err_t __extract_map_card(const char* path, extract_card_t* card){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        printf("ERROR: can't open %s: %s [in __extract_map_card()]\n", path, strerror(errno));
+        return ESP_FAIL;
+    }
+    struct stat st;
+    u64 size = 0x0;
+    if(fstat(fd, &st) == 0x0){
+        size = st.st_size;
+        if(S_ISBLK(st.st_mode) && ioctl(fd, BLKGETSIZE64, &size) != 0x0){
+            size = 0x0;
+        }
+    }
+    if(size < EXTRACT_SECTOR_SIZE){
+        printf("ERROR: %s is empty or its size is unknown [in __extract_map_card()]\n", path);
+        close(fd);
+        return ESP_FAIL;
+    }
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0x0);
+    close(fd);
+    if(map == MAP_FAILED){
+        printf("ERROR: mmap of %s failed: %s [in __extract_map_card()]\n", path, strerror(errno));
+        return ESP_FAIL;
+    }
+    card->map = (const u8*)map;
+    card->sector_count = size / EXTRACT_SECTOR_SIZE;
+    card->backend.read_sectors = __extract_read_sectors;
+    card->backend.write_sectors = __extract_write_sectors;
+    card->backend.erase_sectors = NULL;
+    card->backend.get_sectors_count = __extract_get_sectors_count;
+    card->backend.get_sector_size = __extract_get_sector_size;
+    card->backend.print_info = __extract_print_info;
+    card->backend.ctx = card;
+    return ESP_OK;
+}
+
+/**
+ * @brief Open an isacfs instance on the mapped card and bind it to the calling thread
+*/
+static isacfs_t* __extract_mount(extract_card_t* card){
+    isacfs_t* fs = isacfs_open(&card->backend);
+    if(fs == NULL){
+        printf("ERROR: out of memory [in __extract_mount()]\n");
+        return NULL;
+    }
+    isacfs_bind(fs);
+    if(isacfs_init() != isacfs_ok){
+        printf("ERROR: not an isacfs card (or an unsupported geometry) [in __extract_mount()]\n");
+        isacfs_bind(NULL);
+        isacfs_close(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+static bool __extract_parse_time(const char* s, isacfs_file_meta* file_meta){
+    unsigned year, month, day, hour, minute, second, millisecond = 0x0;
+    char sep;
+    int n = sscanf(s, "%u-%u-%u%c%u:%u:%u.%u", &year, &month, &day, &sep, &hour, &minute, &second, &millisecond);
+    if(n < 0x7 || (sep != ' ' && sep != 'T') || year < YEAR_DIFF_REF || year > YEAR_DIFF_REF + 0x3F
+       || month < 0x1 || month > 12U || day < 0x1 || day > 31U || hour > 23U || minute > 59U || second > 59U || millisecond > 999U){
+        return false;
+    }
+    file_meta->year_diff = year - YEAR_DIFF_REF;
+    file_meta->month = month;
+    file_meta->day = day;
+    file_meta->hour = hour;
+    file_meta->minute = minute;
+    file_meta->second = second;
+    file_meta->millisecond = millisecond;
+    return true;
+}
+
+/**
+ * @brief The timestamp as a number that compares like the time
+*/
+static u64 __extract_time_key(const isacfs_file_meta* file_meta){
+    u64 t = file_meta->year_diff;
+    t = t * 13U + file_meta->month;
+    t = t * 32U + file_meta->day;
+    t = t * 24U + file_meta->hour;
+    t = t * 60U + file_meta->minute;
+    t = t * 60U + file_meta->second;
+    return t * 1000U + file_meta->millisecond;
+}
+
+static int __extract_format_time(const isacfs_file_meta* file_meta, char* out, size_t out_sz, char date_sep, char time_sep){
+    return snprintf(out, out_sz, "%04u-%02u-%02u%c%02u%c%02u%c%02u.%03u", YEAR_DIFF_REF + file_meta->year_diff,
+                    file_meta->month, file_meta->day, date_sep, file_meta->hour, time_sep, file_meta->minute,
+                    time_sep, file_meta->second, file_meta->millisecond);
+}
+
+/**
+ * @brief Write the frame from the mapping to a new file (both runs of a frame wrapping the card in one call)
+*/
+static esp_err_t __extract_write_frame(const char* path, const extract_card_t* card, const u64* pos, const u32* len, u32 runs){
+    struct iovec iov[0x2];
+    size_t card_size = card->sector_count * EXTRACT_SECTOR_SIZE;
+    for(u32 i = 0x0; i < runs; i++){
+        if(pos[i] + len[i] > card_size){
+            printf("ERROR: frame data past the end of the image [in __extract_write_frame()]\n");
+            return ESP_ERR_INVALID_SIZE;
+        }
+        iov[i].iov_base = (void*)(card->map + pos[i]);
+        iov[i].iov_len = len[i];
+        madvise((void*)((uintptr_t)iov[i].iov_base & ~(uintptr_t)0xFFF), len[i] + ((uintptr_t)iov[i].iov_base & 0xFFF), MADV_WILLNEED);
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        printf("ERROR: can't create %s: %s [in __extract_write_frame()]\n", path, strerror(errno));
+        return ESP_FAIL;
+    }
+    u32 first = 0x0;
+    while(first < runs){
+        ssize_t n = writev(fd, iov + first, runs - first);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            printf("ERROR: writing %s failed: %s [in __extract_write_frame()]\n", path, strerror(errno));
+            close(fd);
+            return ESP_FAIL;
+        }
+        while(first < runs && (size_t)n >= iov[first].iov_len){
+            n -= iov[first].iov_len;
+            first++;
+        }
+        if(first < runs){
+            iov[first].iov_base = (u8*)iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+    close(fd);
+    return ESP_OK;
+}
+
+static void __extract_worker(extract_worker_t* w){
+    isacfs_t* fs = __extract_mount(w->card);
+    bool seq = fs && isacfs_desc_size() == 0x10;
+    char name[0x40];
+    std::string path;
+    for(;;){
+        u32 c = w->next_chunk->fetch_add(0x1);
+        if(c >= w->chunks->size()){
+            break;
+        }
+        const extract_chunk_t* chunk = &(*w->chunks)[c];
+        extract_result_t* r = &(*w->results)[c];
+        r->min_size = 0xFFFFFFFF;
+        u32 meta_sector = chunk->meta_sector;
+        u32 meta_offset = chunk->meta_offset;
+        bool failed = fs == NULL;
+        for(u32 i = 0x0; i < chunk->frames && !failed && !w->failed->load(std::memory_order_relaxed); i++){
+            isacfs_file_meta file_meta;
+            u32 size;
+            if(isacfs_file_desc(&file_meta, &size, &meta_sector, &meta_offset) != ESP_OK){
+                printf("ERROR: bad descriptor at %u:%u [in __extract_worker()]\n", meta_sector, meta_offset);
+                failed = true;
+                break;
+            }
+            u64 pos[0x2];
+            u32 len[0x2];
+            u32 runs = isacfs_file_extents(&file_meta, pos, len);
+            u64 id = seq ? file_meta.sequence : chunk->first_index + i;
+            r->frames++;
+            r->bytes += size;
+            r->min_size = std::min(r->min_size, size);
+            r->max_size = std::max(r->max_size, size);
+            if(w->config->list){
+                char line[0x80];
+                int n = snprintf(line, sizeof(line), "%10llu  ", id);
+                n += __extract_format_time(&file_meta, line + n, sizeof(line) - n, ' ', ':');
+                snprintf(line + n, sizeof(line) - n, "  %10u  0x%llx%s\n", size, pos[0x0], runs > 0x1 ? " (wraps)" : "");
+                r->listing += line;
+            }
+            else if(!w->config->stat){
+                int n = __extract_format_time(&file_meta, name, sizeof(name), '_', '-');
+                snprintf(name + n, sizeof(name) - n, "_%08llu", id);
+                path.assign(w->config->out_dir);
+                path += '/';
+                path += name;
+                path += w->config->extension;
+                failed = __extract_write_frame(path.c_str(), w->card, pos, len, runs) != ESP_OK;
+            }
+            isacfs_next_meta(&meta_sector, &meta_offset);
+        }
+        if(failed){
+            w->failed->store(true);
+        }
+        std::lock_guard<std::mutex> guard(*w->lock);
+        r->failed = failed;
+        r->done = true;
+        w->chunk_done->notify_all();
+    }
+    if(fs){
+        isacfs_bind(NULL);
+        isacfs_close(fs);
+    }
+}
+
+/**
+ * @brief First frame of the range and the location past its last one
+*/
+static esp_err_t __extract_find_range(const extract_config_t* config, u32* begin_sector, u32* begin_offset, u32* end_sector, u32* end_offset){
+    isacfs_head_meta(end_sector, end_offset);
+    esp_err_t res = config->has_begin ? isacfs_find_meta(&config->begin, begin_sector, begin_offset)
+                                      : isacfs_oldest_meta(begin_sector, begin_offset);
+    if(res != ESP_OK){
+        return res;
+    }
+    if(config->has_end){
+        isacfs_file_meta key = config->end; // the first frame after the end (8B descriptors: after its second)
+        if(isacfs_desc_size() == 0x10){
+            key.millisecond++;
+        }
+        else{
+            key.second++;
+            key.millisecond = 0x0;
+        }
+        u32 s, o;
+        if(isacfs_find_meta(&key, &s, &o) == ESP_OK){
+            *end_sector = s;
+            *end_offset = o;
+        }
+    }
+    return ESP_OK;
+}
+
+static void __extract_usage(){
+    printf("usage: isacfs_extract [-j threads] [-b begin] [-e end] [-o dir] [-x ext] [-l] [-s] image\n");
+    printf("       begin/end: \"YYYY-MM-DD HH:MM:SS[.mmm]\", both inclusive\n");
+}
+
+int main(int argc, char** argv){
+    extract_config_t config = {};
+    config.threads = std::max(0x1U, std::thread::hardware_concurrency());
+    config.out_dir = ".";
+    config.extension = ".jpg";
+    int opt;
+    while((opt = getopt(argc, argv, "j:b:e:o:x:ls")) != -1){
+        switch(opt){
+            case 'j': config.threads = std::max(0x1, atoi(optarg)); break;
+            case 'b': config.has_begin = __extract_parse_time(optarg, &config.begin); if(!config.has_begin){ __extract_usage(); return 1; } break;
+            case 'e': config.has_end = __extract_parse_time(optarg, &config.end); if(!config.has_end){ __extract_usage(); return 1; } break;
+            case 'o': config.out_dir = optarg; break;
+            case 'x': config.extension = optarg; break;
+            case 'l': config.list = true; break;
+            case 's': config.stat = true; break;
+            default: __extract_usage(); return 1;
+        }
+    }
+    if(optind != argc - 1){
+        __extract_usage();
+        return 1;
+    }
+    config.image_path = argv[optind];
+    if(config.has_begin && config.has_end && __extract_time_key(&config.begin) > __extract_time_key(&config.end)){
+        printf("ERROR: the range ends before it begins [in main()]\n");
+        return 1;
+    }
+    if(!config.list && !config.stat && mkdir(config.out_dir, 0755) != 0x0 && errno != EEXIST){
+        printf("ERROR: can't create %s: %s [in main()]\n", config.out_dir, strerror(errno));
+        return 1;
+    }
+
+    extract_card_t card;
+    if(__extract_map_card(config.image_path, &card) != ESP_OK){
+        return 1;
+    }
+    isacfs_t* fs = __extract_mount(&card);
+    if(fs == NULL){
+        return 1;
+    }
+
+    /* cut the range into chunks - a walk over the descriptor locations only, nothing is decoded */
+    std::vector<extract_chunk_t> chunks;
+    u32 meta_sector, meta_offset, end_sector, end_offset;
+    isacfs_file_meta first, last;
+    if(__extract_find_range(&config, &meta_sector, &meta_offset, &end_sector, &end_offset) == ESP_OK){
+        u64 index = 0x0;
+        while(meta_sector != end_sector || meta_offset != end_offset){
+            if(index % EXTRACT_CHUNK_FRAMES == 0x0){
+                chunks.push_back({meta_sector, meta_offset, index, 0x0});
+            }
+            chunks.back().frames++;
+            index++;
+            isacfs_next_meta(&meta_sector, &meta_offset);
+        }
+    }
+    if(!chunks.empty()){
+        u32 s = chunks.front().meta_sector, o = chunks.front().meta_offset, size;
+        isacfs_file_desc(&first, &size, &s, &o);
+        s = end_sector;
+        o = end_offset;
+        isacfs_prev_meta(&s, &o);
+        isacfs_file_desc(&last, &size, &s, &o);
+    }
+    isacfs_bind(NULL);
+    isacfs_close(fs);
+
+    std::vector<extract_result_t> results(chunks.size());
+    std::atomic<u32> next_chunk(0x0);
+    std::atomic<bool> failed(false);
+    std::mutex lock;
+    std::condition_variable chunk_done;
+    extract_worker_t worker = {&config, &card, &chunks, &results, &next_chunk, &failed, &lock, &chunk_done};
+    std::vector<std::thread> threads;
+    for(u32 i = 0x0; i < std::min<size_t>(config.threads, chunks.size()); i++){
+        threads.emplace_back(__extract_worker, &worker);
+    }
+    for(size_t c = 0x0; c < results.size() && config.list; c++){
+        std::unique_lock<std::mutex> guard(lock);
+        chunk_done.wait(guard, [&]{ return results[c].done; });
+        guard.unlock();
+        fputs(results[c].listing.c_str(), stdout);
+        std::string().swap(results[c].listing);
+    }
+    for(std::thread& t : threads){
+        t.join();
+    }
+
+    u64 frames = 0x0, bytes = 0x0;
+    u32 min_size = 0xFFFFFFFF, max_size = 0x0;
+    for(const extract_result_t& r : results){
+        frames += r.frames;
+        bytes += r.bytes;
+        min_size = std::min(min_size, r.min_size);
+        max_size = std::max(max_size, r.max_size);
+    }
+    if(config.stat){
+        printf("frames: %llu, bytes: %llu", frames, bytes);
+        if(frames){
+            char t0[0x20], t1[0x20];
+            __extract_format_time(&first, t0, sizeof(t0), ' ', ':');
+            __extract_format_time(&last, t1, sizeof(t1), ' ', ':');
+            printf(", size min/avg/max: %u/%llu/%u\nfrom %s to %s", min_size, bytes / frames, max_size, t0, t1);
+        }
+        printf("\n");
+    }
+    munmap((void*)card.map, card.sector_count * EXTRACT_SECTOR_SIZE);
+    if(failed.load()){
+        return 1;
+    }
+    if(!config.list && !config.stat){
+        printf("%llu frames (%llu bytes) written to %s\n", frames, bytes, config.out_dir);
+    }
+    return 0;
+}